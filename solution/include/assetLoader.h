@@ -0,0 +1,91 @@
+#ifndef __ASSET_LOADER_H
+#define __ASSET_LOADER_H
+
+#include "workerPool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+class Mesh;
+class TextureContainer;
+namespace glimg
+{
+	class ImageSet;
+}
+
+// Decodes images and generates meshes on a worker pool while the GL thread goes on with the rest
+// of the start-up. finish() uploads every piece through a pixel buffer as soon as it is ready, so
+// loading takes about as long as the slowest asset instead of the sum of all of them.
+class AssetLoader
+{
+public:
+	explicit AssetLoader(int threads = 0);
+	// file i goes to target + i, a cubemap is six files starting at GL_TEXTURE_CUBE_MAP_POSITIVE_X;
+	// an up-to-date cooked container replaces the files and is mapped instead of decoded.
+	// Either way the texture ends up with a full mip chain: cooked levels or generated ones.
+	void addTexture(const std::string &name, GLuint texture, GLenum target, GLint internalFormat,
+		const char *const files[], int count, const std::string &cookedPath = "");
+	void addMesh(const std::string &name, Mesh *mesh);
+	// GL thread only; returns the wall time from the first add to the last upload
+	double finish();
+	void printReport() const;
+	int getThreadCount() const;
+	~AssetLoader();
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Asset
+	{
+		std::string name;
+		GLuint texture;
+		GLenum bindTarget;
+		GLint internalFormat;
+		bool cooked;
+		int facesLeft;			// the mip chain is built once the last face is in
+		size_t uploadBytes;
+		double decodeMs;
+		double uploadMs;
+		double readyMs;
+	};
+
+	// a file or a mesh, decoded by a worker and uploaded by finish()
+	struct Piece
+	{
+		size_t asset;
+		std::string file;
+		GLenum target;
+		glimg::ImageSet *image;
+		TextureContainer *container;
+		Mesh *mesh;
+		double decodeMs;
+		std::string error;
+	};
+
+	std::vector<Asset> assets;
+	std::deque<Piece> pieces;		// a deque keeps the workers' pointers valid while adding
+
+	std::mutex mutex;
+	std::condition_variable pieceReady;
+	std::deque<Piece*> ready;
+	size_t decoded;
+
+	GLuint pixelBuffer;
+	Clock::time_point start;
+	double totalMs;
+
+	// declared last so it is destroyed first: the workers are joined before the members they use go away
+	WorkerPool pool;
+
+	void submit(Piece *piece);
+	void decode(Piece *piece);
+	void uploadImage(Piece &piece);
+	void uploadContainer(Piece &piece);
+	static double elapsedMs(const Clock::time_point &from, const Clock::time_point &to);
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __BENCHMARKS_H
+#define __BENCHMARKS_H
+
+#include "lightSubsystem.h"
+
+#include <string>
+#include <glm/glm.hpp>
+
+// Microbenchmarks run with --bench <name>; all but vertices are CPU-side and need no GL context
+class Benchmarks
+{
+public:
+	static int run(const std::string &name);
+	static void printUsage();
+	// replaces the point lights with count of them at the same spots for the same seed, spread over the box
+	static void makeRandomPointLights(LightSubsystem &lss, int count, unsigned seed, const glm::vec3 &boxMin, const glm::vec3 &boxMax);
+private:
+	static int drawLookups();
+	static int physicsSteps();
+	static int sceneLoading();
+	static int transformBatches();
+	static int lightClustering();
+};
+
+#endif
@@ -3,15 +3,28 @@
 
 #include "graphicsSubsystem.h"
 #include "lightSubsystem.h"
+#include "physicsWorld.h"
 #include "material.h"
+#include "profiler.h"
+#include "sceneStore.h"
+#include "transformSystem.h"
+#include "settings.h"
 #include <glm/glm.hpp>
+#include <chrono>
 #include <set>
+#include <vector>
+#include <string>
 
 class Engine
 {
 public:
-	Engine();
-	static void timerMediator(int value);
+	Engine(bool headless = false, const RenderSettings &rs = RenderSettings(), const std::string &scenePath = SCENE_FILE);
+	int run();
+	int runBenchmark(int frames, const std::string &reportPath);
+	int runVertexBenchmark();
+	int runShadingBenchmark();
+
+	static void idleMediator();
 	static void drawCallMediator();
 	static void keyboardCallMediator(unsigned char key, int x, int y);
 	static void keyboardUpCallMediator(unsigned char key, int x, int y);
@@ -19,6 +32,7 @@ public:
 	static void mouseMotionCallMediator(int x, int y);
 	static void reshapeCallMediator(int w, int h);
 
+	int advance(double frameTime);
 	void workCycle();
 	void drawHandler();
 	void keyPressHandler(unsigned char key, int x, int y, bool pressed);
@@ -27,29 +41,50 @@ public:
 private:
 	GraphicsSubsystem gss;
 	LightSubsystem lss;
+	Profiler profiler;
+	bool initialized;
+
+	PhysicsWorld physics;
+	float renderAlpha;
+	std::vector<glm::mat4> lastBallTransforms;
 
-	Sphere ball;
-	Sphere lightSphere;
+	MeshRegistry meshRegistry;	// declared before the meshes, which release their geometry into it
+	Sphere ball;				// its levels of detail also draw the light markers
 	Plane plane;
 	Cube cube;
-	const float collisionCoord;
 
-	MaterialBlock ballMat;
-	MaterialBlock clothMat;
-	MaterialBlock woodMat;
+	SceneStore scene;
+	TransformSystem transforms;
+	std::vector<int> objectNodes;		// per scene object
+	std::vector<int> objectInstances;	// per scene object, in planeInstances or sceneBallInstances by its mesh
+	std::vector<int> ballNodes;			// per physics ball
+	std::vector<InstanceData> planeInstances;
+	std::vector<InstanceData> sceneBallInstances;
+	std::vector<InstanceData> ballInstances;
 
 	enum Key{ KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_MOUSE };
 	std::set<Key> pressedKey;
 	glm::vec2 mouseCoord;
 
-	bool useMotionBlur;
 	bool drawLightSources;
 
-	// motion blur
-	int framesPerFrame;
-	int curFrame;
+	// fixed step simulation
+	std::chrono::steady_clock::time_point lastTick;
+	double accumulator;
+
+	// frame rate / steps per frame printout
+	bool printStats;
+	double statTime;
+	int statFrames;
+	int statSteps;
+	int statMaxSteps;
+
+	static const int CUE_BALL = 0;
 
-	void setPlane(int index);
+	void applyScene();
+	void updateObjectInstances();
+	void rackBalls();
+	void scriptBenchmarkInput(int frame);
 };
 
 #endif
\ No newline at end of file
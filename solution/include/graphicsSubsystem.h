@@ -1,40 +1,70 @@
 #ifndef __GRAPHICS_SYBSYSTEM_H
 #define __GRAPHICS_SYBSYSTEM_H
 
+#include "assetLoader.h"
+#include "lightClusters.h"
 #include "lightSubsystem.h"
 #include "material.h"
+#include "programCache.h"
+#include "renderHandles.h"
+#include "renderQueue.h"
+#include "renderSettings.h"
 #include "sceneObjects.h"
 
 #include <string>
 #include <vector>
-#include <unordered_map>
 #include <algorithm>
 
 class GraphicsSubsystem
 {
 public:
 	GraphicsSubsystem();
-	int initGraphicsSubsystem();
+	// queues the textures on the loader; they are ready once finishLoading() returns
+	int initGraphicsSubsystem(AssetLoader &loader, bool offscreen = false, const RenderSettings &rs = RenderSettings());
+	double finishLoading(AssetLoader &loader);
+	RenderSettings &getSettings();
+	double getShaderLoadMs() const;
 	void reshape(int w, int h);
 
 	glm::vec3 getViewVector();
 	void setCamTarget(const glm::vec3 &camPos);
 	void rotateCam(const glm::vec3 &diff);
 
-	void shadowMapPass(const Mesh *target, LightSubsystem &lss);
-	void drawBall(const Sphere &ball);
-	void drawPlane(const Plane &plane, const std::string &textureName = "cloth");
-	void drawLight(const Mesh *reference, LightSubsystem &lss);
-	void drawSkybox(const Cube &cube);
+	void beginFrame();
+	// binds the forward path's target or the G-buffer
+	void beginScene();
+	// the normal matrices come with the transforms, see TransformSystem
+	InstanceData makeBallInstance(const glm::mat4 &modelToWorld, const glm::mat3 &normalModelToWorld,
+		const glm::mat4 &prevModelToWorld, MaterialId material) const;
+	InstanceData makePlaneInstance(const glm::mat4 &modelToWorld, const glm::mat3 &normalModelToWorld,
+		const glm::vec2 &textureScale, TextureId texture, MaterialId material) const;
+	// the instances from staticFirst on never move, their shadows are cached
+	void submitBalls(const Sphere &mesh, const std::vector<InstanceData> &instances, size_t staticFirst);
+	void submitPlanes(const Plane &mesh, const std::vector<InstanceData> &instances);
+	void submitLights(const Mesh *reference, LightSubsystem &lss);
+	void submitSkybox(const Cube &cube);
+	// the box the shadow casters stay in, the light frusta are fitted to it
+	void setShadowBounds(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+	// renders the balls submitted this frame, so it comes after the submits
+	void shadowMapPass(LightSubsystem &lss);
+	void flushQueue(QueuePass pass);
+	// lights the G-buffer into the forward path's target, deferred path only
+	void deferredLightingPass();
+	void motionBlurPass();
+	int getStateChangesIssued() const;
+	int getStateChangesSkipped() const;
+	int getTrianglesDrawn() const;
+	int getMaxLightsPerCluster() const;
+	int getClusterEntriesDropped() const;
+	int getShadowCastersDrawn() const;
+	// wall time of one instanced draw of the ball program into a tiny viewport, so vertex work dominates
+	double timeMeshDraws(const Mesh &mesh, unsigned instances, int repeats);
 
-	std::string getClothTexture();
-	std::string getWoodTexture();
+	// also bins the point lights into clusters for this frame's camera
 	void bindLighting(LightSubsystem &lss);
-	void bindMaterial(const MaterialBlock &matData);
+	void setMaterial(MaterialId material, const MaterialBlock &matData);
 	void setCam();
 	void swapBuffers();
-	void accumFrame(int cur, int n);
-	void returnFrame();
 	void clearBuffers();
 	~GraphicsSubsystem();
 private:
@@ -47,6 +77,24 @@ private:
 	const float maxCamDistance;
 
 	LightSubsystem lss;
+	RenderSettings settings;
+	ProgramCache programCache;
+	double shaderLoadMs;
+
+	bool headless;
+	GLuint screenFbo;
+	GLuint screenRenderbuffers[2];
+
+	// color + velocity target the scene is drawn into when motion blur is on
+	GLuint sceneFbo;
+	GLuint sceneTextures[2];
+	GLuint sceneDepthBuffer;
+	GLuint sceneTexUnit[2];
+	GLuint fullscreenVao;
+
+	GLuint gbufferFbo;
+	GLuint gbufferTextures[GBUFFER_COUNT];
+	GLint gbufferTexUnit[GBUFFER_COUNT];
 
 	glm::ivec2 windowSize;
 	glm::vec3 sphereCamRelPos;
@@ -54,33 +102,150 @@ private:
 	glm::vec3 camPos;
 	glm::vec3 viewVector;
 	glm::mat4 worldToCam;
+	glm::mat4 camProjection;
+	glm::mat4 prevWorldToCam;
+	float pixelsPerUnit;		// on-screen size of one unit at distance one, for choosing levels of detail
+	bool hasPrevCam;
+
+	ProgramHandle programs[PROGRAM_COUNT];
+	TextureHandle textures[TEXTURE_COUNT];
+	GLuint uniformBuffers[BLOCK_COUNT];
+
+	// per-instance attributes of the whole frame, uploaded once before the first instanced draw
+	GLuint instanceBuffer;
+	GLsizeiptr instanceBufferSize;
+	bool instancesUploaded;
 
-    std::unordered_map<std::string, GLuint> shaders;
-    std::unordered_map<std::string, GLuint> bindingIndexes;
-    std::unordered_map<std::string, GLuint> texUnits;
-    std::unordered_map<std::string, GLuint> uniformBuffers;
-    std::unordered_map<std::string, GLuint> textures;
+	// the shadow casters once more in the frame's instances, the moving ones apart from the static ones;
+	// the planes only cast into the cube maps
+	struct CasterRange
+	{
+		const Mesh *mesh;
+		unsigned first;
+		unsigned count;
+		int lod;
+	};
+	CasterRange dynamicCasters;
+	CasterRange staticCasters;
+	CasterRange planeCasters;
+	std::vector<int> instanceLods;
+	std::vector<InstanceData> markerInstances;	// the light markers, rebuilt by submitLights()
+	int trianglesDrawn;
 
-	GLuint sampler;
+	RenderQueue queue;
+	StateCache state;
+
+	// one sampler per material, refilled when the texture filter setting changes
+	GLuint samplers[MATERIAL_COUNT];
+	TextureFilter samplerFilter;
+	float maxAnisotropy;
 	GLuint shadowMapTextures[NUMBER_OF_LIGHTS];
 	GLuint shadowFbo[NUMBER_OF_LIGHTS];
+	GLuint shadowArrayTexture;
+	GLuint shadowArrayFbo;
+	GLuint shadowLayerFbo[NUMBER_OF_LIGHTS];	// one layer of the array each, the cached depth is copied in
 	GLint shadowTexUnit[NUMBER_OF_LIGHTS];
 	glm::mat4 modelLightWorldClip[NUMBER_OF_LIGHTS];
-    std::unordered_map<GLenum, std::unordered_map<std::string, GLuint> > programUniforms;
+	float lightProjScale;						// the largest of the light projections' y scales
+	glm::vec3 shadowBoundsMin;					// where the casters and their receivers can be
+	glm::vec3 shadowBoundsMax;
+	glm::vec3 casterBoundsMin;					// the box the light frusta are cut around, see fitCasterBounds()
+	glm::vec3 casterBoundsMax;
+
+	// the maps' size and depth format follow the shadow quality setting alone, not the window
+	ShadowQuality shadowQuality;
+	int shadowMapSize;
+	int cubeShadowSize;
+	GLenum shadowDepthFormat;
+
+	// the lights don't move, so the depth of the static casters is rendered once per light and kept.
+	// It is rebuilt when the frusta, the static casters or the shadow quality change; the moving casters
+	// are snapshotted too, and while none of them moves the maps of the last frame are still right
+	GLuint staticShadowTextures[NUMBER_OF_LIGHTS];
+	GLuint staticShadowFbo[NUMBER_OF_LIGHTS];
+	bool staticShadowsValid;
+	bool shadowMapsValid;
+	ShadowMode shadowMapsMode;
+	std::vector<glm::mat4> staticSnapshot;
+	std::vector<glm::mat4> planeSnapshot;
+	std::vector<glm::mat4> dynamicSnapshot;
+	int staticSnapshotLod;
+	int planeSnapshotLod;
+	int dynamicSnapshotLod;
+	int shadowCastersDrawn;
+
+	// SHADOW_CUBE: the distance to the light in the six faces of a cube map per light. The static
+	// casters are cached the same way, and only the faces the moving casters were or are in get
+	// the cached depth copied back and the moving casters drawn
+	GLuint cubeShadowTextures[NUMBER_OF_LIGHTS];
+	GLuint cubeShadowFbo[NUMBER_OF_LIGHTS];
+	GLuint staticCubeTextures[NUMBER_OF_LIGHTS];
+	GLuint staticCubeFbo[NUMBER_OF_LIGHTS];
+	GLuint cubeCopyFbo[2];					// read and draw, one face of each attached per copy
+	glm::vec3 cubeLightPos[NUMBER_OF_LIGHTS];
+	glm::mat4 cubeFaceClip[NUMBER_OF_LIGHTS][6];
+	float shadowRange;						// the distance stored as depth 1
+	int cubeDynamicFaces[NUMBER_OF_LIGHTS];	// the faces the moving casters were last drawn into
+	bool staticCubesValid;
+	glm::mat4 worldToLightMatrix;
+	glm::mat3 worldToLightITMatrix;
+
+	LightClusters clusters;
+	GLuint clusterBuffers[CLUSTER_BUFFER_COUNT];
+	GLuint clusterTextures[CLUSTER_BUFFER_COUNT];
+	GLint clusterTexUnit[CLUSTER_BUFFER_COUNT];
+	bool clusterOverflowReported;			// the lights not fitting the index buffer are warned about once
 
+	int createWindow();
+	int createHeadlessContext();
+	void createScreenTarget();
+	void createSceneTarget();
+	void reallocSceneTarget();
+	void createGBuffer();
+	void reallocGBuffer();
+	void destroyHeadlessContext();
 	void createDepthBuffer();
+	void createLayeredDepthBuffer();
+	void createCubeDepthBuffers();
+	void selectShadowQuality();
+	bool fitCasterBounds();
+	glm::mat4 calcLightFrustum(const glm::vec3 &lightPos);
+	void updateCubeFrusta(const std::vector<glm::vec3> &lightPositions);
+	int chooseCasterLod(const CasterRange &range, const std::vector<glm::vec3> &lightPositions, float texelsPerUnit) const;
+	int cubeFaceMask(const CasterRange &range, const glm::vec3 &lightPos) const;
+	bool updateCasterSnapshot(const CasterRange &range, std::vector<glm::mat4> &snapshot, int &snapshotLod) const;
+	void renderStaticShadows();
+	void copyStaticShadows(int light, GLuint targetFbo);
+	void shadowMapPassPerLight();
+	void shadowMapPassLayered();
+	void shadowMapPassCube(bool restoreAll);
+	void copyStaticCubeFaces(int light, int faces);
+	// the receivers' shadow uniforms and maps for the current shadow mode
+	void bindShadowMaps(const ProgramHandle &program);
+	void drawShadowCasters(const CasterRange &range);
 	void reallocShadowTextures();
-	void createSampler();
+	void createSamplers();
+	void createClusterBuffers();
+	void uploadClusterBuffer(ClusterBufferId id, const void *data, size_t size);
+	void bindClusterBuffers(const ProgramHandle &program);
+	void applyTextureFilter();
 	void loadShaders();
 	void loadUniforms();
 	void loadBuffers();
-	void loadTexture(const char *filename, GLuint &texture);
-	void loadCubemap(const char *filenames[], int csize, GLuint &texture);
+	void loadTexture(AssetLoader &loader, TextureId texture);
+	void loadCubemap(AssetLoader &loader, TextureId texture);
 
 	glm::vec3 resolveCamPosition();
 	glm::mat4 calcLookAtMatrix(const glm::vec3 &cameraPt, const glm::vec3 &lookPt, const glm::vec3 &upPt);
-	void loadUniforms(GLuint pr, const char *uniforms[], int usize, const char *blocks[], int bsize);
-	void loadTextureUnits(const char *textureUnits[], int tsize);
+	void loadUniforms(ProgramHandle &program);
+	void loadTextureUnits();
+	void bindTexture(TextureId texture);
+	int chooseLod(const Mesh *mesh, const glm::vec3 &center, float radius) const;
+	void uploadInstances();
+	void bindInstanceAttributes(const Mesh *mesh, unsigned firstInstance);
+	// adds the instances to the queue and submits one instanced packet for every level they use
+	void submitByLod(QueuePass pass, RenderPacket &packet, const std::vector<InstanceData> &instances);
+	void executePacket(const RenderPacket &packet);
 };
 
 #endif
\ No newline at end of file
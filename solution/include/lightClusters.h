@@ -0,0 +1,58 @@
+#ifndef __LIGHT_CLUSTERS_H
+#define __LIGHT_CLUSTERS_H
+
+#include "lightSubsystem.h"
+
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Point lights binned into the clusters of the view frustum: CLUSTER_TILES_X by CLUSTER_TILES_Y tiles of
+// the screen, each cut into CLUSTER_SLICES slices of depth. A light goes into every cluster inside the
+// screen rectangle and the depth range of its sphere. The fragment shader finds its cluster from the
+// window position and depth and only loops over the lights listed there, so its cost follows the
+// number of lights around it rather than in the scene.
+class LightClusters
+{
+public:
+	LightClusters();
+	// projection is the camera's symmetric perspective with the given planes
+	void build(const std::vector<PointLight> &lights, const glm::mat4 &worldToCam, const glm::mat4 &projection,
+		float zNear, float zFar);
+
+	// two texels for every light in view: camera space position and radius, intensity
+	const std::vector<glm::vec4> &getLightTexels() const;
+	// first index and light count of every cluster, by tile across, then up, then slice
+	const std::vector<uint32_t> &getGrid() const;
+	// the lights of the clusters one after another, as positions in getLightTexels() / 2
+	const std::vector<uint16_t> &getIndices() const;
+	// the slice of a camera space depth is log(depth) * scale + bias
+	glm::vec2 getSliceParams() const;
+	int getVisibleLights() const;
+	int getMaxLightsPerCluster() const;
+	// light entries the last build left out of their clusters because the index list outgrew its limit
+	int getDroppedEntries() const;
+	// the longest index list the renderer can read, unlimited by default
+	void setMaxIndices(uint32_t count);
+private:
+	struct Bounds
+	{
+		int first[3];
+		int last[3];
+	};
+
+	std::vector<glm::vec4> lightTexels;
+	std::vector<uint32_t> grid;
+	std::vector<uint16_t> indices;
+	std::vector<Bounds> bounds;
+	std::vector<uint32_t> filled;
+	glm::vec2 sliceParams;
+	uint32_t maxIndices;
+	int maxPerCluster;
+	uint32_t droppedEntries;
+
+	// tiles covered along one screen axis by a sphere at center across and depth ahead of the eye
+	static bool tileRange(float center, float depth, float radius, float projScale, int tiles, int &first, int &last);
+};
+
+#endif
@@ -10,8 +10,18 @@ struct PerLight
 	glm::vec4 lightIntensity;
 };
 
+// the shadow casting lights, every fragment is lit by all of them
 const int NUMBER_OF_LIGHTS = 3;
 
+// a light without shadows that reaches no further than its radius; only the fragments of the clusters
+// it touches are lit by it, see LightClusters
+struct PointLight
+{
+	glm::vec3 worldPos;
+	float radius;
+	glm::vec3 intensity;
+};
+
 struct LightBlock
 {
 	glm::vec4 ambientIntensity;
@@ -30,9 +40,18 @@ public:
 
 	void setLightIntesity(int index, const glm::vec4 &intesity);
 	void setLightWorldPos(int index, const glm::vec4 &worldPos);
+	void setAmbientIntensity(float intensity);
+	// the distance at which a light is at half its intensity
+	void setHalfLightDistance(float distance);
+
+	// false once MAX_POINT_LIGHTS are there
+	bool addPointLight(const glm::vec3 &worldPos, const glm::vec3 &intensity, float radius);
+	void clearPointLights();
+	const std::vector<PointLight> &getPointLights() const;
 private:
 	LightBlock lightData;
 	glm::vec4 lightsWorldPos[NUMBER_OF_LIGHTS];
+	std::vector<PointLight> pointLights;
 };
 
 #endif
\ No newline at end of file
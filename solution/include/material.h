@@ -8,7 +8,7 @@ struct MaterialBlock
 	glm::vec4 specularColor;
 	float specularShininess;
 	float reflectivity;
-	//float padding[2];
+	float padding[2];
 };
 
 
@@ -1,21 +1,62 @@
 #ifndef __MESH_H
 #define __MESH_H
 
+#include "meshRegistry.h"
+#include "meshOptimizer.h"
+
+#include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <string>
+#include <vector>
 
+// An object in the scene drawn with geometry from the mesh registry. Objects whose generator
+// parameters match, as told by getKey(), share the same geometry.
 class Mesh
 {
 public:
 	Mesh(const glm::vec3 &wp = glm::vec3(0.0));
-	virtual void load() = 0;
-	virtual void draw() const = 0;
+	// true when the geometry is already there and the mesh needs neither generate() nor upload()
+	bool attach(MeshRegistry &registry);
+	void load(MeshRegistry &registry);
+	virtual std::string getKey() const = 0;
+	// generates and optimizes the vertex data in memory only, so it can run on a loader thread
+	void build();
+	virtual void generate() = 0;
+	// hands the generated data to the registry and releases it; needs the context
+	void upload();
+
+	// the vertex array is shared by every mesh of a registry page, it must be bound before a draw
+	GLuint getVertexArray() const;
+	void draw(int lod = 0) const;
+	void drawInstanced(GLsizei instances, int lod = 0) const;
+	GLsizei getTriangleCount(int lod = 0) const;
+	// level 0 is the full mesh, a mesh without levels of detail only has that one
+	int getLodCount() const;
+	// the coarsest level whose outline strays at most maxError pixels from the true shape
+	// when the model's unit bounding sphere covers projectedRadius pixels
+	virtual int chooseLod(float projectedRadius, float maxError) const;
 	glm::mat4 getModelToWorldMat() const;
+	// cache efficiency of each level before and after build() reordered it
+	void printOptimizationReport() const;
 
 	glm::vec3 getWorldPos() const;
 	void setWorldPos(const glm::vec3 &wp);
-	virtual ~Mesh() {}
+	virtual ~Mesh();
 protected:
 	glm::vec3 worldPos;
+	std::vector<MeshVertex> vertexData;
+	std::vector<GLuint> indexData;
+	std::vector<MeshRange> lodRanges;
+private:
+	MeshRegistry *registry;
+	int geometry;
+	std::vector<MeshOptimizer::CacheStats> cacheBefore, cacheAfter;
+
+	void optimize();
+
+	// not copyable, the registry reference would be released twice
+	Mesh(const Mesh &);
+	Mesh &operator=(const Mesh &);
 };
 
-#endif
\ No newline at end of file
+#endif
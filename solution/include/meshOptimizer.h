@@ -0,0 +1,36 @@
+#ifndef __MESH_OPTIMIZER_H
+#define __MESH_OPTIMIZER_H
+
+#include "meshRegistry.h"
+
+#include <GL/glew.h>
+#include <vector>
+
+// Reorders the generated geometry of a mesh before it is uploaded: triangles for the post-transform
+// vertex cache, vertices for the order they are fetched in and, if asked, clusters of triangles so the
+// ones facing outwards are drawn first. Works on a single range, indices starting from 0.
+class MeshOptimizer
+{
+public:
+	// as measured on a FIFO cache of MESH_CACHE_SIZE entries
+	struct CacheStats
+	{
+		float acmr;		// vertices transformed per triangle, 0.5 at best for a big grid, 3 at worst
+		float atvr;		// vertices transformed per vertex used, 1 at best
+	};
+
+	static void optimize(std::vector<MeshVertex> &vertices, std::vector<GLuint> &indices, int overdrawCluster);
+	static CacheStats analyze(const std::vector<GLuint> &indices, size_t vertexCount);
+
+	// Forsyth's linear-speed optimization: greedily emits the triangle whose vertices score best on
+	// their cache position and the triangles they have left
+	static void optimizeVertexCache(std::vector<GLuint> &indices, size_t vertexCount);
+	// keeps the cache order of clusterSize triangle runs, drawing those facing away from the center first
+	static void optimizeOverdraw(const std::vector<MeshVertex> &vertices, std::vector<GLuint> &indices, int clusterSize);
+	// vertices in the order of their first use; the unused ones are dropped
+	static void optimizeVertexFetch(std::vector<MeshVertex> &vertices, std::vector<GLuint> &indices);
+private:
+	static float vertexScore(int cachePosition, unsigned trianglesLeft);
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef __MESH_REGISTRY_H
+#define __MESH_REGISTRY_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+// what the meshes generate
+struct MeshVertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texcoord;
+};
+
+enum VertexFormat
+{
+	VERTEX_FLOAT,	// MeshVertex as it is, 32 bytes
+	VERTEX_PACKED,	// PackedVertex, 16 bytes
+	VERTEX_FORMAT_COUNT
+};
+
+// half the size of MeshVertex and still read by the shaders as vec3/vec3/vec2
+struct PackedVertex
+{
+	GLushort position[4];	// half floats, w = 1
+	GLuint normal;			// signed normalized GL_INT_2_10_10_10_REV
+	GLshort texcoord[2];	// signed normalized, so only for coordinates within [-1, 1]
+};
+
+// a level of detail: indices from firstIndex on, offset by baseVertex
+struct MeshRange
+{
+	GLsizei firstIndex;
+	GLsizei indexCount;
+	GLint baseVertex;
+};
+
+// Geometry of every static mesh, packed into a few large vertex and index buffers that share one
+// vertex array per page. Meshes built from the same generator parameters share one entry, counted
+// by reference. Every range is drawn with a base vertex, so going from one mesh to another within a
+// page binds nothing and the indices of each range fit in 16 bits. Vertices are stored packed unless
+// a mesh is out of the packed range, then it goes to a page of float vertices.
+class MeshRegistry
+{
+public:
+	explicit MeshRegistry(VertexFormat format = VERTEX_PACKED);
+	// true when the key is new and the caller has to build and upload the geometry
+	bool acquire(const std::string &key, int &entry);
+	// the space of an unused entry is not reclaimed, a page is freed once all its entries are
+	void release(int entry);
+	// GL thread only; ranges are relative to the given vertices and indices
+	void upload(int entry, const std::vector<MeshVertex> &vertices, const std::vector<GLuint> &indices,
+		const std::vector<MeshRange> &ranges);
+
+	GLuint getVertexArray(int entry) const;
+	GLenum getIndexType(int entry) const;
+	GLsizeiptr getIndexSize(int entry) const;
+	int getRangeCount(int entry) const;
+	// relative to the page buffers, ready for glDrawElementsBaseVertex
+	const MeshRange &getRange(int entry, int range) const;
+
+	int getPageCount() const;
+	size_t getVertexBytes() const;
+	void printReport() const;
+	~MeshRegistry();
+private:
+	struct Page
+	{
+		GLuint vao;
+		GLuint vertexBuffer;
+		GLuint indexBuffer;
+		GLenum indexType;
+		VertexFormat format;
+		GLsizei vertexCapacity, indexCapacity;
+		GLsizei vertexCount, indexCount;
+		int entries;		// live entries, the buffers go with the last one
+	};
+
+	struct Entry
+	{
+		std::string key;
+		int refs;
+		int page;
+		std::vector<MeshRange> ranges;
+	};
+
+	VertexFormat preferredFormat;
+	std::vector<Page> pages;
+	std::vector<Entry> entries;
+	std::map<std::string, int> keys;
+
+	int findPage(GLsizei vertices, GLsizei indices, GLenum indexType, VertexFormat format);
+	void createPage(Page &page);
+	static bool fitsPacked(const std::vector<MeshVertex> &vertices);
+	static PackedVertex pack(const MeshVertex &v);
+	static GLsizeiptr getVertexSize(VertexFormat format);
+
+	// not copyable
+	MeshRegistry(const MeshRegistry &);
+	MeshRegistry &operator=(const MeshRegistry &);
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef __PHYSICS_WORLD_H
+#define __PHYSICS_WORLD_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+#include <vector>
+
+struct PhysicsParams
+{
+	PhysicsParams();
+
+	float ballRadius;
+	glm::vec2 tableHalfSize;	// cushion lines along x and z
+	float ballRestitution;
+	float cushionRestitution;
+	float rollingFriction;		// deceleration, units/s^2
+	float pocketRadius;
+	bool pockets;				// six pockets: four corners and the middles of the x cushions
+};
+
+// Balls rolling on the cloth. Positions are (x, z) on the table plane, the state is kept as
+// structure of arrays so the integration and the grid passes walk contiguous memory.
+// Collisions are continuous: a step finds the time of impact of every ball-ball and
+// ball-cushion contact and resolves them in time order, so fast balls never tunnel and
+// the step length only affects friction and the cue input.
+class PhysicsWorld
+{
+public:
+	PhysicsWorld(const PhysicsParams &p = PhysicsParams());
+	const PhysicsParams &getParams() const;
+	// removes the balls as well
+	void setParams(const PhysicsParams &p);
+
+	void clear();
+	int addBall(const glm::vec2 &pos, const glm::vec2 &vel = glm::vec2(0.0f));
+	void placeBall(int ball, const glm::vec2 &pos);
+	void accelerate(int ball, const glm::vec2 &dv, float maxSpeed);
+	void step(float dt);
+
+	int getBallCount() const;
+	int getActiveCount() const;
+	bool isPocketed(int ball) const;
+	glm::vec2 getVelocity(int ball) const;
+	// transforms are blended between the last two steps, alpha = 1 is the latest state
+	glm::vec3 getPosition(int ball, float alpha = 1.0f) const;
+	glm::quat getRotation(int ball, float alpha = 1.0f) const;
+	glm::mat4 getModelToWorldMat(int ball, float alpha = 1.0f) const;
+
+	// work done by the last step
+	int getCandidatePairs() const;
+	int getContacts() const;
+	int getEvents() const;
+private:
+	enum { CUSHION_X = -1, CUSHION_Z = -2 };
+
+	// a predicted contact; it is stale once either ball has collided with something else
+	struct Event
+	{
+		float time;
+		int a, b;				// b is a ball or one of the cushion ids
+		unsigned countA, countB;
+		// inverted so the standard heap keeps the earliest event on top
+		bool operator<(const Event &e) const { return time > e.time; }
+	};
+
+	PhysicsParams params;
+
+	std::vector<float> posX, posZ;
+	std::vector<float> velX, velZ;
+	std::vector<float> prevX, prevZ;
+	std::vector<glm::quat> rotation, prevRotation;
+	std::vector<unsigned char> active;
+
+	// balls are advanced lazily during a step, each one is at its own time
+	std::vector<float> ballTime;
+	std::vector<unsigned> ballEvents;
+
+	// uniform grid with cells as wide as two balls can close in one step,
+	// rebuilt every step by a counting sort
+	float cellSize;
+	int gridW, gridH;
+	std::vector<int> cellStart;
+	std::vector<int> cellBalls;
+	std::vector<int> ballCell;
+
+	// pairs that can meet during the step, also as per-ball neighbour lists
+	std::vector<glm::ivec2> pairs;
+	std::vector<int> neighbourStart;
+	std::vector<int> neighbours;
+	std::vector<Event> events;
+
+	int contacts;
+	int eventsResolved;
+
+	void applyFriction(float dt);
+	void buildGrid(float reach);
+	void findPairs(float dt);
+	void resolveEvents(float dt);
+	void predict(int ball, float now, float dt, bool allNeighbours);
+	void pushEvent(float time, int a, int b);
+	void advanceBall(int ball, float time);
+	void collideBalls(int a, int b);
+	void collideCushion(int ball, int cushion);
+	void separateOverlaps();
+	bool overPocket(int ball) const;
+	void collidePockets();
+};
+
+#endif
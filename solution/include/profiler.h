@@ -0,0 +1,104 @@
+#ifndef __PROFILER_H
+#define __PROFILER_H
+
+#include <GL/glew.h>
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+enum ProfilePass
+{
+	PASS_SIMULATION,
+	PASS_SHADOW,
+	PASS_SCENE,
+	PASS_LIGHTING,		// the deferred path's full-screen lighting
+	PASS_LIGHTS,
+	PASS_SKYBOX,
+	PASS_MOTION_BLUR,
+	PASS_PRESENT,
+	PASS_COUNT
+};
+
+enum ProfileCounter
+{
+	COUNTER_STATE_CHANGES,
+	COUNTER_STATE_CHANGES_SKIPPED,
+	COUNTER_PHYSICS_STEPS,
+	COUNTER_TRIANGLES,
+	COUNTER_MATRICES_UPDATED,
+	COUNTER_LIGHTS_PER_CLUSTER,	// the most point lights any cluster has
+	COUNTER_CLUSTER_DROPS,		// cluster entries left out because the index buffer is full
+	COUNTER_SHADOW_CASTERS,		// casters drawn into the shadow maps, none while nothing moves
+	COUNTER_COUNT
+};
+
+// measured once per run, from creating the context to the first frame
+enum StartupStage
+{
+	STARTUP_SHADERS,
+	STARTUP_ASSETS,
+	STARTUP_SCENE,
+	STARTUP_TOTAL,
+	STARTUP_COUNT
+};
+
+class Profiler
+{
+public:
+	Profiler();
+	void init();
+	void setEnabled(bool e);
+	bool isEnabled() const;
+	bool hasGpuTimers() const;
+	void reset();
+
+	void beginFrame();
+	void endFrame();
+	void beginPass(ProfilePass pass);
+	void endPass(ProfilePass pass);
+	void setCounter(ProfileCounter counter, double value);
+	void setStartupTime(StartupStage stage, double ms);
+
+	// mean of the pass over the frames since the last reset, on the GPU if it has timers
+	double getPassMs(ProfilePass pass) const;
+	void printSummary() const;
+	bool writeJson(const std::string &path, const std::string &label) const;
+	~Profiler();
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	struct Stats
+	{
+		double mean;
+		double p50;
+		double p95;
+		double p99;
+		double min;
+		double max;
+	};
+
+	bool enabled;
+	bool gpuTimers;
+	bool passUsed[PASS_COUNT];
+	GLuint queries[PASS_COUNT];
+
+	Clock::time_point frameStart;
+	Clock::time_point passStart[PASS_COUNT];
+
+	std::vector<double> frameTimes;
+	std::vector<double> passCpuTimes[PASS_COUNT];
+	std::vector<double> passGpuTimes[PASS_COUNT];
+	std::vector<double> counters[COUNTER_COUNT];
+	double startupTimes[STARTUP_COUNT];
+
+	static const char *passNames[PASS_COUNT];
+	static const char *counterNames[COUNTER_COUNT];
+	static const char *startupNames[STARTUP_COUNT];
+
+	static double elapsedMs(const Clock::time_point &from, const Clock::time_point &to);
+	static Stats computeStats(std::vector<double> samples);
+	static void writeStats(FILE *f, const Stats &s);
+};
+
+#endif
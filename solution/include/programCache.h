@@ -0,0 +1,44 @@
+#ifndef __PROGRAM_CACHE_H
+#define __PROGRAM_CACHE_H
+
+#include "shaderWorker.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+enum ShaderCacheMode
+{
+	SHADER_CACHE_OFF,		// always compile, nothing is written
+	SHADER_CACHE_ON,		// link from stored binaries, compile and store what is missing
+	SHADER_CACHE_REBUILD,	// compile everything and overwrite the stored binaries
+	SHADER_CACHE_MODE_COUNT
+};
+
+// Linked program binaries kept on disk between runs. An entry is keyed by a hash of the shader
+// sources, the defines and the driver strings, so an edited shader or an updated driver simply
+// misses; a binary the driver refuses to load falls back to compilation and is replaced.
+class ProgramCache
+{
+public:
+	ProgramCache();
+	void init(const std::string &directory, ShaderCacheMode m);
+	GLuint load(const std::vector<shaderStringPair> &filePathList, const std::string &defines = "");
+
+	int getHits() const;
+	int getCompiled() const;
+	int getRejected() const;
+private:
+	std::string dir;
+	std::string driver;
+	ShaderCacheMode mode;
+	int hits, compiled, rejected;
+
+	static uint64_t hash(const std::string &data, uint64_t h);
+	std::string entryPath(uint64_t key) const;
+	GLuint loadBinary(const std::string &path, uint64_t key);
+	void saveBinary(GLuint program, const std::string &path, uint64_t key);
+};
+
+#endif
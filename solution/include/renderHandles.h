@@ -0,0 +1,151 @@
+#ifndef __RENDER_HANDLES_H
+#define __RENDER_HANDLES_H
+
+#include <GL/glew.h>
+
+// Everything the draw paths touch is addressed by these ids; names are resolved once at load time.
+
+enum ProgramId
+{
+	PROGRAM_SHADOW,
+	PROGRAM_SIMPLE,
+	PROGRAM_SKYBOX,
+	PROGRAM_PLANE,
+	PROGRAM_BALL,
+	PROGRAM_SHADOW_LAYERED,
+	PROGRAM_PLANE_LAYERED,
+	PROGRAM_MOTION_BLUR,
+	PROGRAM_PLANE_DEFERRED,
+	PROGRAM_BALL_DEFERRED,
+	PROGRAM_DEFERRED_LIGHTING,
+	PROGRAM_DEFERRED_LIGHTING_LAYERED,
+	PROGRAM_SHADOW_CUBE,
+	PROGRAM_PLANE_CUBE,
+	PROGRAM_DEFERRED_LIGHTING_CUBE,
+	PROGRAM_COUNT
+};
+
+enum UniformId
+{
+	UNIFORM_MODEL_TO_WORLD,
+	UNIFORM_NORMAL_MODEL_TO_CAMERA,
+	UNIFORM_NORMAL_MODEL_TO_WORLD,
+	UNIFORM_MODEL_TO_LIGHT_TO_CLIP,
+	UNIFORM_WORLD_TO_LIGHT,
+	UNIFORM_WORLD_TO_LIGHT_IT,
+	UNIFORM_TEXTURE_SCALE,
+	UNIFORM_SHADOW_TEX_SIZE,
+	UNIFORM_COLOR_TEXTURE,
+	UNIFORM_SHADOW_TEXTURE,
+	UNIFORM_SKYBOX,
+	UNIFORM_CAM_POS,
+	UNIFORM_WORLD_TO_LIGHT_CLIP,
+	UNIFORM_SHADOW_TEXTURE_ARRAY,
+	UNIFORM_PREV_MODEL_TO_WORLD,
+	UNIFORM_SCENE_COLOR,
+	UNIFORM_SCENE_VELOCITY,
+	UNIFORM_BLUR_SCALE,
+	UNIFORM_POINT_LIGHTS,
+	UNIFORM_CLUSTER_GRID,
+	UNIFORM_CLUSTER_INDICES,
+	UNIFORM_CLUSTER_SIZE,
+	UNIFORM_CLUSTER_SCALE,
+	UNIFORM_GBUFFER_ALBEDO,
+	UNIFORM_GBUFFER_NORMAL,
+	UNIFORM_GBUFFER_VELOCITY,
+	UNIFORM_GBUFFER_DEPTH,
+	UNIFORM_CLIP_TO_CAMERA,
+	UNIFORM_CAMERA_TO_WORLD,
+	UNIFORM_SHADOW_CUBE,
+	UNIFORM_LIGHT_WORLD_POS,
+	UNIFORM_SHADOW_RANGE,
+	UNIFORM_FACE_TO_CLIP,
+	UNIFORM_FACE_MASK,
+	UNIFORM_COUNT
+};
+
+// block ids double as uniform buffer binding indexes
+enum UniformBlockId
+{
+	BLOCK_MATRICES,
+	BLOCK_LIGHT,
+	BLOCK_MATERIAL,
+	BLOCK_COUNT
+};
+
+// buffer textures the clustered point lights are read from, see LightClusters
+enum ClusterBufferId
+{
+	CLUSTER_BUFFER_LIGHTS,
+	CLUSTER_BUFFER_GRID,
+	CLUSTER_BUFFER_INDICES,
+	CLUSTER_BUFFER_COUNT
+};
+
+// targets of the deferred path's geometry pass, see gbuffer.glslf
+enum GBufferId
+{
+	GBUFFER_ALBEDO,
+	GBUFFER_NORMAL,
+	GBUFFER_VELOCITY,
+	GBUFFER_DEPTH,
+	GBUFFER_COUNT
+};
+
+enum TextureId
+{
+	TEXTURE_BALL,
+	TEXTURE_CLOTH,
+	TEXTURE_WOOD,
+	TEXTURE_ROOM,
+	TEXTURE_ROOM_BALL,
+	TEXTURE_COUNT
+};
+
+enum MaterialId
+{
+	MATERIAL_BALL,
+	MATERIAL_CLOTH,
+	MATERIAL_WOOD,
+	MATERIAL_COUNT,
+	MATERIAL_NONE = MATERIAL_COUNT
+};
+
+// source images of a texture, one per cubemap face
+struct TextureSource
+{
+	const char *name;
+	int count;
+	const char *files[6];
+};
+
+// addressing of a material's textures; the filter itself is a render setting
+struct SamplerDesc
+{
+	GLenum wrapS;
+	GLenum wrapT;
+	float maxAnisotropy;
+};
+
+struct ProgramHandle
+{
+	GLuint id;
+	GLint uniforms[UNIFORM_COUNT];
+	GLuint blocks[BLOCK_COUNT];
+};
+
+struct TextureHandle
+{
+	GLuint id;
+	GLenum target;
+	GLuint unit;
+};
+
+extern const char *programNames[PROGRAM_COUNT];
+extern const char *uniformNames[UNIFORM_COUNT];
+extern const char *blockNames[BLOCK_COUNT];
+extern const char *materialNames[MATERIAL_COUNT];
+extern const TextureSource textureSources[TEXTURE_COUNT];
+extern const SamplerDesc materialSamplers[MATERIAL_COUNT];
+
+#endif
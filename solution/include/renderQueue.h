@@ -0,0 +1,113 @@
+#ifndef __RENDER_QUEUE_H
+#define __RENDER_QUEUE_H
+
+#include "mesh.h"
+#include "renderHandles.h"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+enum QueuePass
+{
+	QUEUE_OPAQUE,
+	QUEUE_LIGHTS,
+	QUEUE_SKYBOX,
+	QUEUE_PASS_COUNT
+};
+
+// Vertex attributes 3..14 of the instanced programs, one record per drawn copy of a mesh
+struct InstanceData
+{
+	glm::mat4 modelToWorld;
+	glm::mat4 prevModelToWorld;
+	glm::mat3 normalModelToWorld;
+	glm::vec4 params; // texture scale, texture slot, material; the color of a light marker
+};
+
+struct RenderPacket
+{
+	RenderPacket(): lod(0), firstInstance(0), instanceCount(0) { }
+
+	ProgramId program;
+	MaterialId material;
+	TextureId texture;
+	const Mesh *mesh;
+	int lod;
+	glm::mat4 modelToWorld;
+	glm::mat4 prevModelToWorld; // last frame's transform, for the velocity buffer
+	unsigned firstInstance;
+	unsigned instanceCount; // 0 for a plain draw
+};
+
+class RenderQueue
+{
+public:
+	RenderQueue();
+	// pass:4 | program:8 | material:8 | texture:12 | depth:32
+	static uint64_t makeKey(QueuePass pass, int program, int material, int texture, float depth);
+
+	void clear();
+	void submit(QueuePass pass, float depth, const RenderPacket &packet);
+	unsigned addInstances(const InstanceData *data, unsigned count);
+	void sort();
+	void getRange(QueuePass pass, size_t &begin, size_t &end) const;
+	const RenderPacket &getPacket(size_t sortedIndex) const;
+	size_t size() const;
+	const std::vector<InstanceData> &getInstances() const;
+private:
+	struct SortEntry
+	{
+		uint64_t key;
+		unsigned index;
+		bool operator<(const SortEntry &other) const { return key < other.key; }
+	};
+
+	std::vector<RenderPacket> packets;
+	std::vector<SortEntry> order;
+	std::vector<InstanceData> instances;
+	bool sorted;
+};
+
+// Shadows the GL binding state so redundant binds are skipped; counts what was issued and skipped.
+class StateCache
+{
+public:
+	StateCache();
+	void invalidate();
+	void resetCounters();
+
+	void useProgram(GLuint program);
+	void bindTexture(GLuint unit, GLenum target, GLuint texture);
+	void bindSampler(GLuint unit, GLuint sampler);
+	void bindBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+	void bindVertexArray(GLuint vao);
+
+	int getIssued() const;
+	int getSkipped() const;
+private:
+	static const int MAX_TEXTURE_UNITS = 32;
+	static const int MAX_BUFFER_BINDINGS = 8;
+	static const GLuint UNKNOWN = 0xFFFFFFFF;
+
+	struct BufferRange
+	{
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+
+	GLuint program;
+	GLuint vertexArray;
+	GLuint activeUnit;
+	GLenum textureTargets[MAX_TEXTURE_UNITS];
+	GLuint textures[MAX_TEXTURE_UNITS];
+	GLuint samplers[MAX_TEXTURE_UNITS];
+	BufferRange buffers[MAX_BUFFER_BINDINGS];
+
+	int issued;
+	int skipped;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __RENDER_SETTINGS_H
+#define __RENDER_SETTINGS_H
+
+#include "programCache.h"
+
+#include <string>
+
+enum ShadowMode
+{
+	SHADOW_PER_LIGHT,	// a framebuffer, a clear and a draw for every light
+	SHADOW_LAYERED,		// all lights in one layered pass into a depth texture array
+	SHADOW_CUBE,		// a cube map per light in one layered pass, every object casts
+	SHADOW_MODE_COUNT
+};
+
+enum ShadowQuality
+{
+	SHADOW_QUALITY_LOW,		// 512 texels a side, 256 a cube face, 16 bit depth
+	SHADOW_QUALITY_MEDIUM,	// 1024 texels a side, 512 a cube face, 16 bit depth
+	SHADOW_QUALITY_HIGH,	// 2048 texels a side, 1024 a cube face, 24 bit depth
+	SHADOW_QUALITY_COUNT
+};
+
+enum RenderPath
+{
+	RENDER_FORWARD,		// every object lit as it is drawn, overdraw included; multisampled
+	RENDER_DEFERRED,	// objects write a G-buffer, then every visible pixel is lit once; no MSAA
+	RENDER_PATH_COUNT
+};
+
+enum TextureFilter
+{
+	FILTER_NEAREST,		// one texel of the base level
+	FILTER_BILINEAR,	// base level only, minified surfaces alias and miss the texture cache
+	FILTER_TRILINEAR,
+	FILTER_ANISOTROPIC,	// trilinear plus as many extra taps as the material allows
+	FILTER_COUNT
+};
+
+// Renderer options that can be chosen from the command line and switched at runtime
+struct RenderSettings
+{
+	RenderSettings();
+	std::string describe() const;
+	bool parseOption(const char *name, const char *value);
+
+	ShadowMode shadowMode;
+	ShadowQuality shadowQuality;
+	bool motionBlur;
+	ShaderCacheMode shaderCache;
+	TextureFilter textureFilter;
+	RenderPath renderPath;
+};
+
+#endif
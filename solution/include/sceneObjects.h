@@ -6,36 +6,18 @@
 #include <GL/glew.h>
 #include <glm/gtx/quaternion.hpp>
 
+// A UV sphere of unit radius with a chain of levels of detail, kept as ranges of one registry entry.
+// Level i has sectors >> i segments around the equator and half as many from pole to pole.
 class Sphere: public Mesh
 {
 public:
-	Sphere(const glm::vec3 &wp = glm::vec3(0.0), int r = SPHERE_SHAPE, int s = SPHERE_SHAPE);
+	Sphere(const glm::vec3 &wp = glm::vec3(0.0), int sectors = SPHERE_SHAPE, int lodCount = SPHERE_LOD_COUNT);
 
-	virtual void load();
-	virtual void draw() const;
-
-	glm::mat4 getModelToWorldMat() const;
-	glm::vec3 getVelocity() const;
-
-	void changeVelocity(const glm::vec3 &a, float frameDiv);
-	void move(float frameDiv);
-	void setVelocity(const glm::vec3 &v);
-	virtual ~Sphere();
+	virtual std::string getKey() const;
+	virtual void generate();
+	virtual int chooseLod(float projectedRadius, float maxError) const;
 private:
-	const int rings;
-	const int sectors;
-
-	GLuint vao;
-	GLsizei vaoSize;
-	GLuint vertexBufferObject;
-	GLuint indexBufferObject;
-
-	glm::vec3 velocity;
-	glm::quat rotation;
-
-	const float maxSpeed;
-	const float braking;
-	const float acceleration;
+	std::vector<int> lodSectors;
 };
 
 class Plane: public Mesh
@@ -43,26 +25,8 @@ class Plane: public Mesh
 public:
 	Plane(const glm::vec3 &wp = glm::vec3(0.0));
 
-	virtual void load();
-	virtual void draw() const;
-
-	glm::mat4 getModelToWorldMat() const;
-	glm::vec2 getTextureScale() const;
-	void setScale(const glm::vec3 &sc);
-	void setTextureScale(const glm::vec2 &tsc);
-	void setRotate(const glm::vec3 &euler);
-	virtual ~Plane();
-private:
-	GLuint vao;
-	GLsizei vaoSize;
-	GLuint vertexBufferObject;
-	GLuint indexBufferObject;	
-
-	glm::vec3 scale;
-	glm::vec2 textureScale;
-	glm::quat rotation;
-
-
+	virtual std::string getKey() const;
+	virtual void generate();
 };
 
 class Cube: public Mesh
@@ -70,18 +34,12 @@ class Cube: public Mesh
 public:
 	Cube(const glm::vec3 &wp = glm::vec3(0.0));
 
-	virtual void load();
-	virtual void draw() const;
+	virtual std::string getKey() const;
+	virtual void generate();
 
 	glm::mat4 getModelToWorldMat() const;
 	void setScale(const glm::vec3 &sc);
-	virtual ~Cube();
 private:
-	GLuint vao;
-	GLsizei vaoSize;
-	GLuint vertexBufferObject;
-	GLuint indexBufferObject;	
-
 	glm::vec3 scale;
 };
 
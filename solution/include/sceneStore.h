@@ -0,0 +1,125 @@
+#ifndef __SCENE_STORE_H
+#define __SCENE_STORE_H
+
+#include "material.h"
+#include "renderHandles.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+enum SceneMesh
+{
+	SCENE_MESH_PLANE,
+	SCENE_MESH_SPHERE,
+	SCENE_MESH_COUNT
+};
+
+// Cooked scene file: the header, then every array of the store one after another as it is in memory,
+// without padding between them
+struct SceneFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t objects;
+	uint32_t lights;
+	uint32_t pointLights;
+	uint32_t materials;
+	float ambient;
+	float lightHalfDistance;
+	float tableHalfSize[2];
+};
+
+static const uint32_t SCENE_FILE_MAGIC = 0x4E435347;	// "GSCN"
+static const uint32_t SCENE_FILE_VERSION = 3;
+
+// Static contents of a level: the objects as structure of arrays, the materials by MaterialId, the
+// lights and the table the physics runs on. Described in a text file, one line per entry:
+//	table <half width x> <half width z>
+//	ambient <intensity>
+//	attenuation <distance at which a light is at half intensity>
+//	light <x y z> <r g b>
+//	pointLight <x y z> <r g b> <radius>
+//	material <name> <specular r g b a> <shininess> <reflectivity>
+//	object <plane|sphere> <material> <texture> <position x y z> <rotation x y z, degrees> <scale x y z> <texture scale u v>
+//		[parent <index of an earlier object>]
+// An object with a parent is placed relative to it. The first lights cast shadows; point lights don't
+// and reach no further than their radius, so any number of them can light the scene.
+// The text is cooked with --cook into a binary copy of the arrays, which loads with a mapping and a
+// few copies.
+class SceneStore
+{
+public:
+	SceneStore();
+	void clear();
+	// text or binary, as told by the first bytes of the file
+	bool load(const std::string &path);
+	bool saveText(const std::string &path) const;
+	bool saveBinary(const std::string &path) const;
+	// cooks the scenes the demo ships with
+	static int cookAll();
+
+	int addObject(SceneMesh mesh, MaterialId material, TextureId texture, const glm::vec3 &position,
+		const glm::quat &rotation, const glm::vec3 &scale, const glm::vec2 &textureScale, int parent = -1);
+	int addLight(const glm::vec3 &position, const glm::vec3 &intensity);
+	int addPointLight(const glm::vec3 &position, const glm::vec3 &intensity, float radius);
+	void setMaterial(MaterialId id, const MaterialBlock &material);
+
+	int getObjectCount() const;
+	const std::vector<unsigned char> &getMeshes() const;
+	const std::vector<unsigned char> &getMaterialIds() const;
+	const std::vector<unsigned char> &getTextures() const;
+	const std::vector<glm::vec2> &getTextureScales() const;
+	// local to the parent, -1 for none
+	const std::vector<glm::vec3> &getPositions() const;
+	const std::vector<glm::quat> &getRotations() const;
+	const std::vector<glm::vec3> &getScales() const;
+	const std::vector<int32_t> &getParents() const;
+
+	MaterialBlock &getMaterial(MaterialId id);
+	int getLightCount() const;
+	const std::vector<glm::vec3> &getLightPositions() const;
+	const std::vector<glm::vec3> &getLightIntensities() const;
+	int getPointLightCount() const;
+	const std::vector<glm::vec3> &getPointLightPositions() const;
+	const std::vector<glm::vec3> &getPointLightIntensities() const;
+	const std::vector<float> &getPointLightRadii() const;
+	float getAmbient() const;
+	float getLightHalfDistance() const;
+	glm::vec2 getTableHalfSize() const;
+private:
+	// objects
+	std::vector<unsigned char> meshes;
+	std::vector<unsigned char> materialIds;
+	std::vector<unsigned char> textures;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<glm::vec2> textureScales;
+	std::vector<int32_t> parents;
+
+	MaterialBlock materials[MATERIAL_COUNT];
+	std::vector<glm::vec3> lightPositions;
+	std::vector<glm::vec3> lightIntensities;
+	std::vector<glm::vec3> pointLightPositions;
+	std::vector<glm::vec3> pointLightIntensities;
+	std::vector<float> pointLightRadii;
+	float ambient;
+	float lightHalfDistance;
+	glm::vec2 tableHalfSize;
+
+	bool loadText(const std::string &path);
+	bool loadBinary(const unsigned char *data, size_t size);
+	template <typename T> static bool readArray(const unsigned char *&cursor, const unsigned char *end,
+		std::vector<T> &out, uint32_t count);
+	template <typename T> static void writeArray(FILE *f, const std::vector<T> &data);
+	static int findName(const char *name, const char *const names[], int count);
+	static int findTexture(const char *name);
+};
+
+extern const char *sceneMeshNames[SCENE_MESH_COUNT];
+
+#endif
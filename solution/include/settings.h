@@ -7,19 +7,66 @@
 #define WIN_POS_X 0
 #define WIN_POS_Y 0
 
-#define TIMER_SPEED 1
 #define GSS_ERROR 1
 
-#define SPHERE_SHAPE 50
-#define LIGHT_SPHERE_SHAPE 15
+// the simulation advances in fixed steps, independent of how often frames are drawn
+#define PHYSICS_STEP (1.0 / 30.0)
+#define MAX_PHYSICS_STEPS 5
+
+#define LOADER_THREADS 0			// image decoding and mesh generation threads, 0 for one per core
+
+#define BALL_COUNT 16				// the cue ball and a triangle rack of 15
+#define CUE_ACCELERATION 18.0f		// units/s^2 while a direction key is held
+#define CUE_MAX_SPEED 18.0f
+
+#define MESH_PAGE_VERTICES 65536	// static meshes are packed into vertex and index buffers of this size
+#define MESH_PAGE_INDICES 196608
+#define MESH_CACHE_SIZE 16			// post-transform cache entries the optimized meshes are measured against
+#define MESH_OVERDRAW_CLUSTER 0	// triangles per cluster of the overdraw order; 0 keeps the vertex cache order, a convex mesh has no overdraw of its own
+
+#define SPHERE_SHAPE 48				// segments around the equator of the finest sphere level
+#define SPHERE_LOD_COUNT 4			// 48, 24, 12 and 6 segments
+#define LOD_MAX_ERROR 0.5f			// pixels a level's outline may stray from the true sphere
+#define SHADOW_LOD_MAX_ERROR 2.0f	// the same in shadow map texels, hidden under the 3x3 PCF footprint
+#define SHADOW_FIT_MARGIN 0.1f		// the light frusta leave this part of the casters' extent as slack on each side
+#define SHADOW_FIT_SHRINK 0.6f		// the light frusta are fitted again once the casters cover less of their area than this
+
+// point lights are binned into view-space clusters: screen tiles times depth slices spaced
+// exponentially between the near and the far plane
+#define MAX_POINT_LIGHTS 4096
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+
+// blur length relative to the motion between two frames
+#define MOTION_BLUR_SCALE 1.0f
 
 #define MOTION_CALL -1
 
+#define BENCHMARK_FRAMES 600
+#define BENCHMARK_WARMUP_FRAMES 30
+#define BENCHMARK_REPORT "benchmark.json"
+#define BENCHMARK_FRAME_TIME (1.0 / 60.0)
+
+// --bench vertices: a sphere far finer than any ball, drawn in each vertex format
+#define VERTEX_BENCHMARK_SECTORS 512
+#define VERTEX_BENCHMARK_INSTANCES 4
+#define VERTEX_BENCHMARK_REPEATS 10
+
+// --bench shading: the same still frame drawn by each render path with more and more point lights
+#define SHADING_BENCHMARK_FRAMES 10
+
 #define M_PI 3.14159265359f
 #define EPS 0.00001
 
 #define COPYRIGHT "This demo was created by Dontsov Valentin for MailRu Group and Allods team."
 #define TEXTURE_PATH "data/textures/"
+#define COOKED_TEXTURE_PATH TEXTURE_PATH "cooked/"
+#define SCENE_PATH "data/scenes/"
+#define COOKED_SCENE_PATH SCENE_PATH "cooked/"
+#define SCENE_FILE SCENE_PATH "table.scene"
+#define LIGHTS_SCENE_FILE SCENE_PATH "lights.scene"	// the table lit by 256 point lights
+#define SHADER_CACHE_PATH "data/shaderCache/"
 #define GREETING COPYRIGHT "\nCommands:\n" \
 	"\tq / [ESC]- Quit the application\n" \
 	"\twasd\t- Move ball forward, back, left, right relative to the camera\n" \
@@ -27,5 +74,11 @@
 	"\tc/v\t- Decrease/Increase ball's reflectivity\n" \
 	"\tb\t- Enable/Disable motion blur\n" \
 	"\tl\t- Show/hide light sources\n" \
+	"\tr\t- Rack the balls again\n" \
+	"\tk\t- Switch shadow rendering mode (per-light / layered / cube)\n" \
+	"\th\t- Switch shadow quality (low / medium / high)\n" \
+	"\tf\t- Switch texture filtering (nearest / bilinear / trilinear / anisotropic)\n" \
+	"\tg\t- Switch the render path (forward / deferred)\n" \
+	"\ti\t- Print frame rate and physics steps per frame\n" \
 	"TIP: Use english keyboard layout\n"
 #endif
\ No newline at end of file
@@ -11,10 +11,14 @@ class ShaderWorker
 {
 public:
 	static GLuint createShader(GLenum eShaderType, const std::string &strShaderFile);
-	static GLuint createProgramFromShaders(const std::vector<GLuint> &shaderList);
-	static GLuint createProgramFromFiles(const std::vector<shaderStringPair> &filePathList);
+	// retrievable programs can be read back with glGetProgramBinary
+	static GLuint createProgramFromShaders(const std::vector<GLuint> &shaderList, bool retrievable = false);
+	static GLuint createProgramFromFiles(const std::vector<shaderStringPair> &filePathList, const std::string &defines = "");
+	static GLuint createProgramFromSources(const std::vector<shaderStringPair> &sources, bool retrievable = false);
+	static void readSources(const std::vector<shaderStringPair> &filePathList, const std::string &defines,
+		std::vector<shaderStringPair> &sources);
 private:
-	static GLuint loadShaders(const std::vector<shaderStringPair> &vshader);
+	static void insertDefines(std::string &shader, const std::string &defines);
 	static int loadShaderFromFile(const std::string &filePath, std::string &shaderOut);
 };
 
@@ -0,0 +1,77 @@
+#ifndef __TEXTURE_CONTAINER_H
+#define __TEXTURE_CONTAINER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Cooked texture file: a header, a level table and the level data, face-major and each level
+// exactly in the layout glTexImage2D / glCompressedTexImage2D take, so loading is a mapping.
+struct TextureFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t internalFormat;	// GL enums
+	uint32_t pixelFormat;		// for uncompressed data, 0 when compressed
+	uint32_t width;
+	uint32_t height;
+	uint32_t faces;
+	uint32_t levels;
+};
+
+struct TextureFileLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t offset;			// from the start of the file
+	uint32_t size;
+};
+
+static const uint32_t TEXTURE_FILE_MAGIC = 0x58455447;	// "GTEX"
+static const uint32_t TEXTURE_FILE_VERSION = 1;
+
+// A whole file mapped read-only
+class MappedFile
+{
+public:
+	MappedFile();
+	bool open(const std::string &path);
+	void close();
+	const unsigned char *getData() const;
+	size_t getSize() const;
+	~MappedFile();
+private:
+	const unsigned char *data;
+	size_t size;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#else
+	int fd;
+#endif
+
+	// not copyable
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
+
+class TextureContainer
+{
+public:
+	TextureContainer();
+	// reads the header only: the file is there, newer than its sources and loadable by this driver
+	static bool probe(const std::string &path, const char *const sources[], int faces, bool compressionSupported);
+	bool open(const std::string &path);
+	// touches every page, so the upload on the GL thread does not stall on the disk
+	unsigned prefetch() const;
+
+	const TextureFileHeader &getHeader() const;
+	const TextureFileLevel &getLevel(int face, int level) const;
+	const void *getLevelData(int face, int level) const;
+private:
+	MappedFile file;
+	const TextureFileHeader *header;
+	const TextureFileLevel *levels;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef __TEXTURE_COOKER_H
+#define __TEXTURE_COOKER_H
+
+#include <string>
+#include <vector>
+
+// Offline step behind --cook: decodes the source images once, builds the mip chains and stores
+// them BC1 compressed in texture containers next to the sources.
+class TextureCooker
+{
+public:
+	static int cookAll();
+	static bool cook(const char *const files[], int count, const std::string &outPath);
+private:
+	struct Image
+	{
+		int width;
+		int height;
+		std::vector<unsigned char> rgb;
+	};
+
+	static bool decode(const char *file, Image &image);
+	static void downsample(const Image &src, Image &dst);
+	static void compress(const Image &image, std::vector<unsigned char> &out);
+	static void compressBlock(const unsigned char pixels[16][3], unsigned char *out);
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __TRANSFORM_KERNEL_H
+#define __TRANSFORM_KERNEL_H
+
+#include <stddef.h>
+#include <glm/glm.hpp>
+
+// Position, rotation (a unit quaternion) and scale of count objects, one float array per component
+struct TransformArrays
+{
+	const float *position[3];
+	const float *rotation[4];	// x, y, z, w
+	const float *scale[3];
+	size_t count;
+};
+
+enum TransformKernelPath
+{
+	TRANSFORM_SCALAR,
+	TRANSFORM_SSE,		// four objects at a time
+	TRANSFORM_AVX,		// eight
+	TRANSFORM_PATH_COUNT
+};
+
+// Builds the model matrices, the normal matrices and optionally the model-view matrices of a batch of
+// objects straight from their components. With a rotation and a scale the normal matrix is the rotation
+// with its columns divided by the scale, so no inverse is needed. The SIMD paths keep one object per
+// lane while they compute and transpose to the glm layout on the way out.
+class TransformKernel
+{
+public:
+	// the widest path this CPU runs
+	static TransformKernelPath getBestPath();
+	static const char *getPathName(TransformKernelPath path);
+	// view and modelView may both be NULL
+	static void run(TransformKernelPath path, const TransformArrays &in, glm::mat4 *model, glm::mat3 *normal,
+		const glm::mat4 *view = NULL, glm::mat4 *modelView = NULL);
+private:
+	static void runScalar(const TransformArrays &in, size_t first, glm::mat4 *model, glm::mat3 *normal,
+		const glm::mat4 *view, glm::mat4 *modelView);
+	// both return the number of objects done, the rest is left to the scalar path
+	static size_t runSse(const TransformArrays &in, glm::mat4 *model, glm::mat3 *normal,
+		const glm::mat4 *view, glm::mat4 *modelView);
+	static size_t runAvx(const TransformArrays &in, glm::mat4 *model, glm::mat3 *normal,
+		const glm::mat4 *view, glm::mat4 *modelView);
+};
+
+#endif
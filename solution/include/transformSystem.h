@@ -0,0 +1,52 @@
+#ifndef __TRANSFORM_SYSTEM_H
+#define __TRANSFORM_SYSTEM_H
+
+#include "transformKernel.h"
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+// Local transforms of the scene nodes and the world and normal matrices built from them. update()
+// rebuilds the matrices of the nodes changed since the last update and of everything below them,
+// the rest keep theirs. Nodes are added parents first, so one pass in index order sees every parent
+// before its children. The local matrices of the changed nodes are built together by the widest
+// TransformKernel path the CPU has.
+class TransformSystem
+{
+public:
+	TransformSystem();
+	void clear();
+	int addNode(const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale, int parent = -1);
+	// the node is only marked dirty when the transform really differs
+	void setLocal(int node, const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale);
+	// returns the number of nodes whose matrices were rebuilt
+	int update();
+
+	int getNodeCount() const;
+	// whether the last update() rebuilt the node's matrices
+	bool isChanged(int node) const;
+	const glm::mat4 &getWorld(int node) const;
+	// inverse transpose of the world matrix, for the normals
+	const glm::mat3 &getNormal(int node) const;
+	int getUpdatedCount() const;
+private:
+	std::vector<glm::vec3> positions;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<int> parents;
+	std::vector<unsigned char> dirty;		// set by setLocal()
+	std::vector<unsigned char> changed;		// set by update() for the node or any of its ancestors
+	std::vector<glm::mat4> world;
+	std::vector<glm::mat3> normal;
+	int updated;
+
+	// the changed nodes of an update, gathered for the kernel
+	TransformKernelPath kernelPath;
+	std::vector<int> batchNodes;
+	std::vector<float> batchComponents[10];
+	std::vector<glm::mat4> batchModel;
+	std::vector<glm::mat3> batchNormal;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef __WORKER_POOL_H
+#define __WORKER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads running jobs in submission order. Jobs must not touch GL.
+class WorkerPool
+{
+public:
+	// 0 uses one thread per hardware thread
+	explicit WorkerPool(int threads = 0);
+	void submit(const std::function<void()> &job);
+	int getThreadCount() const;
+	~WorkerPool();
+private:
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()> > jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+
+	void workerLoop();
+
+	// not copyable
+	WorkerPool(const WorkerPool &);
+	WorkerPool &operator=(const WorkerPool &);
+};
+
+#endif
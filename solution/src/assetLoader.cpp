@@ -0,0 +1,244 @@
+#include "assetLoader.h"
+#include "mesh.h"
+#include "textureContainer.h"
+
+#include <algorithm>
+#include <exception>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <glimg/glimg.h>
+
+AssetLoader::AssetLoader(int threads): decoded(0), pixelBuffer(0), totalMs(0.0), pool(threads) { }
+
+void AssetLoader::addTexture(const std::string &name, GLuint texture, GLenum target, GLint internalFormat,
+	const char *const files[], int count, const std::string &cookedPath)
+{
+	GLenum bindTarget = target == GL_TEXTURE_CUBE_MAP_POSITIVE_X ? GL_TEXTURE_CUBE_MAP : target;
+	bool cooked = !cookedPath.empty() &&
+		TextureContainer::probe(cookedPath, files, count, GLEW_EXT_texture_compression_s3tc != GL_FALSE);
+	Asset asset = { name, texture, bindTarget, internalFormat, cooked, count, 0, 0.0, 0.0, 0.0 };
+	assets.push_back(asset);
+
+	if (cooked)
+	{
+		Piece piece = { assets.size() - 1, cookedPath, target, NULL, new TextureContainer(), NULL, 0.0, "" };
+		pieces.push_back(piece);
+		submit(&pieces.back());
+		return;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		Piece piece = { assets.size() - 1, files[i], target + i, NULL, NULL, NULL, 0.0, "" };
+		pieces.push_back(piece);
+		submit(&pieces.back());
+	}
+}
+
+void AssetLoader::addMesh(const std::string &name, Mesh *mesh)
+{
+	Asset asset = { name, 0, GL_NONE, 0, false, 0, 0, 0.0, 0.0, 0.0 };
+	assets.push_back(asset);
+	Piece piece = { assets.size() - 1, name, GL_NONE, NULL, NULL, mesh, 0.0, "" };
+	pieces.push_back(piece);
+	submit(&pieces.back());
+}
+
+void AssetLoader::submit(Piece *piece)
+{
+	if (pieces.size() == 1)
+		start = Clock::now();
+	pool.submit(std::bind(&AssetLoader::decode, this, piece));
+}
+
+void AssetLoader::decode(Piece *piece)
+{
+	Clock::time_point from = Clock::now();
+	try
+	{
+		if (piece->mesh)
+			piece->mesh->build();
+		else if (piece->container)
+		{
+			if (piece->container->open(piece->file))
+				piece->container->prefetch();
+			else
+				piece->error = "not a valid texture container";
+		}
+		else
+			piece->image = glimg::loaders::stb::LoadFromFile(piece->file);
+	}
+	catch (std::exception &e)
+	{
+		piece->error = e.what();
+	}
+	piece->decodeMs = elapsedMs(from, Clock::now());
+
+	// notified under the lock, the destructor may return as soon as it sees the count
+	std::lock_guard<std::mutex> lock(mutex);
+	ready.push_back(piece);
+	decoded++;
+	pieceReady.notify_one();
+}
+
+double AssetLoader::finish()
+{
+	for (size_t uploaded = 0; uploaded < pieces.size(); uploaded++)
+	{
+		Piece *piece;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (ready.empty())
+				pieceReady.wait(lock);
+			piece = ready.front();
+			ready.pop_front();
+		}
+
+		Asset &asset = assets[piece->asset];
+		Clock::time_point from = Clock::now();
+		if (piece->mesh)
+			piece->mesh->upload();
+		else if (piece->container)
+			uploadContainer(*piece);
+		else
+			uploadImage(*piece);
+		asset.decodeMs += piece->decodeMs;
+		asset.uploadMs += elapsedMs(from, Clock::now());
+		asset.readyMs = elapsedMs(start, Clock::now());
+	}
+
+	if (pixelBuffer)
+	{
+		glDeleteBuffers(1, &pixelBuffer);
+		pixelBuffer = 0;
+	}
+	totalMs = pieces.empty() ? 0.0 : elapsedMs(start, Clock::now());
+	return totalMs;
+}
+
+void AssetLoader::uploadImage(Piece &piece)
+{
+	Asset &asset = assets[piece.asset];
+	glBindTexture(asset.bindTarget, asset.texture);
+	if (!piece.image)
+	{
+		printf("Can't load %s: %s\n", piece.file.c_str(), piece.error.c_str());
+		uint32_t img[4] = { 0x0, 0xFFFFFFFF, 0xFFFFFFFF, 0x0 };
+		glTexImage2D(piece.target, 0, asset.internalFormat, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, img);
+		if (--asset.facesLeft == 0)
+			glGenerateMipmap(asset.bindTarget);
+		glBindTexture(asset.bindTarget, 0);
+		return;
+	}
+
+	glimg::SingleImage image = piece.image->GetImage(0, 0, 0);
+	glimg::Dimensions dims = image.GetDimensions();
+	glimg::ImageFormat format = image.GetFormat();
+	GLenum pixelFormat = GL_RGBA;
+	switch (format.Components())
+	{
+	case glimg::FMT_COLOR_RED: pixelFormat = GL_RED; break;
+	case glimg::FMT_COLOR_RG: pixelFormat = GL_RG; break;
+	case glimg::FMT_COLOR_RGB: pixelFormat = GL_RGB; break;
+	default: break;
+	}
+
+	// the copy into a freshly orphaned buffer never waits for the previous upload to finish
+	GLsizeiptr size = (GLsizeiptr)image.GetImageByteSize();
+	if (!pixelBuffer)
+		glGenBuffers(1, &pixelBuffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	memcpy(dst, image.GetImageData(), size);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, format.LineAlign());
+	glTexImage2D(piece.target, 0, asset.internalFormat, dims.width, dims.height, 0,
+		pixelFormat, GL_UNSIGNED_BYTE, 0);
+	asset.uploadBytes += size;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	// a cubemap can only be filtered down once all six faces are there
+	if (--asset.facesLeft == 0)
+		glGenerateMipmap(asset.bindTarget);
+	glBindTexture(asset.bindTarget, 0);
+
+	delete piece.image;
+	piece.image = NULL;
+}
+
+void AssetLoader::uploadContainer(Piece &piece)
+{
+	Asset &asset = assets[piece.asset];
+	const TextureContainer &tc = *piece.container;
+	glBindTexture(asset.bindTarget, asset.texture);
+	if (!piece.error.empty())
+	{
+		printf("Can't load %s: %s\n", piece.file.c_str(), piece.error.c_str());
+		uint32_t img[4] = { 0x0, 0xFFFFFFFF, 0xFFFFFFFF, 0x0 };
+		for (int face = 0; face < (asset.bindTarget == GL_TEXTURE_CUBE_MAP ? 6 : 1); face++)
+			glTexImage2D(piece.target + face, 0, asset.internalFormat, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, img);
+		glGenerateMipmap(asset.bindTarget);
+	}
+	else
+	{
+		// straight from the mapping, the levels are already in the layout GL wants
+		const TextureFileHeader &h = tc.getHeader();
+		glTexParameteri(asset.bindTarget, GL_TEXTURE_MAX_LEVEL, h.levels - 1);
+		for (uint32_t face = 0; face < h.faces; face++)
+			for (uint32_t level = 0; level < h.levels; level++)
+			{
+				const TextureFileLevel &l = tc.getLevel(face, level);
+				if (h.pixelFormat)
+					glTexImage2D(piece.target + face, level, h.internalFormat, l.width, l.height, 0,
+						h.pixelFormat, GL_UNSIGNED_BYTE, tc.getLevelData(face, level));
+				else
+					glCompressedTexImage2D(piece.target + face, level, h.internalFormat, l.width, l.height, 0,
+						l.size, tc.getLevelData(face, level));
+				asset.uploadBytes += l.size;
+			}
+	}
+	glBindTexture(asset.bindTarget, 0);
+
+	delete piece.container;
+	piece.container = NULL;
+}
+
+void AssetLoader::printReport() const
+{
+	double decodeMs = 0.0;
+	for (size_t i = 0; i < assets.size(); i++)
+		decodeMs += assets[i].decodeMs;
+	printf("Loaded %u assets on %i threads in %.1f ms, decoding them one by one takes %.1f ms:\n",
+		(unsigned)assets.size(), pool.getThreadCount(), totalMs, decodeMs);
+	for (size_t i = 0; i < assets.size(); i++)
+	{
+		const Asset &a = assets[i];
+		printf("\t%-12s %-6s %8.1f ms  upload %7.1f ms %7.1f MB  ready at %8.1f ms\n", a.name.c_str(),
+			a.cooked ? "mapped" : a.texture ? "decode" : "build", a.decodeMs, a.uploadMs, a.uploadBytes / 1048576.0, a.readyMs);
+	}
+}
+
+int AssetLoader::getThreadCount() const
+{
+	return pool.getThreadCount();
+}
+
+double AssetLoader::elapsedMs(const Clock::time_point &from, const Clock::time_point &to)
+{
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+AssetLoader::~AssetLoader()
+{
+	// without finish() the workers may still be writing into the pieces, and the images are still owned here
+	std::unique_lock<std::mutex> lock(mutex);
+	while (decoded < pieces.size())
+		pieceReady.wait(lock);
+	for (size_t i = 0; i < pieces.size(); i++)
+	{
+		delete pieces[i].image;
+		delete pieces[i].container;
+	}
+}
@@ -0,0 +1,526 @@
+#include "benchmarks.h"
+#include "engine.h"
+#include "lightClusters.h"
+#include "physicsWorld.h"
+#include "renderHandles.h"
+#include "sceneStore.h"
+#include "settings.h"
+#include "transformKernel.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+static double elapsedNs(const BenchClock::time_point &from, const BenchClock::time_point &to)
+{
+	return std::chrono::duration<double, std::nano>(to - from).count();
+}
+
+// LCG, so every run starts from the same state; uniform in [0, 1]
+static float nextRandom(unsigned &seed)
+{
+	seed = seed * 1664525u + 1013904223u;
+	return ((seed >> 8) & 0xFFFF) / 65535.0f;
+}
+
+void Benchmarks::makeRandomPointLights(LightSubsystem &lss, int count, unsigned seed, const glm::vec3 &boxMin, const glm::vec3 &boxMax)
+{
+	lss.clearPointLights();
+	for (int i = 0; i < count; i++)
+	{
+		glm::vec3 r;
+		for (int k = 0; k < 3; k++)
+			r[k] = nextRandom(seed);
+		lss.addPointLight(boxMin + r * (boxMax - boxMin), glm::vec3(0.3f), 3.5f);
+	}
+}
+
+int Benchmarks::run(const std::string &name)
+{
+	if (name == "lookups")
+		return drawLookups();
+	if (name == "physics")
+		return physicsSteps();
+	if (name == "scene")
+		return sceneLoading();
+	if (name == "transforms")
+		return transformBatches();
+	if (name == "clusters")
+		return lightClustering();
+	if (name == "vertices" || name == "shading")
+	{
+		// the benchmarks that need the renderer bring up a headless engine
+		Engine engine(true, RenderSettings());
+		return name == "vertices" ? engine.runVertexBenchmark() : engine.runShadingBenchmark();
+	}
+
+	printUsage();
+	return 1;
+}
+
+void Benchmarks::printUsage()
+{
+	printf("Available benchmarks:\n"
+		"\tclusters\t- binning 256 to 4096 point lights into the view clusters, and the lights a fragment loops over\n"
+		"\tlookups\t- per-draw cost of string-keyed state lookups vs precompiled handles\n"
+		"\tphysics\t- physics steps per second with 16, 256 and 4096 balls\n"
+		"\tshading\t- scene and lighting passes of the forward and deferred paths with 0 to 1024 point lights\n"
+		"\tscene\t- loading scenes of 1000 to 100000 objects from text and from their cooked binary\n"
+		"\ttransforms\t- model, normal and model-view matrices of 1000 to 100000 objects, glm vs the batch kernel\n"
+		"\tvertices\t- vertex throughput of a finely tessellated sphere, float vs packed vertices\n");
+}
+
+/*=================================
+	   Draw path lookups
+===================================*/
+
+// the string-keyed containers GraphicsSubsystem used before the handle layer
+struct LegacyLookupState
+{
+	std::unordered_map<std::string, GLuint> shaders;
+	std::unordered_map<std::string, GLuint> texUnits;
+	std::unordered_map<std::string, GLuint> textures;
+	std::unordered_map<GLenum, std::unordered_map<std::string, GLuint> > programUniforms;
+};
+
+static std::string legacyClothTexture()
+{
+	return std::string("cloth");
+}
+
+// the lookup sequence of the old drawBall() followed by the old drawPlane()
+static GLuint legacyDraw(LegacyLookupState &st)
+{
+	GLuint sum = 0;
+	GLuint ballpr = st.shaders["ball"];
+	sum += st.programUniforms[ballpr]["modelToWorldMatrix"];
+	sum += st.programUniforms[ballpr]["normalModelToWorldMatrix"];
+	sum += st.programUniforms[ballpr]["normalModelToCameraMatrix"];
+	sum += st.programUniforms[ballpr]["worldToLightMatrix"];
+	sum += st.programUniforms[ballpr]["worldToLightITMatrix"];
+	sum += st.programUniforms[ballpr]["camPos"];
+	sum += st.texUnits["roomBall"] + st.textures["roomBall"];
+	sum += st.texUnits["ball"] + st.textures["ball"];
+	sum += st.texUnits["ball"] + st.texUnits["ball"];
+
+	std::string textureName = legacyClothTexture();
+	GLuint planepr = st.shaders["plane"];
+	sum += st.shaders["plane"];
+	sum += st.programUniforms[planepr]["normalModelToCameraMatrix"];
+	sum += st.programUniforms[planepr]["modelToWorldMatrix"];
+	sum += st.programUniforms[planepr]["modelToLightToClipMatrix"];
+	sum += st.programUniforms[planepr]["textureScale"];
+	sum += st.programUniforms[planepr]["shadowTexSize"];
+	sum += st.programUniforms[planepr]["colorTexture"] + st.texUnits[textureName];
+	sum += st.texUnits[textureName] + st.textures[textureName];
+	sum += st.texUnits[textureName] + st.texUnits[textureName];
+	return sum;
+}
+
+// the same reads through the handle tables
+static GLuint handleDraw(const ProgramHandle *programs, const TextureHandle *textures, TextureId texture)
+{
+	GLuint sum = 0;
+	const ProgramHandle &ballpr = programs[PROGRAM_BALL];
+	sum += ballpr.uniforms[UNIFORM_MODEL_TO_WORLD];
+	sum += ballpr.uniforms[UNIFORM_NORMAL_MODEL_TO_WORLD];
+	sum += ballpr.uniforms[UNIFORM_NORMAL_MODEL_TO_CAMERA];
+	sum += ballpr.uniforms[UNIFORM_WORLD_TO_LIGHT];
+	sum += ballpr.uniforms[UNIFORM_WORLD_TO_LIGHT_IT];
+	sum += ballpr.uniforms[UNIFORM_CAM_POS];
+	sum += textures[TEXTURE_ROOM_BALL].unit + textures[TEXTURE_ROOM_BALL].id;
+	sum += textures[TEXTURE_BALL].unit + textures[TEXTURE_BALL].id;
+	sum += textures[TEXTURE_BALL].unit + textures[TEXTURE_BALL].unit;
+
+	const ProgramHandle &planepr = programs[PROGRAM_PLANE];
+	sum += planepr.id;
+	sum += planepr.uniforms[UNIFORM_NORMAL_MODEL_TO_CAMERA];
+	sum += planepr.uniforms[UNIFORM_MODEL_TO_WORLD];
+	sum += planepr.uniforms[UNIFORM_MODEL_TO_LIGHT_TO_CLIP];
+	sum += planepr.uniforms[UNIFORM_TEXTURE_SCALE];
+	sum += planepr.uniforms[UNIFORM_SHADOW_TEX_SIZE];
+	sum += planepr.uniforms[UNIFORM_COLOR_TEXTURE] + textures[texture].unit;
+	sum += textures[texture].unit + textures[texture].id;
+	sum += textures[texture].unit + textures[texture].unit;
+	return sum;
+}
+
+int Benchmarks::drawLookups()
+{
+	const int iterations = 1000000;
+	const char *textureNames[] = { "ball", "cloth", "wood", "room", "roomBall" };
+
+	LegacyLookupState legacy;
+	ProgramHandle programs[PROGRAM_COUNT];
+	TextureHandle textures[TEXTURE_COUNT];
+	for (int p = 0; p < PROGRAM_COUNT; p++)
+	{
+		legacy.shaders[programNames[p]] = p + 1;
+		programs[p].id = p + 1;
+		for (int u = 0; u < UNIFORM_COUNT; u++)
+		{
+			legacy.programUniforms[p + 1][uniformNames[u]] = u;
+			programs[p].uniforms[u] = u;
+		}
+	}
+	for (int t = 0; t < TEXTURE_COUNT; t++)
+	{
+		legacy.texUnits[textureNames[t]] = t;
+		legacy.textures[textureNames[t]] = t + 10;
+		textures[t].unit = t;
+		textures[t].id = t + 10;
+		textures[t].target = 0;
+	}
+
+	// volatile keeps the compiler from folding the handle path away
+	volatile GLuint sink = 0;
+	volatile int texture = TEXTURE_CLOTH;
+
+	BenchClock::time_point start = BenchClock::now();
+	for (int i = 0; i < iterations; i++)
+		sink = sink + legacyDraw(legacy);
+	double legacyNs = elapsedNs(start, BenchClock::now()) / iterations;
+
+	start = BenchClock::now();
+	for (int i = 0; i < iterations; i++)
+		sink = sink + handleDraw(programs, textures, (TextureId)texture);
+	double handleNs = elapsedNs(start, BenchClock::now()) / iterations;
+
+	printf("Per-draw state lookups (drawBall + drawPlane), %i iterations:\n", iterations);
+	printf("\tstring-keyed maps\t%8.1f ns\n", legacyNs / 2.0);
+	printf("\tprecompiled handles\t%8.1f ns\n", handleNs / 2.0);
+	printf("\tspeed-up\t\t%8.1fx\n", legacyNs / handleNs);
+	return 0;
+}
+
+/*=================================
+		  Physics stepping
+===================================*/
+
+// a table sized for the ball count, filled on a jittered grid with random velocities
+static void fillStressTable(PhysicsWorld &world, int balls, float speed, unsigned seed)
+{
+	const PhysicsParams &p = world.getParams();
+	int side = (int)ceil(sqrt((double)balls));
+	float spacing = 2.0f * p.tableHalfSize.x / side;
+
+	for (int i = 0; i < balls; i++)
+	{
+		float jitter = nextRandom(seed) - 0.5f;
+		float angle = nextRandom(seed) * 6.2831853f;
+		float x = -p.tableHalfSize.x + spacing * (i % side + 0.5f + 0.2f * jitter);
+		float z = -p.tableHalfSize.y + spacing * (i / side + 0.5f - 0.2f * jitter);
+		world.addBall(glm::vec2(x, z), glm::vec2(cos(angle), sin(angle)) * speed);
+	}
+}
+
+int Benchmarks::physicsSteps()
+{
+	const int counts[] = { 16, 256, 4096 };
+	const float dt = 1.0f / 60.0f;
+
+	printf("Physics steps, dt = 1/60 s, no friction or pockets so the ball count and energy stay constant:\n");
+	printf("\t%6s %10s %12s %14s %12s %10s\n", "balls", "steps/s", "us/step", "ns/ball-step", "pairs/step", "contacts");
+	for (int c = 0; c < 3; c++)
+	{
+		int balls = counts[c];
+		PhysicsParams params;
+		// about a third of the cloth covered by balls, whatever their number
+		float half = sqrtf(balls * 4.0f * params.ballRadius * params.ballRadius / 0.3f) * 0.5f;
+		params.tableHalfSize = glm::vec2(half);
+		params.rollingFriction = 0.0f;
+		params.ballRestitution = 1.0f;
+		params.cushionRestitution = 1.0f;
+		params.pockets = false;
+
+		PhysicsWorld world(params);
+		fillStressTable(world, balls, 10.0f, 12345u);
+		for (int i = 0; i < 60; i++)
+			world.step(dt);
+
+		const int steps = std::max(200, 400000 / balls);
+		long long pairs = 0, contacts = 0;
+		BenchClock::time_point start = BenchClock::now();
+		for (int i = 0; i < steps; i++)
+		{
+			world.step(dt);
+			pairs += world.getCandidatePairs();
+			contacts += world.getContacts();
+		}
+		double stepNs = elapsedNs(start, BenchClock::now()) / steps;
+
+		printf("\t%6i %10.0f %12.2f %14.1f %12.1f %10.1f\n", balls, 1e9 / stepNs, stepNs / 1000.0,
+			stepNs / balls, (double)pairs / steps, (double)contacts / steps);
+	}
+
+	// with continuous collisions a longer step must not lose balls or energy, only CPU time
+	const int ticks[] = { 240, 120, 60, 30, 15 };
+	const int balls = 256;
+	const float speed = 40.0f;
+	printf("\nStep length sweep, %i balls at %.0f units/s, 2 simulated seconds, elastic:\n", balls, speed);
+	printf("\t%6s %14s %12s %12s %12s %8s\n", "tick", "ms/sim-sec", "events/step", "energy, %", "max overlap", "escaped");
+	for (int t = 0; t < 5; t++)
+	{
+		PhysicsParams params;
+		float half = sqrtf(balls * 4.0f * params.ballRadius * params.ballRadius / 0.3f) * 0.5f;
+		params.tableHalfSize = glm::vec2(half);
+		params.rollingFriction = 0.0f;
+		params.ballRestitution = 1.0f;
+		params.cushionRestitution = 1.0f;
+		params.pockets = false;
+
+		PhysicsWorld world(params);
+		fillStressTable(world, balls, speed, 12345u);
+		double energyBefore = 0.0;
+		for (int i = 0; i < balls; i++)
+			energyBefore += glm::dot(world.getVelocity(i), world.getVelocity(i));
+
+		const int steps = 2 * ticks[t];
+		long long events = 0;
+		BenchClock::time_point start = BenchClock::now();
+		for (int i = 0; i < steps; i++)
+		{
+			world.step(1.0f / ticks[t]);
+			events += world.getEvents();
+		}
+		double totalMs = elapsedNs(start, BenchClock::now()) / 1e6;
+
+		double energyAfter = 0.0;
+		float maxOverlap = 0.0f;
+		int escaped = 0;
+		for (int i = 0; i < balls; i++)
+		{
+			glm::vec3 p = world.getPosition(i);
+			energyAfter += glm::dot(world.getVelocity(i), world.getVelocity(i));
+			if (fabsf(p.x) > half || fabsf(p.z) > half)
+				escaped++;
+			for (int j = i + 1; j < balls; j++)
+				maxOverlap = std::max(maxOverlap, 2.0f * params.ballRadius - glm::distance(p, world.getPosition(j)));
+		}
+
+		printf("\t%4i Hz %14.2f %12.1f %12.3f %12.4f %8i\n", ticks[t], totalMs / 2.0, (double)events / steps,
+			100.0 * (energyAfter - energyBefore) / energyBefore, maxOverlap, escaped);
+	}
+	return 0;
+}
+
+/*=================================
+		   Scene loading
+===================================*/
+
+static double fileMb(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return 0.0;
+	fseek(f, 0, SEEK_END);
+	double mb = ftell(f) / 1048576.0;
+	fclose(f);
+	return mb;
+}
+
+// best of a few loads, the file is in the page cache after the first one
+static double timeSceneLoad(const std::string &path, int repeats)
+{
+	double best = 1e30;
+	for (int i = 0; i < repeats; i++)
+	{
+		SceneStore scene;
+		BenchClock::time_point start = BenchClock::now();
+		if (!scene.load(path))
+			return -1.0;
+		best = std::min(best, elapsedNs(start, BenchClock::now()) / 1e6);
+	}
+	return best;
+}
+
+int Benchmarks::sceneLoading()
+{
+	const int counts[] = { 1000, 10000, 100000 };
+	const std::string textPath = std::string(SCENE_PATH) + "benchmark.scene";
+	const std::string binaryPath = std::string(SCENE_PATH) + "benchmark.gscn";
+
+	printf("Scene loading, planes on a grid with random rotations, best of 5:\n");
+	printf("\t%8s %10s %10s %12s %10s %9s\n", "objects", "text, MB", "text, ms", "binary, MB", "binary, ms", "speed-up");
+	for (int c = 0; c < 3; c++)
+	{
+		SceneStore scene;
+		unsigned seed = 12345u;
+		int side = (int)ceil(sqrt((double)counts[c]));
+		for (int i = 0; i < counts[c]; i++)
+		{
+			float angle = nextRandom(seed) * 6.2831853f;
+			scene.addObject(SCENE_MESH_PLANE, (MaterialId)(MATERIAL_CLOTH + i % 2), i % 2 ? TEXTURE_WOOD : TEXTURE_CLOTH,
+				glm::vec3(i % side * 2.0f, 0.0f, i / side * 2.0f), glm::quat(glm::vec3(0.0f, angle, 0.0f)),
+				glm::vec3(1.0f), glm::vec2(1.0f));
+		}
+		if (!scene.saveText(textPath) || !scene.saveBinary(binaryPath))
+			return 1;
+
+		double textMs = timeSceneLoad(textPath, 5);
+		double binaryMs = timeSceneLoad(binaryPath, 5);
+		printf("\t%8i %10.2f %10.2f %12.2f %10.3f %8.1fx\n", counts[c], fileMb(textPath), textMs,
+			fileMb(binaryPath), binaryMs, textMs / binaryMs);
+	}
+	remove(textPath.c_str());
+	remove(binaryPath.c_str());
+	return 0;
+}
+
+/*=================================
+		 Transform batches
+===================================*/
+
+// the component arrays of count objects with random positions, rotations and scales
+struct TransformBatch
+{
+	std::vector<float> components[10];
+	TransformArrays arrays;
+
+	TransformBatch(int count, unsigned seed)
+	{
+		for (int c = 0; c < 10; c++)
+			components[c].resize(count);
+		for (int i = 0; i < count; i++)
+		{
+			float r[10];
+			for (int c = 0; c < 10; c++)
+				r[c] = nextRandom(seed);
+			glm::quat q = glm::normalize(glm::quat(r[3] - 0.5f, r[4] - 0.5f, r[5] - 0.5f, r[6] - 0.5f + 1e-3f));
+			for (int c = 0; c < 3; c++)
+			{
+				components[c][i] = r[c] * 100.0f - 50.0f;
+				components[7 + c][i] = 0.25f + r[7 + c] * 2.0f;
+			}
+			for (int c = 0; c < 4; c++)
+				components[3 + c][i] = q[c];
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			arrays.position[c] = components[c].data();
+			arrays.scale[c] = components[7 + c].data();
+		}
+		for (int c = 0; c < 4; c++)
+			arrays.rotation[c] = components[3 + c].data();
+		arrays.count = count;
+	}
+};
+
+// what TransformSystem did per node before the kernel, with the model-view product a draw needs
+static void glmTransforms(const TransformArrays &in, glm::mat4 *model, glm::mat3 *normal, const glm::mat4 &view,
+	glm::mat4 *modelView)
+{
+	for (size_t i = 0; i < in.count; i++)
+	{
+		glm::vec3 position(in.position[0][i], in.position[1][i], in.position[2][i]);
+		glm::quat rotation(in.rotation[3][i], in.rotation[0][i], in.rotation[1][i], in.rotation[2][i]);
+		glm::vec3 scale(in.scale[0][i], in.scale[1][i], in.scale[2][i]);
+		model[i] = glm::scale(glm::translate(glm::mat4(1.0f), position) * glm::mat4_cast(rotation), scale);
+		normal[i] = glm::inverseTranspose(glm::mat3(model[i]));
+		modelView[i] = view * model[i];
+	}
+}
+
+static float maxError(const float *a, const float *b, size_t floats)
+{
+	float error = 0.0f;
+	for (size_t i = 0; i < floats; i++)
+		error = std::max(error, fabsf(a[i] - b[i]) / std::max(1.0f, fabsf(b[i])));
+	return error;
+}
+
+int Benchmarks::transformBatches()
+{
+	const int counts[] = { 1000, 10000, 100000 };
+	const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 60.0f, 90.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	TransformKernelPath best = TransformKernel::getBestPath();
+
+	printf("Transform batches, model + normal + model-view matrices, best of 20 (widest path here: %s):\n",
+		TransformKernel::getPathName(best));
+	printf("\t%8s %-8s %12s %9s %11s\n", "objects", "path", "ns/object", "speed-up", "max error");
+	for (int c = 0; c < 3; c++)
+	{
+		int count = counts[c];
+		TransformBatch batch(count, 777u + c);
+		std::vector<glm::mat4> refModel(count), refModelView(count), model(count), modelView(count);
+		std::vector<glm::mat3> refNormal(count), normal(count);
+
+		double glmNs = 1e30;
+		for (int r = 0; r < 20; r++)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			glmTransforms(batch.arrays, refModel.data(), refNormal.data(), view, refModelView.data());
+			glmNs = std::min(glmNs, elapsedNs(start, BenchClock::now()) / count);
+		}
+		printf("\t%8i %-8s %12.2f %8.1fx %11s\n", count, "glm", glmNs, 1.0, "-");
+
+		for (int p = TRANSFORM_SCALAR; p <= best; p++)
+		{
+			TransformKernelPath path = (TransformKernelPath)p;
+			double ns = 1e30;
+			for (int r = 0; r < 20; r++)
+			{
+				BenchClock::time_point start = BenchClock::now();
+				TransformKernel::run(path, batch.arrays, model.data(), normal.data(), &view, modelView.data());
+				ns = std::min(ns, elapsedNs(start, BenchClock::now()) / count);
+			}
+			float error = std::max(maxError(&model[0][0][0], &refModel[0][0][0], count * 16),
+				std::max(maxError(&normal[0][0][0], &refNormal[0][0][0], count * 9),
+				maxError(&modelView[0][0][0], &refModelView[0][0][0], count * 16)));
+			printf("\t%8i %-8s %12.2f %8.1fx %11.1e\n", count, TransformKernel::getPathName(path), ns, glmNs / ns, error);
+		}
+	}
+	return 0;
+}
+
+/*=================================
+		  Light clustering
+===================================*/
+
+int Benchmarks::lightClustering()
+{
+	const int counts[] = { 256, 1024, 4096 };
+	const float zNear = 1.0f, zFar = 100.0f;
+	// the demo's camera looking down at a room of lights from one of its corners
+	const glm::mat4 projection = glm::perspective(45.0f, WIN_W / (float)WIN_H, zNear, zFar);
+	const glm::mat4 view = glm::lookAt(glm::vec3(-12.0f, 8.0f, -12.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const int clusters = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+
+	printf("Light clustering into %i x %i x %i clusters, lights of radius 3.5 spread over a 40 x 6 x 40 room, best of 20:\n",
+		CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
+	printf("\t%8s %8s %10s %10s %12s %12s\n", "lights", "in view", "build, ms", "indices", "per cluster", "max/cluster");
+	for (int c = 0; c < 3; c++)
+	{
+		LightSubsystem lss;
+		makeRandomPointLights(lss, counts[c], 4242u, glm::vec3(-20.0f, 0.0f, -20.0f), glm::vec3(20.0f, 6.0f, 20.0f));
+		const std::vector<PointLight> &lights = lss.getPointLights();
+
+		LightClusters binned;
+		double ms = 1e30;
+		for (int r = 0; r < 20; r++)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			binned.build(lights, view, projection, zNear, zFar);
+			ms = std::min(ms, elapsedNs(start, BenchClock::now()) / 1e6);
+		}
+
+		// a fragment's loop is as long as its cluster's list, averaged over the clusters holding any
+		const std::vector<uint32_t> &grid = binned.getGrid();
+		int occupied = 0;
+		for (int k = 0; k < clusters; k++)
+			occupied += grid[k * 2 + 1] ? 1 : 0;
+		size_t references = binned.getIndices().size();
+		printf("\t%8i %8i %10.3f %10i %12.1f %12i\n", counts[c], binned.getVisibleLights(), ms, (int)references,
+			occupied ? (double)references / occupied : 0.0, binned.getMaxLightsPerCluster());
+	}
+	return 0;
+}
@@ -1,37 +1,59 @@
 #include "engine.h"
+#include "benchmarks.h"
 #include "settings.h"
 #include "material.h"
 #include <GL/glew.h>
 #include <GL/freeglut.h>
+#include <algorithm>
 
 static Engine *engine;
 
-Engine::Engine(): useMotionBlur(false), drawLightSources(false),
-	curFrame(0), collisionCoord(9.0), framesPerFrame(3),
-	ball(glm::vec3(0.0, 1.0, 0.0), SPHERE_SHAPE, SPHERE_SHAPE), 
-	lightSphere(glm::vec3(0.0), LIGHT_SPHERE_SHAPE, LIGHT_SPHERE_SHAPE)
+Engine::Engine(bool headless, const RenderSettings &rs, const std::string &scenePath): initialized(false),
+	renderAlpha(1.0f), ball(glm::vec3(0.0), SPHERE_SHAPE, SPHERE_LOD_COUNT), drawLightSources(false), accumulator(0.0),
+	printStats(false), statTime(0.0), statFrames(0), statSteps(0), statMaxSteps(0)
 {
 	engine = this;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-	if(gss.initGraphicsSubsystem())
+	AssetLoader loader(LOADER_THREADS);
+	if(gss.initGraphicsSubsystem(loader, headless, rs))
 		return;
 
-	printf("Loading meshes...\n");
-	ball.load();
-	lightSphere.load();
-	plane.load();
-	cube.load();
-
-	ballMat.specularColor = glm::vec4(0.8, 0.8, 0.8, 1.0);
-	ballMat.specularShininess = 0.07f;
-	ballMat.reflectivity = 0.3f;
+	// a mesh whose geometry is already in the registry shares it and has nothing to build
+	Mesh *meshes[] = { &ball, &plane, &cube };
+	std::vector<Mesh*> built;
+	for (size_t i = 0; i < sizeof(meshes) / sizeof(meshes[0]); i++)
+		if (!meshes[i]->attach(meshRegistry))
+		{
+			loader.addMesh(meshes[i]->getKey(), meshes[i]);
+			built.push_back(meshes[i]);
+		}
+	double assetsMs = gss.finishLoading(loader);
+	meshRegistry.printReport();
+	for (size_t i = 0; i < built.size(); i++)
+		built[i]->printOptimizationReport();
 
-	clothMat.specularShininess = 0.0f;
-	clothMat.reflectivity = 0.0f;
+	std::chrono::steady_clock::time_point sceneStart = std::chrono::steady_clock::now();
+	if (!scene.load(scenePath))
+		return;
+	double sceneMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sceneStart).count();
+	printf("Scene %s: %i objects, %i lights in %.2f ms\n", scenePath.c_str(), scene.getObjectCount(),
+		scene.getLightCount() + scene.getPointLightCount(), sceneMs);
+	applyScene();
+	rackBalls();
+
+	profiler.init();
+	profiler.setStartupTime(STARTUP_SHADERS, gss.getShaderLoadMs());
+	profiler.setStartupTime(STARTUP_ASSETS, assetsMs);
+	profiler.setStartupTime(STARTUP_SCENE, sceneMs);
+	profiler.setStartupTime(STARTUP_TOTAL, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	initialized = true;
+}
 
-	woodMat.specularColor = glm::vec4(0.7, 0.7, 0.7, 1.0);
-	woodMat.specularShininess = 0.15f;
-	woodMat.reflectivity = 0.0f;
+int Engine::run()
+{
+	if (!initialized)
+		return GSS_ERROR;
 
 	glutDisplayFunc(Engine::drawCallMediator);
 	glutKeyboardFunc(Engine::keyboardCallMediator);
@@ -39,93 +61,366 @@ Engine::Engine(): useMotionBlur(false), drawLightSources(false),
 	glutMouseFunc(Engine::mouseCallMediator);
 	glutMotionFunc(Engine::mouseMotionCallMediator);
 	glutReshapeFunc(Engine::reshapeCallMediator);
-	glutTimerFunc(TIMER_SPEED, Engine::timerMediator, 0);
+	glutIdleFunc(Engine::idleMediator);
+	lastTick = std::chrono::steady_clock::now();
 	glutMainLoop();
+	return 0;
+}
+
+int Engine::runBenchmark(int frames, const std::string &reportPath)
+{
+	if (!initialized)
+		return GSS_ERROR;
+
+	printf("Running benchmark: %i frames (+%i warm-up)...\n", frames, BENCHMARK_WARMUP_FRAMES);
+	reshapeHandler(WIN_W, WIN_H);
+	drawLightSources = true;
+	profiler.setEnabled(true);
+
+	for (int frame = -BENCHMARK_WARMUP_FRAMES; frame < frames; frame++)
+	{
+		if (frame == 0)
+			profiler.reset();
+		scriptBenchmarkInput(frame + BENCHMARK_WARMUP_FRAMES);
+
+		// a constant frame time keeps the run reproducible regardless of how fast it renders
+		profiler.beginFrame();
+		profiler.setCounter(COUNTER_PHYSICS_STEPS, advance(BENCHMARK_FRAME_TIME));
+		drawHandler();
+		profiler.endFrame();
+	}
+
+	profiler.printSummary();
+	return profiler.writeJson(reportPath, gss.getSettings().describe()) ? 0 : 1;
+}
+
+int Engine::runVertexBenchmark()
+{
+	if (!initialized)
+		return GSS_ERROR;
+
+	reshapeHandler(WIN_W, WIN_H);
+	gss.setCam();
+	printf("Vertex throughput: sphere of %i segments, %i instances per draw, %i draws\n",
+		VERTEX_BENCHMARK_SECTORS, VERTEX_BENCHMARK_INSTANCES, VERTEX_BENCHMARK_REPEATS);
+
+	const char *formatNames[VERTEX_FORMAT_COUNT] = { "float", "packed" };
+	for (int f = 0; f < VERTEX_FORMAT_COUNT; f++)
+	{
+		// the sphere is declared after the registry, it releases its geometry into it on the way out
+		MeshRegistry registry((VertexFormat)f);
+		Sphere sphere(glm::vec3(0.0f), VERTEX_BENCHMARK_SECTORS, 1);
+		sphere.load(registry);
+		if (f == 0)
+			sphere.printOptimizationReport();
+
+		double ms = gss.timeMeshDraws(sphere, VERTEX_BENCHMARK_INSTANCES, VERTEX_BENCHMARK_REPEATS);
+		double triangles = (double)sphere.getTriangleCount() * VERTEX_BENCHMARK_INSTANCES;
+		printf("\t%-7s %5.1f MB of vertices  %8.3f ms per draw  %7.2f M triangles/s\n", formatNames[f],
+			registry.getVertexBytes() / 1048576.0, ms, triangles / ms / 1000.0);
+	}
+	return 0;
+}
+
+int Engine::runShadingBenchmark()
+{
+	if (!initialized)
+		return GSS_ERROR;
+
+	reshapeHandler(WIN_W, WIN_H);
+	profiler.setEnabled(true);
+	pressedKey.clear();
+	rackBalls();
+
+	const int counts[] = { 0, 64, 256, 1024 };
+	const char *pathNames[RENDER_PATH_COUNT] = { "forward", "deferred" };
+	RenderSettings &rs = gss.getSettings();
+	RenderPath initialPath = rs.renderPath;
+	glm::vec2 table = scene.getTableHalfSize();
+
+	printf("Shading: the racked table in a still frame, lights of radius 3.5 over it, scene + lighting passes, %s ms:\n",
+		profiler.hasGpuTimers() ? "GPU" : "CPU");
+	printf("\t%8s %10s %10s %8s\n", "lights", pathNames[RENDER_FORWARD], pathNames[RENDER_DEFERRED], "speed-up");
+	for (int c = 0; c < 4; c++)
+	{
+		Benchmarks::makeRandomPointLights(lss, counts[c], 4242u, glm::vec3(-table.x, 1.0f, -table.y),
+			glm::vec3(table.x, 3.0f, table.y));
+
+		double ms[RENDER_PATH_COUNT];
+		for (int p = 0; p < RENDER_PATH_COUNT; p++)
+		{
+			rs.renderPath = (RenderPath)p;
+			// the first frames of a path compile its pipelines and fill the timer queries
+			for (int frame = -2; frame < SHADING_BENCHMARK_FRAMES; frame++)
+			{
+				if (frame == 0)
+					profiler.reset();
+				profiler.beginFrame();
+				advance(BENCHMARK_FRAME_TIME);
+				drawHandler();
+				profiler.endFrame();
+			}
+			ms[p] = profiler.getPassMs(PASS_SCENE) + profiler.getPassMs(PASS_LIGHTING);
+		}
+		printf("\t%8i %10.3f %10.3f %7.2fx\n", counts[c], ms[RENDER_FORWARD], ms[RENDER_DEFERRED],
+			ms[RENDER_FORWARD] / ms[RENDER_DEFERRED]);
+	}
+
+	rs.renderPath = initialPath;
+	applyScene();
+	rackBalls();
+	return 0;
+}
+
+void Engine::scriptBenchmarkInput(int frame)
+{
+	// the ball drives a square relative to the orbiting camera, so every frame has motion and shadows move
+	const Key path[] = { KEY_UP, KEY_LEFT, KEY_DOWN, KEY_RIGHT };
+	const int segmentFrames = 90;
+
+	pressedKey.clear();
+	pressedKey.insert(path[(frame / segmentFrames) % 4]);
+	gss.rotateCam(glm::vec3(0.25f, (frame / 180) % 2 ? 0.1f : -0.1f, 0.0f));
+}
+
+int Engine::advance(double frameTime)
+{
+	/*=============================================
+	  fixed steps for the elapsed time -> interpolation between the last two
+	===============================================*/
+
+	profiler.beginPass(PASS_SIMULATION);
+	accumulator += frameTime;
+	int steps = 0;
+	while (accumulator >= PHYSICS_STEP && steps < MAX_PHYSICS_STEPS)
+	{
+		workCycle();
+		accumulator -= PHYSICS_STEP;
+		steps++;
+	}
+	// after a long stall drop the time we could not simulate instead of trying to catch up
+	if (steps == MAX_PHYSICS_STEPS)
+		accumulator = std::min(accumulator, PHYSICS_STEP);
+
+	renderAlpha = (float)(accumulator / PHYSICS_STEP);
+	gss.setCamTarget(physics.getPosition(CUE_BALL, renderAlpha));
+	profiler.endPass(PASS_SIMULATION);
+	return steps;
 }
 
 void Engine::workCycle()
 {
 	/*=============================================
-	  keys processing -> ball's movement -> drawing
+	  keys processing -> balls' movement, one fixed step
 	===============================================*/
 	
-	float div = useMotionBlur ? 1.0f / framesPerFrame : 1.0f;
+	glm::vec3 camv = gss.getViewVector();
+	glm::vec2 forward = glm::normalize(glm::vec2(camv.x, camv.z));
+	glm::vec2 dir(0.0f);
 	for (std::set<Key>::iterator key = pressedKey.begin(); key != pressedKey.end(); key++)
 	{
-		glm::vec3 camv = gss.getViewVector();
 		switch (*key)
 		{
 		case Engine::KEY_UP:
-			ball.changeVelocity(camv, div);
+			dir += forward;
 			break;
 		case Engine::KEY_DOWN:
-			ball.changeVelocity(-camv, div);
+			dir -= forward;
 			break;
 		case Engine::KEY_LEFT:
-			ball.changeVelocity(glm::vec3(camv.z, 0.0f, -camv.x), div);
+			dir += glm::vec2(forward.y, -forward.x);
 			break;
 		case Engine::KEY_RIGHT:
-			ball.changeVelocity(glm::vec3(-camv.z, 0.0f, camv.x), div);
+			dir += glm::vec2(-forward.y, forward.x);
 			break;
 		default:
 			break;
 		}
 	}
-	ball.move(div);
-	glm::vec3 bwp = ball.getWorldPos();
-	glm::vec3 bv = ball.getVelocity();
-
-	if (abs(bwp.x) > collisionCoord)
-		ball.setVelocity(glm::vec3(-bv.x, 0.0, bv.z));
-	if (abs(bwp.z) > 9.0)
-		ball.setVelocity(glm::vec3(bv.x, 0.0, -bv.z));
-	bwp = glm::clamp(bwp, -collisionCoord, collisionCoord);
-	
-	gss.setCamTarget(bwp);
-	ball.setWorldPos(bwp);
+	if (glm::length(dir) > EPS)
+		physics.accelerate(CUE_BALL, glm::normalize(dir) * (float)(CUE_ACCELERATION * PHYSICS_STEP), CUE_MAX_SPEED);
 
-	glutPostRedisplay();
+	physics.step((float)PHYSICS_STEP);
+
+	// a pocketed cue ball goes back to its spot
+	if (physics.isPocketed(CUE_BALL))
+		physics.placeBall(CUE_BALL, glm::vec2(0.0f, 6.0f));
+}
+
+void Engine::applyScene()
+{
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+	{
+		bool used = i < scene.getLightCount();
+		lss.setLightWorldPos(i, glm::vec4(used ? scene.getLightPositions()[i] : glm::vec3(0.0f), 1.0f));
+		lss.setLightIntesity(i, glm::vec4(used ? scene.getLightIntensities()[i] : glm::vec3(0.0f), 1.0f));
+	}
+	if (scene.getLightCount() > NUMBER_OF_LIGHTS)
+		printf("The scene has %i lights, only the first %i are used\n", scene.getLightCount(), NUMBER_OF_LIGHTS);
+	lss.clearPointLights();
+	for (int i = 0; i < scene.getPointLightCount(); i++)
+		if (!lss.addPointLight(scene.getPointLightPositions()[i], scene.getPointLightIntensities()[i], scene.getPointLightRadii()[i]))
+		{
+			printf("The scene has %i point lights, only the first %i are used\n", scene.getPointLightCount(), MAX_POINT_LIGHTS);
+			break;
+		}
+	lss.setAmbientIntensity(scene.getAmbient());
+	lss.setHalfLightDistance(scene.getLightHalfDistance());
+
+	PhysicsParams params = physics.getParams();
+	params.tableHalfSize = scene.getTableHalfSize();
+	physics.setParams(params);
+	// the balls stay on the table, below the top of a ball
+	gss.setShadowBounds(glm::vec3(-params.tableHalfSize.x, 0.0f, -params.tableHalfSize.y),
+		glm::vec3(params.tableHalfSize.x, 2.0f * params.ballRadius, params.tableHalfSize.y));
+
+	// scene objects first, their parents always come before them; the balls get their nodes when racked
+	const std::vector<unsigned char> &meshes = scene.getMeshes();
+	const std::vector<int32_t> &parents = scene.getParents();
+	transforms.clear();
+	objectNodes.clear();
+	objectInstances.clear();
+	ballNodes.clear();
+	int planes = 0, balls = 0;
+	for (int i = 0; i < scene.getObjectCount(); i++)
+	{
+		int parent = parents[i] >= 0 && parents[i] < i ? objectNodes[parents[i]] : -1;
+		objectNodes.push_back(transforms.addNode(scene.getPositions()[i], scene.getRotations()[i], scene.getScales()[i], parent));
+		objectInstances.push_back(meshes[i] == SCENE_MESH_PLANE ? planes++ : balls++);
+	}
+	planeInstances.resize(planes);
+	sceneBallInstances.resize(balls);
+	transforms.update();
+	updateObjectInstances();
+}
+
+// only the objects whose transforms the last update changed
+void Engine::updateObjectInstances()
+{
+	const std::vector<unsigned char> &meshes = scene.getMeshes();
+	const std::vector<unsigned char> &materials = scene.getMaterialIds();
+	const std::vector<unsigned char> &textures = scene.getTextures();
+	const std::vector<glm::vec2> &textureScales = scene.getTextureScales();
+	for (size_t i = 0; i < objectNodes.size(); i++)
+	{
+		int node = objectNodes[i];
+		if (!transforms.isChanged(node))
+			continue;
+		const glm::mat4 &modelToWorld = transforms.getWorld(node);
+		const glm::mat3 &normal = transforms.getNormal(node);
+		if (meshes[i] == SCENE_MESH_PLANE)
+			planeInstances[objectInstances[i]] = gss.makePlaneInstance(modelToWorld, normal, textureScales[i],
+				(TextureId)textures[i], (MaterialId)materials[i]);
+		else
+			sceneBallInstances[objectInstances[i]] = gss.makeBallInstance(modelToWorld, normal, modelToWorld,
+				(MaterialId)materials[i]);
+	}
+}
+
+void Engine::rackBalls()
+{
+	const float r = physics.getParams().ballRadius;
+	// a hair of spacing, so the rack doesn't start in contact
+	const float gap = 2.0f * r * 1.001f;
+	const float rowStep = gap * 0.8660254f;
+
+	physics.clear();
+	physics.addBall(glm::vec2(0.0f, 6.0f));
+	for (int row = 0; row < 5; row++)
+		for (int i = 0; i <= row && physics.getBallCount() < BALL_COUNT; i++)
+			physics.addBall(glm::vec2((i - row * 0.5f) * gap, -2.0f - row * rowStep));
+
+	// the balls' nodes follow the scene's and are added on the first rack
+	while ((int)ballNodes.size() < physics.getBallCount())
+		ballNodes.push_back(transforms.addNode(glm::vec3(0.0f), glm::quat(), glm::vec3(1.0f)));
+
+	lastBallTransforms.clear();
+	for (int i = 0; i < physics.getBallCount(); i++)
+		lastBallTransforms.push_back(physics.getModelToWorldMat(i));
+	renderAlpha = 1.0f;
+	gss.setCamTarget(physics.getPosition(CUE_BALL));
 }
 
 void Engine::drawHandler()
 {
-	gss.shadowMapPass(static_cast<Mesh*>(&ball), lss);
-	gss.clearBuffers();
+	gss.beginFrame();
 	gss.setCam();
+
+	// a ball at rest keeps its matrices
+	for (int i = 0; i < physics.getBallCount(); i++)
+		if (!physics.isPocketed(i))
+			transforms.setLocal(ballNodes[i], physics.getPosition(i, renderAlpha), physics.getRotation(i, renderAlpha), glm::vec3(1.0f));
+	int matricesUpdated = transforms.update();
+	updateObjectInstances();
+
+	ballInstances.clear();
+	for (int i = 0; i < physics.getBallCount(); i++)
+	{
+		if (physics.isPocketed(i))
+			continue;
+		const glm::mat4 &modelToWorld = transforms.getWorld(ballNodes[i]);
+		ballInstances.push_back(gss.makeBallInstance(modelToWorld, transforms.getNormal(ballNodes[i]), lastBallTransforms[i], MATERIAL_BALL));
+		lastBallTransforms[i] = modelToWorld;
+	}
+	size_t movingBalls = ballInstances.size();
+	ballInstances.insert(ballInstances.end(), sceneBallInstances.begin(), sceneBallInstances.end());
+	gss.submitBalls(ball, ballInstances, movingBalls);
+	gss.submitPlanes(plane, planeInstances);
+	if (drawLightSources)
+		gss.submitLights(&ball, lss);
+	gss.submitSkybox(cube);
+
+	profiler.beginPass(PASS_SHADOW);
+	gss.shadowMapPass(lss);
+	profiler.endPass(PASS_SHADOW);
+
+	profiler.beginPass(PASS_SCENE);
+	gss.beginScene();
+	gss.clearBuffers();
 	gss.bindLighting(lss);
 
-	gss.bindMaterial(ballMat);
-	gss.drawBall(ball);
-	
-	gss.bindMaterial(clothMat);
-	setPlane(0);
-	gss.drawPlane(plane, gss.getClothTexture());
+	for (int i = 0; i < MATERIAL_COUNT; i++)
+		gss.setMaterial((MaterialId)i, scene.getMaterial((MaterialId)i));
+
+	gss.flushQueue(QUEUE_OPAQUE);
+	profiler.endPass(PASS_SCENE);
 
-	gss.bindMaterial(woodMat);
-	for (int i = 1; i < 5; i++)
+	if (gss.getSettings().renderPath == RENDER_DEFERRED)
 	{
-		setPlane(i);
-		gss.drawPlane(plane, gss.getWoodTexture());
+		profiler.beginPass(PASS_LIGHTING);
+		gss.deferredLightingPass();
+		profiler.endPass(PASS_LIGHTING);
 	}
 
 	if (drawLightSources)
-		gss.drawLight(static_cast<Mesh*>(&lightSphere), lss);
+	{
+		profiler.beginPass(PASS_LIGHTS);
+		gss.flushQueue(QUEUE_LIGHTS);
+		profiler.endPass(PASS_LIGHTS);
+	}
+
+	profiler.beginPass(PASS_SKYBOX);
+	gss.flushQueue(QUEUE_SKYBOX);
+	profiler.endPass(PASS_SKYBOX);
 
-	gss.drawSkybox(cube);
+	profiler.setCounter(COUNTER_STATE_CHANGES, gss.getStateChangesIssued());
+	profiler.setCounter(COUNTER_STATE_CHANGES_SKIPPED, gss.getStateChangesSkipped());
+	profiler.setCounter(COUNTER_TRIANGLES, gss.getTrianglesDrawn());
+	profiler.setCounter(COUNTER_MATRICES_UPDATED, matricesUpdated);
+	profiler.setCounter(COUNTER_LIGHTS_PER_CLUSTER, gss.getMaxLightsPerCluster());
+	profiler.setCounter(COUNTER_CLUSTER_DROPS, gss.getClusterEntriesDropped());
+	profiler.setCounter(COUNTER_SHADOW_CASTERS, gss.getShadowCastersDrawn());
 
-	if (useMotionBlur)
+	if (gss.getSettings().motionBlur)
 	{
-		gss.accumFrame(curFrame, framesPerFrame);
-		curFrame++;
-		if (curFrame >= framesPerFrame)
-		{
-			curFrame = 0;
-			gss.returnFrame();
-			gss.swapBuffers();
-		}
+		profiler.beginPass(PASS_MOTION_BLUR);
+		gss.motionBlurPass();
+		profiler.endPass(PASS_MOTION_BLUR);
 	}
-	else
-		gss.swapBuffers();
+
+	profiler.beginPass(PASS_PRESENT);
+	gss.swapBuffers();
+	profiler.endPass(PASS_PRESENT);
 }
 
 void Engine::keyPressHandler(unsigned char key, int x, int y, bool pressed)
@@ -148,6 +443,7 @@ void Engine::keyPressHandler(unsigned char key, int x, int y, bool pressed)
 
 	if (pressed)
 	{
+		MaterialBlock &ballMat = scene.getMaterial(MATERIAL_BALL);
 		pressedKey.insert(input);
 		switch (key)
 		{
@@ -160,15 +456,59 @@ void Engine::keyPressHandler(unsigned char key, int x, int y, bool pressed)
 		case 'V':
 		case 'v': ballMat.reflectivity += 0.03f; break;
 		case 'B':
-		case 'b': 
-			useMotionBlur = !useMotionBlur; curFrame = 0; 
-			printf("Motion blur %s\n", useMotionBlur ? "ON" : "OFF");
+		case 'b':
+		{
+			RenderSettings &rs = gss.getSettings();
+			rs.motionBlur = !rs.motionBlur;
+			printf("Motion blur %s\n", rs.motionBlur ? "ON" : "OFF");
 			break;
+		}
 		case 'L':
 		case 'l': 
 			drawLightSources = !drawLightSources; 
 			printf("%s\n", drawLightSources ? "Light sources are shown" : "Light sources are hidden");
 			break;
+		case 'R':
+		case 'r':
+			rackBalls();
+			break;
+		case 'I':
+		case 'i':
+			printStats = !printStats;
+			statTime = 0.0; statFrames = statSteps = statMaxSteps = 0;
+			break;
+		case 'K':
+		case 'k':
+		{
+			RenderSettings &rs = gss.getSettings();
+			rs.shadowMode = (ShadowMode)((rs.shadowMode + 1) % SHADOW_MODE_COUNT);
+			printf("Render settings: %s\n", rs.describe().c_str());
+			break;
+		}
+		case 'H':
+		case 'h':
+		{
+			RenderSettings &rs = gss.getSettings();
+			rs.shadowQuality = (ShadowQuality)((rs.shadowQuality + 1) % SHADOW_QUALITY_COUNT);
+			printf("Render settings: %s\n", rs.describe().c_str());
+			break;
+		}
+		case 'G':
+		case 'g':
+		{
+			RenderSettings &rs = gss.getSettings();
+			rs.renderPath = (RenderPath)((rs.renderPath + 1) % RENDER_PATH_COUNT);
+			printf("Render settings: %s\n", rs.describe().c_str());
+			break;
+		}
+		case 'F':
+		case 'f':
+		{
+			RenderSettings &rs = gss.getSettings();
+			rs.textureFilter = (TextureFilter)((rs.textureFilter + 1) % FILTER_COUNT);
+			printf("Render settings: %s\n", rs.describe().c_str());
+			break;
+		}
 		}
 		ballMat.specularShininess = glm::clamp(ballMat.specularShininess, 0.0f, 0.3f);
 		ballMat.reflectivity = glm::clamp(ballMat.reflectivity, 0.0f, 1.0f);
@@ -223,52 +563,32 @@ void Engine::reshapeHandler(int w, int h)
 }
 
 
-void Engine::setPlane(int index)
-{
-	const glm::vec3 planePos[] = {
-		glm::vec3(0.0, 0.0, 0.0),
-		glm::vec3(10.0, 0.5, 0.0),
-		glm::vec3(-10.0, 0.5, 0.0),
-		glm::vec3(0.0, 0.5, -10.0),
-		glm::vec3(0.0, 0.5, 10.0),
-	};
-	const glm::vec3 planeRot[] = {
-		glm::vec3(0.0, 0.0, 0.0),
-		glm::vec3(0.0, 0.0, M_PI / 2.0),
-		glm::vec3(0.0, 0.0, -M_PI / 2.0),
-		glm::vec3(M_PI / 2.0, 0.0, 0.0),
-		glm::vec3(-M_PI / 2.0, 0.0, 0.0),
-	};
-	const glm::vec3 planeScale[] = {
-		glm::vec3(10.0, 1.0, 10.0),
-		glm::vec3(0.5, 1.0, 10.0),
-		glm::vec3(0.5, 1.0, 10.0),
-		glm::vec3(10.0, 1.0, 0.5),
-		glm::vec3(10.0, 1.0, 0.5),
-	};
-	const glm::vec2 planeTexScale[] = {
-		glm::vec2(10.0, 10.0),
-		glm::vec2(0.5, 10.0),
-		glm::vec2(0.5, 10.0),
-		glm::vec2(10.0, 0.5),
-		glm::vec2(10.0, 0.5),
-	};
-
-	plane.setWorldPos(planePos[index]);
-	plane.setRotate(planeRot[index]);
-	plane.setScale(planeScale[index]);
-	plane.setTextureScale(planeTexScale[index]);
-}
-
-
 /*=================================
 		   Call Handlers
 ===================================*/
 
-void Engine::timerMediator(int value)
+void Engine::idleMediator()
 {
-	engine->workCycle();
-	glutTimerFunc(TIMER_SPEED, Engine::timerMediator, 0);
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double frameTime = std::chrono::duration<double>(now - engine->lastTick).count();
+	engine->lastTick = now;
+
+	int steps = engine->advance(frameTime);
+	glutPostRedisplay();
+
+	if (!engine->printStats)
+		return;
+	engine->statTime += frameTime;
+	engine->statFrames++;
+	engine->statSteps += steps;
+	engine->statMaxSteps = std::max(engine->statMaxSteps, steps);
+	if (engine->statTime >= 1.0)
+	{
+		printf("%.1f fps, %.2f physics steps per frame (max %i)\n", engine->statFrames / engine->statTime,
+			(double)engine->statSteps / engine->statFrames, engine->statMaxSteps);
+		engine->statTime = 0.0;
+		engine->statFrames = engine->statSteps = engine->statMaxSteps = 0;
+	}
 }
 
 void Engine::drawCallMediator()
@@ -5,36 +5,110 @@
 #include "material.h"
 
 #include <algorithm>
+#include <chrono>
 
 #include <GL/glew.h>
 #include <GL/freeglut.h>
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
-//#include <glimg/glimg.h>
 
 #define loadSky 1
 
+const char *programNames[PROGRAM_COUNT] = { "shadow", "simple", "skybox", "plane", "ball", "shadowLayered", "planeLayered", "motionBlur",
+	"planeDeferred", "ballDeferred", "deferredLighting", "deferredLightingLayered", "shadowCube", "planeCube",
+	"deferredLightingCube" };
+
+const char *uniformNames[UNIFORM_COUNT] = { "modelToWorldMatrix", "normalModelToCameraMatrix",
+	"normalModelToWorldMatrix", "modelToLightToClipMatrix", "worldToLightMatrix", "worldToLightITMatrix",
+	"textureScale", "shadowTexSize", "colorTexture", "shadowTexture", "skybox", "camPos",
+	"worldToLightClipMatrix", "shadowTextureArray", "prevModelToWorldMatrix", "sceneColor", "sceneVelocity", "blurScale",
+	"pointLights", "clusterGrid", "clusterIndices", "clusterSize", "clusterScale",
+	"gbufferAlbedo", "gbufferNormal", "gbufferVelocity", "gbufferDepth", "clipToCameraMatrix", "cameraToWorldMatrix",
+	"shadowCube", "lightWorldPosition", "shadowRange", "worldToFaceClipMatrix", "faceMask" };
+
+const char *blockNames[BLOCK_COUNT] = { "GlobalMatrices", "Light", "MaterialTable" };
+
+const TextureSource textureSources[TEXTURE_COUNT] = {
+	{ "ball_albedo", 1, { TEXTURE_PATH "ball_albedo.png" } },
+	{ "cloth", 1, { TEXTURE_PATH "cloth.png" } },
+	{ "wood", 1, { TEXTURE_PATH "wood.png" } },
+	{ "skybox", 6, { TEXTURE_PATH "skybox/negx.jpg", TEXTURE_PATH "skybox/posx.jpg",
+		TEXTURE_PATH "skybox/negy.jpg", TEXTURE_PATH "skybox/posy.jpg",
+		TEXTURE_PATH "skybox/negz.jpg", TEXTURE_PATH "skybox/posz.jpg" } },
+	{ "skyboxBall", 6, { TEXTURE_PATH "skyboxBall/negx.jpg", TEXTURE_PATH "skyboxBall/posx.jpg",
+		TEXTURE_PATH "skyboxBall/negy.jpg", TEXTURE_PATH "skyboxBall/posy.jpg",
+		TEXTURE_PATH "skyboxBall/negz.jpg", TEXTURE_PATH "skyboxBall/posz.jpg" } },
+};
+
+const char *materialNames[MATERIAL_COUNT] = { "ball", "cloth", "wood" };
+
+// the ball is mapped pole to pole along t, the planes tile their textures
+const SamplerDesc materialSamplers[MATERIAL_COUNT] = {
+	{ GL_REPEAT, GL_CLAMP_TO_EDGE, 4.0f },
+	{ GL_REPEAT, GL_REPEAT, 16.0f },
+	{ GL_REPEAT, GL_REPEAT, 8.0f },
+};
+
+// textures the plane shader can pick per instance, the slot goes into InstanceData::params.z
+static const int PLANE_TEXTURE_COUNT = 2;
+static const TextureId planeTextures[PLANE_TEXTURE_COUNT] = { TEXTURE_CLOTH, TEXTURE_WOOD };
+static const MaterialId planeMaterials[PLANE_TEXTURE_COUNT] = { MATERIAL_CLOTH, MATERIAL_WOOD };
+
+static const GLuint INSTANCE_ATTRIBUTE = 3;
+
+// texels along a shadow map and along a cube map face, and the depth format, for every ShadowQuality.
+// The frusta are cut around the casters, so even 16 bits resolve their short depth range finely
+static const struct
+{
+	int mapSize;
+	int cubeSize;
+	GLenum depthFormat;
+} shadowQualities[SHADOW_QUALITY_COUNT] = {
+	{ 512, 256, GL_DEPTH_COMPONENT16 },
+	{ 1024, 512, GL_DEPTH_COMPONENT16 },
+	{ 2048, 1024, GL_DEPTH_COMPONENT24 },
+};
+
+#ifndef _WIN32
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+#endif
+
 GraphicsSubsystem::GraphicsSubsystem(): sphereCamRelPos(295.0f, -73.0f, 4.0f), 
 	camTarget(0.0f, 1.0f, 0.0f), 
 	windowSize(WIN_W, WIN_H), 
 	zNear(1.0f),	zFar(100.0f), IBLscale(0.07f),
 	minCamAngle(-87.0f), maxCamAngle(-1.0f),
-	minCamDistance(3.0f), maxCamDistance(12.0f)
-{ }
+	minCamDistance(3.0f), maxCamDistance(12.0f),
+	shaderLoadMs(0.0), headless(false), screenFbo(0), pixelsPerUnit(0.0f), hasPrevCam(false),
+	instanceBuffer(0), instanceBufferSize(0), instancesUploaded(false),
+	trianglesDrawn(0), lightProjScale(1.0f),
+	shadowBoundsMin(-10.0f, 0.0f, -10.0f), shadowBoundsMax(10.0f, 2.0f, 10.0f),
+	casterBoundsMin(shadowBoundsMin), casterBoundsMax(shadowBoundsMax),
+	shadowQuality(SHADOW_QUALITY_MEDIUM), shadowMapSize(0), cubeShadowSize(0), shadowDepthFormat(GL_DEPTH_COMPONENT16),
+	staticShadowsValid(false), shadowMapsValid(false), shadowMapsMode(SHADOW_PER_LIGHT),
+	staticSnapshotLod(0), planeSnapshotLod(0), dynamicSnapshotLod(0), shadowCastersDrawn(0),
+	shadowRange(1.0f), staticCubesValid(false), clusterOverflowReported(false)
+{
+	CasterRange none = { NULL, 0, 0, 0 };
+	dynamicCasters = staticCasters = planeCasters = none;
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+		cubeDynamicFaces[i] = 0;
+}
 
-int GraphicsSubsystem::initGraphicsSubsystem()
+int GraphicsSubsystem::initGraphicsSubsystem(AssetLoader &loader, bool offscreen, const RenderSettings &rs)
 {
-	char *myargv[1];
-	int myargc = 1;
-	myargv[0] = _strdup(COPYRIGHT);
-	glutInit(&myargc, myargv);
-	glutInitWindowPosition(WIN_POS_X, WIN_POS_Y);
-	glutInitWindowSize(windowSize.x, windowSize.y);
-	glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGBA | GLUT_MULTISAMPLE);
-	glutCreateWindow("Practical Work");
+	headless = offscreen;
+	settings = rs;
+	if (headless ? createHeadlessContext() : createWindow())
+		return GSS_ERROR;
 
 	glewExperimental = GL_TRUE;
 	GLenum err = glewInit();
@@ -52,35 +126,34 @@ int GraphicsSubsystem::initGraphicsSubsystem()
 		return GSS_ERROR;
 	}
 
-	bindingIndexes["matrices"] = 0;
-	bindingIndexes["light"] = 1;
-	bindingIndexes["material"] = 2;
+	if (headless)
+		createScreenTarget();
 
-	const char *textureUnits[] = { "ball", "cloth", "wood", "room", "roomBall" };
-	loadTextureUnits(textureUnits, sizeof(textureUnits) / sizeof(char*));
+	loadTextureUnits();
 
-	loadShaders();
-	loadUniforms();
-	loadBuffers();
-	
-	printf("Loading textures...\n");
-	loadTexture(TEXTURE_PATH "ball_albedo.png", textures["ball"]);
-	loadTexture(TEXTURE_PATH "cloth.png", textures["cloth"]);
-	loadTexture(TEXTURE_PATH "wood.png", textures["wood"]);
+	// images decode on the loader's threads while the shaders compile here
+	printf("Loading textures on %i threads...\n", loader.getThreadCount());
+	loadTexture(loader, TEXTURE_BALL);
+	loadTexture(loader, TEXTURE_CLOTH);
+	loadTexture(loader, TEXTURE_WOOD);
 
 #if loadSky == 1
-	const char *skybox[] = { TEXTURE_PATH "skybox/negx.jpg", TEXTURE_PATH "skybox/posx.jpg",
-		TEXTURE_PATH "skybox/negy.jpg", TEXTURE_PATH "skybox/posy.jpg",
-		TEXTURE_PATH "skybox/negz.jpg", TEXTURE_PATH "skybox/posz.jpg" };
-	const char *skyboxBall[] = { TEXTURE_PATH "skyboxBall/negx.jpg", TEXTURE_PATH "skyboxBall/posx.jpg",
-		TEXTURE_PATH "skyboxBall/negy.jpg", TEXTURE_PATH "skyboxBall/posy.jpg",
-		TEXTURE_PATH "skyboxBall/negz.jpg", TEXTURE_PATH "skyboxBall/posz.jpg" };
-	loadCubemap(skybox, sizeof(skybox) / sizeof(char*), textures["room"]);
-	loadCubemap(skyboxBall, sizeof(skyboxBall) / sizeof(char*), textures["roomBall"]);
+	loadCubemap(loader, TEXTURE_ROOM);
+	loadCubemap(loader, TEXTURE_ROOM_BALL);
 #endif
 
+	loadShaders();
+	loadUniforms();
+	loadBuffers();
+
+	selectShadowQuality();
 	createDepthBuffer();
-	createSampler();
+	createLayeredDepthBuffer();
+	createCubeDepthBuffers();
+	createSceneTarget();
+	createGBuffer();
+	createSamplers();
+	createClusterBuffers();
 
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
@@ -93,63 +166,165 @@ int GraphicsSubsystem::initGraphicsSubsystem()
 	glDepthFunc(GL_LEQUAL);
 	glDepthRange(0.0f, 1.0f);
 	glEnable(GL_DEPTH_CLAMP);
-	
+
+	// loading bound things behind the cache's back
+	state.invalidate();
 	return 0;
 }
 
-void GraphicsSubsystem::loadTextureUnits(const char *textureUnits[], int tsize)
+int GraphicsSubsystem::createWindow()
 {
-	for (int i = 0; i < tsize; i++)
-		texUnits[textureUnits[i]] = i;
-	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
-		shadowTexUnit[i] = tsize + i;
+	static char appName[] = COPYRIGHT;
+	char *myargv[1];
+	int myargc = 1;
+	myargv[0] = appName;
+	glutInit(&myargc, myargv);
+	glutInitWindowPosition(WIN_POS_X, WIN_POS_Y);
+	glutInitWindowSize(windowSize.x, windowSize.y);
+	glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGBA | GLUT_MULTISAMPLE);
+	// everything is drawn from vertex arrays with shaders, nothing needs the fixed function pipeline
+	glutInitContextVersion(3, 3);
+	glutInitContextProfile(GLUT_CORE_PROFILE);
+	glutCreateWindow("Practical Work");
+	return 0;
 }
 
-void GraphicsSubsystem::loadUniforms(GLuint pr, const char *uniforms[], int usize, const char *blocks[], int bsize)
+#ifdef _WIN32
+int GraphicsSubsystem::createHeadlessContext()
 {
-	for (int i = 0; i < usize; i++)
-		programUniforms[pr][uniforms[i]] = glGetUniformLocation(pr, uniforms[i]);
-	for (int i = 0; i < bsize; i++)
-		programUniforms[pr][blocks[i]] = glGetUniformBlockIndex(pr, blocks[i]);
+	// there is no surfaceless EGL on the windows build, so a hidden window only provides the context
+	createWindow();
+	glutHideWindow();
+	return 0;
 }
 
-void GraphicsSubsystem::loadTexture(const char *filename, GLuint &texture)
+void GraphicsSubsystem::destroyHeadlessContext()
+{ }
+#else
+int GraphicsSubsystem::createHeadlessContext()
 {
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	eglDisplay = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL)
+		: eglGetDisplay(EGL_DEFAULT_DISPLAY);
 
-	/*
-    std::auto_ptr<glimg::ImageSet> pImageSet(glimg::loaders::stb::LoadFromFile(filename));
-    glimg::SingleImage image = pImageSet->GetImage(0, 0, 0);
-	glimg::Dimensions dims = image.GetDimensions();
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, dims.width, dims.height, 0,
-		GL_RGB, GL_UNSIGNED_BYTE, image.GetImageData());*/
-    uint32_t img[4] = { 0x0, 0xFFFFFFFF, 0xFFFFFFFF, 0x0 };
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, img );
+	EGLint major, minor;
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor))
+	{
+		printf("Can't initialize EGL display\n");
+		return GSS_ERROR;
+	}
+	eglBindAPI(EGL_OPENGL_API);
+
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	eglChooseConfig(eglDisplay, configAttribs, &config, 1, &numConfigs);
+
+	// core profile, as in createWindow()
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	eglContext = eglCreateContext(eglDisplay, numConfigs ? config : (EGLConfig)0, EGL_NO_CONTEXT, contextAttribs);
+	if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+	{
+		printf("Can't create surfaceless OpenGL context (EGL error 0x%x)\n", eglGetError());
+		return GSS_ERROR;
+	}
+	printf("Headless EGL %i.%i context created\n", major, minor);
+	return 0;
+}
 
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-	glBindTexture(GL_TEXTURE_2D, 0);
+void GraphicsSubsystem::destroyHeadlessContext()
+{
+	if (eglDisplay == EGL_NO_DISPLAY)
+		return;
+	eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (eglContext != EGL_NO_CONTEXT)
+		eglDestroyContext(eglDisplay, eglContext);
+	eglTerminate(eglDisplay);
+}
+#endif
+
+void GraphicsSubsystem::createScreenTarget()
+{
+	glGenRenderbuffers(2, screenRenderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, screenRenderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, windowSize.x, windowSize.y);
+	glBindRenderbuffer(GL_RENDERBUFFER, screenRenderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, windowSize.x, windowSize.y);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &screenFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, screenRenderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, screenRenderbuffers[1]);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		printf("Offscreen FB error, status: 0x%x\n", status);
 }
 
-void GraphicsSubsystem::loadCubemap(const char *filenames[], int csize, GLuint &texture)
+void GraphicsSubsystem::loadTextureUnits()
 {
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
-	for(int i = 0; i < csize; i++)
+	for (int i = 0; i < TEXTURE_COUNT; i++)
 	{
-        /*
-		std::auto_ptr<glimg::ImageSet> pImageSet(glimg::loaders::stb::LoadFromFile(filenames[i]));
-		glimg::SingleImage image = pImageSet->GetImage(0, 0, 0);
-		glimg::Dimensions dims = image.GetDimensions();
+		textures[i].id = 0;
+		textures[i].unit = i;
+		textures[i].target = (i == TEXTURE_ROOM || i == TEXTURE_ROOM_BALL) ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+	}
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+		shadowTexUnit[i] = TEXTURE_COUNT + i;
+	for (int i = 0; i < 2; i++)
+		sceneTexUnit[i] = TEXTURE_COUNT + NUMBER_OF_LIGHTS + i;
+	for (int i = 0; i < CLUSTER_BUFFER_COUNT; i++)
+		clusterTexUnit[i] = TEXTURE_COUNT + NUMBER_OF_LIGHTS + 2 + i;
+	for (int i = 0; i < GBUFFER_COUNT; i++)
+		gbufferTexUnit[i] = TEXTURE_COUNT + NUMBER_OF_LIGHTS + 2 + CLUSTER_BUFFER_COUNT + i;
+}
 
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,	GL_RGB, dims.width, dims.height, 0,
-			GL_RGB, GL_UNSIGNED_BYTE, image.GetImageData());*/
-        uint32_t img[4] = { 0x0, 0xFFFFFFFF, 0xFFFFFFFF, 0x0 };
-        glTexImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, img );
+void GraphicsSubsystem::loadUniforms(ProgramHandle &program)
+{
+	// uniforms a program doesn't use resolve to -1, which glUniform* silently ignores
+	for (int i = 0; i < UNIFORM_COUNT; i++)
+		program.uniforms[i] = glGetUniformLocation(program.id, uniformNames[i]);
+	for (int i = 0; i < BLOCK_COUNT; i++)
+	{
+		program.blocks[i] = glGetUniformBlockIndex(program.id, blockNames[i]);
+		if (program.blocks[i] != GL_INVALID_INDEX)
+			glUniformBlockBinding(program.id, program.blocks[i], i);
 	}
+}
+
+void GraphicsSubsystem::loadTexture(AssetLoader &loader, TextureId texture)
+{
+	const TextureSource &src = textureSources[texture];
+	glGenTextures(1, &textures[texture].id);
+	glBindTexture(GL_TEXTURE_2D, textures[texture].id);
+	// the image and its mip chain arrive in finishLoading()
+	loader.addTexture(src.name, textures[texture].id, GL_TEXTURE_2D, GL_RGBA, src.files, src.count,
+		std::string(COOKED_TEXTURE_PATH) + src.name + ".gtex");
+
+	// only seen without a sampler bound, the material samplers override them
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void GraphicsSubsystem::loadCubemap(AssetLoader &loader, TextureId texture)
+{
+	const TextureSource &src = textureSources[texture];
+	glGenTextures(1, &textures[texture].id);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textures[texture].id);
+	loader.addTexture(src.name, textures[texture].id, GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_RGB, src.files, src.count,
+		std::string(COOKED_TEXTURE_PATH) + src.name + ".gtex");
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -164,8 +339,8 @@ void GraphicsSubsystem::createDepthBuffer()
 	{
 		glGenTextures(1, &shadowMapTextures[i]);
 		glBindTexture(GL_TEXTURE_2D, shadowMapTextures[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, 1024, 1024,//windowSize.x, windowSize.y, SIZEOF_DEPTH_BUFFER
-            0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexImage2D(GL_TEXTURE_2D, 0, shadowDepthFormat, shadowMapSize, shadowMapSize,
+			0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 
 		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -187,129 +362,475 @@ void GraphicsSubsystem::createDepthBuffer()
 			printf("FB error, status: 0x%x\n", Status);
 			return;
 		}
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFbo);
+	}
+
+	// the cached depth of the static casters, only ever copied from
+	glGenTextures(NUMBER_OF_LIGHTS, staticShadowTextures);
+	glGenFramebuffers(NUMBER_OF_LIGHTS, staticShadowFbo);
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, staticShadowTextures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, shadowDepthFormat, shadowMapSize, shadowMapSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, staticShadowFbo[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, staticShadowTextures[i], 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+			printf("Static shadow FB error, status: 0x%x\n", status);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void GraphicsSubsystem::createLayeredDepthBuffer()
+{
+	glGenTextures(1, &shadowArrayTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, shadowArrayTexture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, shadowDepthFormat, shadowMapSize, shadowMapSize, NUMBER_OF_LIGHTS,
+		0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// attaching the whole array makes the framebuffer layered, gl_Layer picks the light
+	glGenFramebuffers(1, &shadowArrayFbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowArrayFbo);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowArrayTexture, 0);
+	glDrawBuffer(GL_NONE);
+
+	GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		printf("Layered FB error, status: 0x%x\n", status);
+
+	// single layers, the targets of copying the cached depth
+	glGenFramebuffers(NUMBER_OF_LIGHTS, shadowLayerFbo);
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+	{
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowLayerFbo[i]);
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowArrayTexture, 0, i);
+		glDrawBuffer(GL_NONE);
+	}
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFbo);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void GraphicsSubsystem::createCubeDepthBuffers()
+{
+	// the distance to the light goes in as depth
+	GLuint *cubes[2] = { cubeShadowTextures, staticCubeTextures };
+	GLuint *fbos[2] = { cubeShadowFbo, staticCubeFbo };
+	for (int k = 0; k < 2; k++)
+	{
+		glGenTextures(NUMBER_OF_LIGHTS, cubes[k]);
+		glGenFramebuffers(NUMBER_OF_LIGHTS, fbos[k]);
+		for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+		{
+			glBindTexture(GL_TEXTURE_CUBE_MAP, cubes[k][i]);
+			for (int face = 0; face < 6; face++)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, shadowDepthFormat, cubeShadowSize, cubeShadowSize,
+					0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+			// the whole cube attached makes the framebuffer layered, gl_Layer picks the face
+			glBindFramebuffer(GL_FRAMEBUFFER, fbos[k][i]);
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubes[k][i], 0);
+			glDrawBuffer(GL_NONE);
+			glReadBuffer(GL_NONE);
+
+			GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+			if (status != GL_FRAMEBUFFER_COMPLETE)
+				printf("Cube shadow FB error, status: 0x%x\n", status);
+		}
+	}
+
+	glGenFramebuffers(2, cubeCopyFbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, cubeCopyFbo[0]);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cubeCopyFbo[1]);
+	glDrawBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void GraphicsSubsystem::createSceneTarget()
+{
+	glGenTextures(2, sceneTextures);
+	for (int i = 0; i < 2; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, sceneTextures[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glGenRenderbuffers(1, &sceneDepthBuffer);
+	reallocSceneTarget();
+
+	glGenFramebuffers(1, &sceneFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sceneTextures[0], 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, sceneTextures[1], 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sceneDepthBuffer);
+	const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		printf("Scene FB error, status: 0x%x\n", status);
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+
+	// the blur pass builds its triangle from gl_VertexID, but a VAO still has to be bound
+	glGenVertexArrays(1, &fullscreenVao);
+}
+
+void GraphicsSubsystem::reallocSceneTarget()
+{
+	glBindTexture(GL_TEXTURE_2D, sceneTextures[0]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, windowSize.x, windowSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, sceneTextures[1]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, windowSize.x, windowSize.y, 0, GL_RG, GL_FLOAT, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, sceneDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, windowSize.x, windowSize.y);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	state.invalidate();
+}
+
+void GraphicsSubsystem::createGBuffer()
+{
+	// every target is read back with texelFetch, one texel per pixel
+	glGenTextures(GBUFFER_COUNT, gbufferTextures);
+	for (int i = 0; i < GBUFFER_COUNT; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, gbufferTextures[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	reallocGBuffer();
+
+	glGenFramebuffers(1, &gbufferFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, gbufferFbo);
+	const GLenum drawBuffers[GBUFFER_DEPTH] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+	for (int i = 0; i < GBUFFER_DEPTH; i++)
+		glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[i], GL_TEXTURE_2D, gbufferTextures[i], 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gbufferTextures[GBUFFER_DEPTH], 0);
+	glDrawBuffers(GBUFFER_DEPTH, drawBuffers);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		printf("G-buffer FB error, status: 0x%x\n", status);
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+}
+
+void GraphicsSubsystem::reallocGBuffer()
+{
+	// 16 bytes a pixel with the depth, see gbuffer.glslf
+	const GLint internalFormats[GBUFFER_COUNT] = { GL_RGBA8, GL_RG16, GL_RG16F, GL_DEPTH_COMPONENT24 };
+	const GLenum formats[GBUFFER_COUNT] = { GL_RGBA, GL_RG, GL_RG, GL_DEPTH_COMPONENT };
+	const GLenum types[GBUFFER_COUNT] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_FLOAT, GL_UNSIGNED_INT };
+	for (int i = 0; i < GBUFFER_COUNT; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, gbufferTextures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], windowSize.x, windowSize.y, 0, formats[i], types[i], NULL);
 	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	state.invalidate();
+}
+
+void GraphicsSubsystem::selectShadowQuality()
+{
+	shadowQuality = settings.shadowQuality;
+	shadowMapSize = shadowQualities[shadowQuality].mapSize;
+	cubeShadowSize = shadowQualities[shadowQuality].cubeSize;
+	shadowDepthFormat = shadowQualities[shadowQuality].depthFormat;
 }
 
 void GraphicsSubsystem::reallocShadowTextures()
 {
+	selectShadowQuality();
 	for (int i = 0; i < NUMBER_OF_LIGHTS; i++) 
 	{
 		glBindTexture(GL_TEXTURE_2D, shadowMapTextures[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, windowSize.x, windowSize.y, 0,
+		glTexImage2D(GL_TEXTURE_2D, 0, shadowDepthFormat, shadowMapSize, shadowMapSize, 0,
 			GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 	}
+
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, staticShadowTextures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, shadowDepthFormat, shadowMapSize, shadowMapSize, 0,
+			GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, shadowArrayTexture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, shadowDepthFormat, shadowMapSize, shadowMapSize, NUMBER_OF_LIGHTS,
+		0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	GLuint *cubes[2] = { cubeShadowTextures, staticCubeTextures };
+	for (int k = 0; k < 2; k++)
+		for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+		{
+			glBindTexture(GL_TEXTURE_CUBE_MAP, cubes[k][i]);
+			for (int face = 0; face < 6; face++)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, shadowDepthFormat, cubeShadowSize, cubeShadowSize,
+					0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	state.invalidate();
+	staticShadowsValid = staticCubesValid = shadowMapsValid = false;
 }
 
-void GraphicsSubsystem::createSampler()
+void GraphicsSubsystem::createSamplers()
 {
-	glGenSamplers(1, &sampler);
-	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	//glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	//glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glSamplerParameteri( sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-    glSamplerParameteri( sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	maxAnisotropy = 1.0f;
+	if (GLEW_EXT_texture_filter_anisotropic)
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+
+	glGenSamplers(MATERIAL_COUNT, samplers);
+	for (int i = 0; i < MATERIAL_COUNT; i++)
+	{
+		glSamplerParameteri(samplers[i], GL_TEXTURE_WRAP_S, materialSamplers[i].wrapS);
+		glSamplerParameteri(samplers[i], GL_TEXTURE_WRAP_T, materialSamplers[i].wrapT);
+	}
+	applyTextureFilter();
+}
+
+void GraphicsSubsystem::applyTextureFilter()
+{
+	static const GLenum minFilters[FILTER_COUNT] = { GL_NEAREST, GL_LINEAR, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR };
+	static const GLenum magFilters[FILTER_COUNT] = { GL_NEAREST, GL_LINEAR, GL_LINEAR, GL_LINEAR };
+
+	samplerFilter = settings.textureFilter;
+	for (int i = 0; i < MATERIAL_COUNT; i++)
+	{
+		glSamplerParameteri(samplers[i], GL_TEXTURE_MIN_FILTER, minFilters[samplerFilter]);
+		glSamplerParameteri(samplers[i], GL_TEXTURE_MAG_FILTER, magFilters[samplerFilter]);
+		if (GLEW_EXT_texture_filter_anisotropic)
+		{
+			float anisotropy = samplerFilter == FILTER_ANISOTROPIC ? std::min(materialSamplers[i].maxAnisotropy, maxAnisotropy) : 1.0f;
+			glSamplerParameterf(samplers[i], GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
+		}
+	}
+}
+
+void GraphicsSubsystem::createClusterBuffers()
+{
+	// the texel formats follow LightClusters: vec4 lights, (first, count) pairs, 16-bit indexes
+	const GLenum formats[CLUSTER_BUFFER_COUNT] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+	glGenBuffers(CLUSTER_BUFFER_COUNT, clusterBuffers);
+	glGenTextures(CLUSTER_BUFFER_COUNT, clusterTextures);
+	for (int i = 0; i < CLUSTER_BUFFER_COUNT; i++)
+	{
+		uploadClusterBuffer((ClusterBufferId)i, NULL, 0);
+		glBindTexture(GL_TEXTURE_BUFFER, clusterTextures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], clusterBuffers[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	// a cluster's list has no length limit of its own, but all of them have to fit the index texture
+	GLint maxTexels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	clusters.setMaxIndices((uint32_t)maxTexels);
+}
+
+void GraphicsSubsystem::uploadClusterBuffer(ClusterBufferId id, const void *data, size_t size)
+{
+	// an empty buffer can't back a texture, and the old storage is orphaned like the instance buffer's
+	glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffers[id]);
+	glBufferData(GL_TEXTURE_BUFFER, std::max(size, (size_t)16), NULL, GL_STREAM_DRAW);
+	if (size)
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
 }
 
 void GraphicsSubsystem::loadShaders()
 {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	programCache.init(SHADER_CACHE_PATH, settings.shaderCache);
+
 	std::vector<shaderStringPair> shadow;
 	shadow.push_back(std::make_pair(GL_VERTEX_SHADER, "data/shaders/shadow.glslv"));
-	shaders["shadow"] = ShaderWorker::createProgramFromFiles(shadow);
+	programs[PROGRAM_SHADOW].id = programCache.load(shadow);
 
 	std::vector<shaderStringPair> simple;
 	simple.push_back(std::make_pair(GL_VERTEX_SHADER, "data/shaders/simple.glslv"));
 	simple.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/simple.glslf"));
-	shaders["simple"] = ShaderWorker::createProgramFromFiles(simple);
+	programs[PROGRAM_SIMPLE].id = programCache.load(simple);
 
 	std::vector<shaderStringPair> skybox;
 	skybox.push_back(std::make_pair(GL_VERTEX_SHADER, "data/shaders/skybox.glslv"));
 	skybox.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/skybox.glslf"));
-	shaders["skybox"] = ShaderWorker::createProgramFromFiles(skybox);
+	programs[PROGRAM_SKYBOX].id = programCache.load(skybox);
 
 	std::vector<shaderStringPair> plane;
 	plane.push_back(std::make_pair(GL_VERTEX_SHADER, "data/shaders/plane.glslv"));
 	plane.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/plane.glslf"));
-	shaders["plane"] = ShaderWorker::createProgramFromFiles(plane);
+	plane.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/lighting.glslf"));
+	plane.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/clusteredLights.glslf"));
+	programs[PROGRAM_PLANE].id = programCache.load(plane);
 
 	std::vector<shaderStringPair> ball;
 	ball.push_back(std::make_pair(GL_VERTEX_SHADER, "data/shaders/ball.glslv"));
 	ball.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/ball.glslf"));
-	shaders["ball"] = ShaderWorker::createProgramFromFiles(ball);
+	ball.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/lighting.glslf"));
+	ball.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/clusteredLights.glslf"));
+	programs[PROGRAM_BALL].id = programCache.load(ball);
+
+	const std::string layered = "#define LAYERED_SHADOWS\n";
+	shadow.push_back(std::make_pair(GL_GEOMETRY_SHADER, "data/shaders/shadow.glslg"));
+	programs[PROGRAM_SHADOW_LAYERED].id = programCache.load(shadow, layered);
+	programs[PROGRAM_PLANE_LAYERED].id = programCache.load(plane, layered);
+
+	const std::string cube = "#define CUBE_SHADOWS\n";
+	std::vector<shaderStringPair> shadowCube;
+	shadowCube.push_back(std::make_pair(GL_VERTEX_SHADER, "data/shaders/shadow.glslv"));
+	shadowCube.push_back(std::make_pair(GL_GEOMETRY_SHADER, "data/shaders/shadowCube.glslg"));
+	shadowCube.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/shadowCube.glslf"));
+	programs[PROGRAM_SHADOW_CUBE].id = programCache.load(shadowCube, cube);
+	std::vector<shaderStringPair> planeCube = plane;
+	planeCube.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/cubeShadows.glslf"));
+	programs[PROGRAM_PLANE_CUBE].id = programCache.load(planeCube, cube);
+
+	std::vector<shaderStringPair> motionBlur;
+	motionBlur.push_back(std::make_pair(GL_VERTEX_SHADER, "data/shaders/motionBlur.glslv"));
+	motionBlur.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/motionBlur.glslf"));
+	programs[PROGRAM_MOTION_BLUR].id = programCache.load(motionBlur);
+
+	// the deferred path: the objects write the G-buffer, then a full-screen pass lights it
+	const std::string deferred = "#define DEFERRED\n";
+	plane.back().second = "data/shaders/gbuffer.glslf";
+	programs[PROGRAM_PLANE_DEFERRED].id = programCache.load(plane, deferred);
+	ball.back().second = "data/shaders/gbuffer.glslf";
+	programs[PROGRAM_BALL_DEFERRED].id = programCache.load(ball, deferred);
+
+	std::vector<shaderStringPair> lighting;
+	lighting.push_back(std::make_pair(GL_VERTEX_SHADER, "data/shaders/motionBlur.glslv"));
+	lighting.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/deferredLighting.glslf"));
+	lighting.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/lighting.glslf"));
+	lighting.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/gbuffer.glslf"));
+	lighting.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/clusteredLights.glslf"));
+	programs[PROGRAM_DEFERRED_LIGHTING].id = programCache.load(lighting);
+	programs[PROGRAM_DEFERRED_LIGHTING_LAYERED].id = programCache.load(lighting, layered);
+	lighting.push_back(std::make_pair(GL_FRAGMENT_SHADER, "data/shaders/cubeShadows.glslf"));
+	programs[PROGRAM_DEFERRED_LIGHTING_CUBE].id = programCache.load(lighting, cube);
+
+	shaderLoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("Loaded %i programs in %.1f ms: %i from cache, %i compiled", PROGRAM_COUNT, shaderLoadMs,
+		programCache.getHits(), programCache.getCompiled());
+	if (programCache.getRejected())
+		printf(", %i cached binaries rejected by the driver", programCache.getRejected());
+	printf("\n");
 }
 
 
 void GraphicsSubsystem::loadBuffers()
 {
-	glGenBuffers(1, &uniformBuffers["matrices"]);
-	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers["matrices"]);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) * 2, NULL, GL_STREAM_DRAW);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	glBindBufferRange(GL_UNIFORM_BUFFER, bindingIndexes["matrices"], uniformBuffers["matrices"], 0, sizeof(glm::mat4) * 2);
+	// materials are a packed table indexed per instance, so every block stays bound for the whole run
+	const GLsizeiptr sizes[BLOCK_COUNT] = { sizeof(glm::mat4) * 3, sizeof(LightBlock), sizeof(MaterialBlock) * MATERIAL_COUNT };
+	const GLenum usage[BLOCK_COUNT] = { GL_STREAM_DRAW, GL_DYNAMIC_DRAW, GL_DYNAMIC_DRAW };
 
-	glGenBuffers(1, &uniformBuffers["light"]);
-	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers["light"]);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), NULL, GL_DYNAMIC_DRAW);
-	glBindBufferRange(GL_UNIFORM_BUFFER, bindingIndexes["light"], uniformBuffers["light"], 0, sizeof(LightBlock));
+	glGenBuffers(BLOCK_COUNT, uniformBuffers);
+	for (int i = 0; i < BLOCK_COUNT; i++)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers[i]);
+		glBufferData(GL_UNIFORM_BUFFER, sizes[i], NULL, usage[i]);
+		state.bindBufferRange(i, uniformBuffers[i], 0, sizes[i]);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-	glGenBuffers(1, &uniformBuffers["material"]);
-	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers["material"]);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), NULL, GL_DYNAMIC_DRAW);
-	glBindBufferRange(GL_UNIFORM_BUFFER, bindingIndexes["material"], uniformBuffers["material"], 0, sizeof(LightBlock));
+	glGenBuffers(1, &instanceBuffer);
 }
 
 void GraphicsSubsystem::loadUniforms()
 {
-	GLuint shadow = shaders["shadow"];
-	GLuint simple = shaders["simple"];
-	GLuint skybox = shaders["skybox"];
-	GLuint plane = shaders["plane"];
-	GLuint ball = shaders["ball"];
-	
-	programUniforms[shadow]["modelToClipMatrix"] = glGetUniformLocation(shadow, "modelToClipMatrix");
-	
-	const char *simpleUniforms[] = { "modelToWorldMatrix", "baseColor" };
-	const char *simpleBlocks[] = { "GlobalMatrices" };
-	loadUniforms(simple, simpleUniforms, sizeof(simpleUniforms) / sizeof(char*), simpleBlocks, sizeof(simpleBlocks) / sizeof(char*));
-
-	const char *skyboxUniforms[] = { "modelToWorldMatrix", "skybox" };
-	const char *skyboxBlocks[] = { "GlobalMatrices" };
-	loadUniforms(skybox, skyboxUniforms, sizeof(skyboxUniforms) / sizeof(char*), skyboxBlocks, sizeof(skyboxBlocks) / sizeof(char*));
-
-	const char *planeUniforms[] = { "modelToWorldMatrix", "normalModelToCameraMatrix", "modelToLightToClipMatrix",
-		"textureScale", "colorTexture", "shadowTexture", "shadowTexSize" };
-	const char *planeBlocks[] = { "GlobalMatrices", "Light", "Material" };
-	loadUniforms(plane, planeUniforms, sizeof(planeUniforms) / sizeof(char*), planeBlocks, sizeof(planeBlocks) / sizeof(char*));
-
-	const char *ballUniforms[] = { "modelToWorldMatrix", "normalModelToCameraMatrix", "normalModelToWorldMatrix",
-		"worldToLightMatrix", "worldToLightITMatrix", "colorTexture", "skybox", "camPos" };
-	const char *ballBlocks[] = { "GlobalMatrices", "Light", "Material" };
-	loadUniforms(ball, ballUniforms, sizeof(ballUniforms) / sizeof(char*), ballBlocks, sizeof(ballBlocks) / sizeof(char*));
-
-	glUniformBlockBinding(skybox, programUniforms[skybox]["GlobalMatrices"], bindingIndexes["matrices"]);
-
-	glUniformBlockBinding(plane, programUniforms[plane]["GlobalMatrices"], bindingIndexes["matrices"]);
-	glUniformBlockBinding(plane, programUniforms[plane]["Light"], bindingIndexes["light"]);
-	glUniformBlockBinding(plane, programUniforms[plane]["Material"], bindingIndexes["material"]);
-
-	glUniformBlockBinding(ball, programUniforms[ball]["GlobalMatrices"], bindingIndexes["matrices"]);
-	glUniformBlockBinding(ball, programUniforms[ball]["Light"], bindingIndexes["light"]);
-	glUniformBlockBinding(ball, programUniforms[ball]["Material"], bindingIndexes["material"]);
-
-	glUseProgram(skybox);
-	glUniform1i(programUniforms[skybox]["skybox"], texUnits["room"]);
-	glUseProgram(0);
+	for (int i = 0; i < PROGRAM_COUNT; i++)
+		loadUniforms(programs[i]);
 
-	glUseProgram(plane);
-	glUniform1iv(programUniforms[plane]["shadowTexture"], NUMBER_OF_LIGHTS, shadowTexUnit);
-	glUseProgram(0);
+	glUseProgram(programs[PROGRAM_SKYBOX].id);
+	glUniform1i(programs[PROGRAM_SKYBOX].uniforms[UNIFORM_SKYBOX], textures[TEXTURE_ROOM].unit);
+
+	GLint planeTexUnits[PLANE_TEXTURE_COUNT];
+	for (int i = 0; i < PLANE_TEXTURE_COUNT; i++)
+		planeTexUnits[i] = textures[planeTextures[i]].unit;
+
+	glUseProgram(programs[PROGRAM_PLANE].id);
+	glUniform1iv(programs[PROGRAM_PLANE].uniforms[UNIFORM_SHADOW_TEXTURE], NUMBER_OF_LIGHTS, shadowTexUnit);
+	glUniform1iv(programs[PROGRAM_PLANE].uniforms[UNIFORM_COLOR_TEXTURE], PLANE_TEXTURE_COUNT, planeTexUnits);
+
+	glUseProgram(programs[PROGRAM_PLANE_LAYERED].id);
+	glUniform1i(programs[PROGRAM_PLANE_LAYERED].uniforms[UNIFORM_SHADOW_TEXTURE_ARRAY], shadowTexUnit[0]);
+	glUniform1iv(programs[PROGRAM_PLANE_LAYERED].uniforms[UNIFORM_COLOR_TEXTURE], PLANE_TEXTURE_COUNT, planeTexUnits);
+
+	glUseProgram(programs[PROGRAM_BALL].id);
+	glUniform1i(programs[PROGRAM_BALL].uniforms[UNIFORM_COLOR_TEXTURE], textures[TEXTURE_BALL].unit);
+	glUniform1i(programs[PROGRAM_BALL].uniforms[UNIFORM_SKYBOX], textures[TEXTURE_ROOM_BALL].unit);
+
+	const ProgramId lighting[] = { PROGRAM_DEFERRED_LIGHTING, PROGRAM_DEFERRED_LIGHTING_LAYERED, PROGRAM_DEFERRED_LIGHTING_CUBE };
+	for (int i = 0; i < 3; i++)
+	{
+		const ProgramHandle &pr = programs[lighting[i]];
+		glUseProgram(pr.id);
+		glUniform1i(pr.uniforms[UNIFORM_GBUFFER_ALBEDO], gbufferTexUnit[GBUFFER_ALBEDO]);
+		glUniform1i(pr.uniforms[UNIFORM_GBUFFER_NORMAL], gbufferTexUnit[GBUFFER_NORMAL]);
+		glUniform1i(pr.uniforms[UNIFORM_GBUFFER_VELOCITY], gbufferTexUnit[GBUFFER_VELOCITY]);
+		glUniform1i(pr.uniforms[UNIFORM_GBUFFER_DEPTH], gbufferTexUnit[GBUFFER_DEPTH]);
+		glUniform1i(pr.uniforms[UNIFORM_SKYBOX], textures[TEXTURE_ROOM_BALL].unit);
+		glUniform1iv(pr.uniforms[UNIFORM_SHADOW_TEXTURE], NUMBER_OF_LIGHTS, shadowTexUnit);
+		glUniform1i(pr.uniforms[UNIFORM_SHADOW_TEXTURE_ARRAY], shadowTexUnit[0]);
+		glUniform1iv(pr.uniforms[UNIFORM_SHADOW_CUBE], NUMBER_OF_LIGHTS, shadowTexUnit);
+	}
+
+	glUseProgram(programs[PROGRAM_PLANE_CUBE].id);
+	glUniform1iv(programs[PROGRAM_PLANE_CUBE].uniforms[UNIFORM_SHADOW_CUBE], NUMBER_OF_LIGHTS, shadowTexUnit);
+	glUniform1iv(programs[PROGRAM_PLANE_CUBE].uniforms[UNIFORM_COLOR_TEXTURE], PLANE_TEXTURE_COUNT, planeTexUnits);
+
+	glUseProgram(programs[PROGRAM_PLANE_DEFERRED].id);
+	glUniform1iv(programs[PROGRAM_PLANE_DEFERRED].uniforms[UNIFORM_COLOR_TEXTURE], PLANE_TEXTURE_COUNT, planeTexUnits);
+	glUseProgram(programs[PROGRAM_BALL_DEFERRED].id);
+	glUniform1i(programs[PROGRAM_BALL_DEFERRED].uniforms[UNIFORM_COLOR_TEXTURE], textures[TEXTURE_BALL].unit);
+
+	const ProgramId lit[] = { PROGRAM_PLANE, PROGRAM_PLANE_LAYERED, PROGRAM_PLANE_CUBE, PROGRAM_BALL,
+		PROGRAM_DEFERRED_LIGHTING, PROGRAM_DEFERRED_LIGHTING_LAYERED, PROGRAM_DEFERRED_LIGHTING_CUBE };
+	for (int i = 0; i < 7; i++)
+	{
+		const ProgramHandle &pr = programs[lit[i]];
+		glUseProgram(pr.id);
+		glUniform1i(pr.uniforms[UNIFORM_POINT_LIGHTS], clusterTexUnit[CLUSTER_BUFFER_LIGHTS]);
+		glUniform1i(pr.uniforms[UNIFORM_CLUSTER_GRID], clusterTexUnit[CLUSTER_BUFFER_GRID]);
+		glUniform1i(pr.uniforms[UNIFORM_CLUSTER_INDICES], clusterTexUnit[CLUSTER_BUFFER_INDICES]);
+		glUniform3i(pr.uniforms[UNIFORM_CLUSTER_SIZE], CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
+	}
 
-	glUseProgram(ball);
-	glUniform1i(programUniforms[ball]["colorTexture"], texUnits["ball"]);
-	glUniform1i(programUniforms[ball]["skybox"], texUnits["roomBall"]);
+	glUseProgram(programs[PROGRAM_MOTION_BLUR].id);
+	glUniform1i(programs[PROGRAM_MOTION_BLUR].uniforms[UNIFORM_SCENE_COLOR], sceneTexUnit[0]);
+	glUniform1i(programs[PROGRAM_MOTION_BLUR].uniforms[UNIFORM_SCENE_VELOCITY], sceneTexUnit[1]);
+	glUniform1f(programs[PROGRAM_MOTION_BLUR].uniforms[UNIFORM_BLUR_SCALE], MOTION_BLUR_SCALE);
 	glUseProgram(0);
+
+	// constant for the whole run, so they are not recomputed per draw
+	worldToLightMatrix = glm::scale(glm::mat4(1.0), glm::vec3(IBLscale));
+	worldToLightITMatrix = glm::mat3(glm::transpose(glm::inverse(worldToLightMatrix)));
 }
 
 glm::mat4 GraphicsSubsystem::calcLookAtMatrix(const glm::vec3 &cameraPt, const glm::vec3 &lookPt, const glm::vec3 &upPt)
@@ -353,163 +874,812 @@ glm::vec3 GraphicsSubsystem::getViewVector()
 	return viewVector;
 }
 
-void GraphicsSubsystem::drawBall(const Sphere &ball)
+void GraphicsSubsystem::bindTexture(TextureId texture)
 {
-	GLuint ballpr = shaders["ball"];
-	glUseProgram(ballpr);
+	state.bindTexture(textures[texture].unit, textures[texture].target, textures[texture].id);
+}
 
-	glm::mat4 modelToWorld = ball.getModelToWorldMat();
-	glm::mat3 normWorldMatrix = glm::mat3(glm::transpose(glm::inverse(modelToWorld)));
-	glm::mat3 normCamMatrix = glm::mat3(glm::transpose(glm::inverse(worldToCam * modelToWorld)));
 
-	glUniformMatrix4fv(programUniforms[ballpr]["modelToWorldMatrix"], 1, GL_FALSE, glm::value_ptr(modelToWorld));
-	glUniformMatrix3fv(programUniforms[ballpr]["normalModelToWorldMatrix"], 1, GL_FALSE, glm::value_ptr(normWorldMatrix));
-	glUniformMatrix3fv(programUniforms[ballpr]["normalModelToCameraMatrix"], 1, GL_FALSE, glm::value_ptr(normCamMatrix));
+double GraphicsSubsystem::finishLoading(AssetLoader &loader)
+{
+	double ms = loader.finish();
+	loader.printReport();
+	// uploads bound textures and buffers behind the cache's back
+	state.invalidate();
+	return ms;
+}
 
-	glm::mat4 worldToLightMatrix = glm::scale(glm::mat4(1.0), glm::vec3(IBLscale)); 
-	glm::mat3 worldToLightITMatrix = glm::mat3(glm::transpose(glm::inverse(worldToLightMatrix)));
-	glUniformMatrix4fv(programUniforms[ballpr]["worldToLightMatrix"], 1, GL_FALSE, glm::value_ptr(worldToLightMatrix));
-	glUniformMatrix3fv(programUniforms[ballpr]["worldToLightITMatrix"], 1, GL_FALSE, glm::value_ptr(worldToLightITMatrix));
+RenderSettings &GraphicsSubsystem::getSettings()
+{
+	return settings;
+}
 
-	glUniform3f(programUniforms[ballpr]["camPos"], camPos.x, camPos.y, camPos.z);
+double GraphicsSubsystem::getShaderLoadMs() const
+{
+	return shaderLoadMs;
+}
 
-	glActiveTexture(GL_TEXTURE0 + texUnits["roomBall"]);  
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textures["roomBall"]);
+void GraphicsSubsystem::beginFrame()
+{
+	if (settings.textureFilter != samplerFilter)
+		applyTextureFilter();
+	if (settings.shadowQuality != shadowQuality)
+		reallocShadowTextures();
+	queue.clear();
+	state.resetCounters();
+	trianglesDrawn = 0;
+	instancesUploaded = false;
+	dynamicCasters.count = staticCasters.count = planeCasters.count = 0;
+}
 
-	glActiveTexture(GL_TEXTURE0 + texUnits["ball"]);
-	glBindTexture(GL_TEXTURE_2D, textures["ball"]);
-	glBindSampler(texUnits["ball"], sampler);
-	
-	ball.draw();
-	
-	glBindSampler(texUnits["ball"], 0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-	glBindTexture(GL_TEXTURE_2D, 0);
+InstanceData GraphicsSubsystem::makeBallInstance(const glm::mat4 &modelToWorld, const glm::mat3 &normalModelToWorld,
+	const glm::mat4 &prevModelToWorld, MaterialId material) const
+{
+	InstanceData instance;
+	instance.modelToWorld = modelToWorld;
+	instance.prevModelToWorld = prevModelToWorld;
+	instance.normalModelToWorld = normalModelToWorld;
+	instance.params = glm::vec4(1.0f, 1.0f, 0.0f, (float)material);
+	return instance;
+}
 
-	glUseProgram(0);
+InstanceData GraphicsSubsystem::makePlaneInstance(const glm::mat4 &modelToWorld, const glm::mat3 &normalModelToWorld,
+	const glm::vec2 &textureScale, TextureId texture, MaterialId material) const
+{
+	int slot = (int)(std::find(planeTextures, planeTextures + PLANE_TEXTURE_COUNT, texture) - planeTextures);
+
+	InstanceData instance;
+	instance.modelToWorld = modelToWorld;
+	instance.prevModelToWorld = instance.modelToWorld;
+	instance.normalModelToWorld = normalModelToWorld;
+	instance.params = glm::vec4(textureScale, (float)std::min(slot, PLANE_TEXTURE_COUNT - 1), (float)material);
+	return instance;
+}
+
+int GraphicsSubsystem::chooseLod(const Mesh *mesh, const glm::vec3 &center, float radius) const
+{
+	float distance = std::max(glm::length(center - camPos), zNear);
+	return mesh->chooseLod(radius * pixelsPerUnit / distance, LOD_MAX_ERROR);
+}
+
+void GraphicsSubsystem::submitBalls(const Sphere &mesh, const std::vector<InstanceData> &instances, size_t staticFirst)
+{
+	if (instances.empty())
+		return;
+
+	RenderPacket packet;
+	packet.program = settings.renderPath == RENDER_DEFERRED ? PROGRAM_BALL_DEFERRED : PROGRAM_BALL;
+	packet.material = MATERIAL_BALL;
+	packet.texture = TEXTURE_BALL;
+	packet.mesh = &mesh;
+	submitByLod(QUEUE_OPAQUE, packet, instances);
+
+	// balls are the only shadow casters, the moving and the static ones are each drawn in one go
+	// at the level shadowMapPass() picks
+	staticFirst = std::min(staticFirst, instances.size());
+	dynamicCasters.mesh = staticCasters.mesh = &mesh;
+	dynamicCasters.count = (unsigned)staticFirst;
+	dynamicCasters.first = queue.addInstances(instances.data(), dynamicCasters.count);
+	staticCasters.count = (unsigned)(instances.size() - staticFirst);
+	staticCasters.first = queue.addInstances(instances.data() + staticFirst, staticCasters.count);
+}
+
+void GraphicsSubsystem::submitPlanes(const Plane &mesh, const std::vector<InstanceData> &instances)
+{
+	if (instances.empty())
+		return;
+
+	RenderPacket packet;
+	if (settings.renderPath == RENDER_DEFERRED)
+		packet.program = PROGRAM_PLANE_DEFERRED;
+	else if (settings.shadowMode == SHADOW_CUBE)
+		packet.program = PROGRAM_PLANE_CUBE;
+	else
+		packet.program = settings.shadowMode == SHADOW_LAYERED ? PROGRAM_PLANE_LAYERED : PROGRAM_PLANE;
+	packet.material = MATERIAL_CLOTH;
+	packet.texture = planeTextures[0];
+	packet.mesh = &mesh;
+	packet.modelToWorld = instances[0].modelToWorld;
+	packet.firstInstance = queue.addInstances(&instances[0], (unsigned)instances.size());
+	packet.instanceCount = (unsigned)instances.size();
+	queue.submit(QUEUE_OPAQUE, glm::length(glm::vec3(packet.modelToWorld[3]) - camPos), packet);
+
+	// the table never moves, it casts into the cached cube maps
+	planeCasters.mesh = &mesh;
+	planeCasters.first = packet.firstInstance;
+	planeCasters.count = packet.instanceCount;
 }
 
-std::string GraphicsSubsystem::getWoodTexture()
+void GraphicsSubsystem::submitLights(const Mesh *reference, LightSubsystem &lss)
 {
-	return std::string("wood");
+	const float refScale = 0.2f;
+	LightBlock lblock = lss.getLightInformation(worldToCam);
+	std::vector<glm::vec3> lPosData = lss.getLightWorldPosition();
+	const std::vector<PointLight> &pointLights = lss.getPointLights();
+
+	// the markers are instances whose params hold the color; point lights get theirs scaled down with their reach
+	InstanceData marker;
+	marker.normalModelToWorld = glm::mat3(1.0f);
+	markerInstances.clear();
+	for (size_t i = 0; i < NUMBER_OF_LIGHTS + pointLights.size(); i++)
+	{
+		bool shadowed = i < NUMBER_OF_LIGHTS;
+		const PointLight *point = shadowed ? NULL : &pointLights[i - NUMBER_OF_LIGHTS];
+		float scale = shadowed ? refScale : std::min(refScale, point->radius * 0.02f);
+		marker.modelToWorld = glm::scale(glm::translate(glm::mat4(1.0), shadowed ? lPosData[i] : point->worldPos), glm::vec3(scale));
+		marker.prevModelToWorld = marker.modelToWorld;
+		marker.params = shadowed ? lblock.lights[i].lightIntensity : glm::vec4(point->intensity, 1.0f);
+		markerInstances.push_back(marker);
+	}
+
+	RenderPacket packet;
+	packet.program = PROGRAM_SIMPLE;
+	packet.material = MATERIAL_NONE;
+	packet.texture = TEXTURE_COUNT;
+	packet.mesh = reference;
+	submitByLod(QUEUE_LIGHTS, packet, markerInstances);
 }
 
-std::string GraphicsSubsystem::getClothTexture()
+void GraphicsSubsystem::submitByLod(QueuePass pass, RenderPacket &packet, const std::vector<InstanceData> &instances)
 {
-	return std::string("cloth");
+	const Mesh *mesh = packet.mesh;
+	instanceLods.resize(instances.size());
+	for (size_t i = 0; i < instances.size(); i++)
+		instanceLods[i] = chooseLod(mesh, glm::vec3(instances[i].modelToWorld[3]), glm::length(glm::vec3(instances[i].modelToWorld[0])));
+
+	// the instances go into the queue grouped by level, one instanced packet per level in use
+	for (int lod = 0; lod < mesh->getLodCount(); lod++)
+	{
+		packet.lod = lod;
+		packet.instanceCount = 0;
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			if (instanceLods[i] != lod)
+				continue;
+			unsigned index = queue.addInstances(&instances[i], 1);
+			if (!packet.instanceCount)
+			{
+				packet.firstInstance = index;
+				packet.modelToWorld = instances[i].modelToWorld;
+			}
+			packet.instanceCount++;
+		}
+		if (packet.instanceCount)
+			queue.submit(pass, glm::length(glm::vec3(packet.modelToWorld[3]) - camPos), packet);
+	}
 }
 
-void GraphicsSubsystem::drawPlane(const Plane &plane, const std::string &textureName)
+void GraphicsSubsystem::submitSkybox(const Cube &cube)
 {
-	int planepr = shaders["plane"];
-	glUseProgram(shaders["plane"]);
+	RenderPacket packet;
+	packet.program = PROGRAM_SKYBOX;
+	packet.material = MATERIAL_NONE;
+	packet.texture = TEXTURE_ROOM;
+	packet.mesh = &cube;
+	packet.modelToWorld = cube.getModelToWorldMat();
+	packet.prevModelToWorld = packet.modelToWorld;
+	queue.submit(QUEUE_SKYBOX, 0.0f, packet);
+}
 
-	glm::mat4 modelToWorld = plane.getModelToWorldMat();
-	glm::mat3 normMatrix = glm::mat3(glm::transpose(glm::inverse(worldToCam * modelToWorld)));
-	glUniformMatrix3fv(programUniforms[planepr]["normalModelToCameraMatrix"], 1, GL_FALSE, glm::value_ptr(normMatrix));
+void GraphicsSubsystem::beginScene()
+{
+	if (settings.renderPath == RENDER_DEFERRED)
+		glBindFramebuffer(GL_FRAMEBUFFER, gbufferFbo);
+	else
+		glBindFramebuffer(GL_FRAMEBUFFER, settings.motionBlur ? sceneFbo : screenFbo);
+}
 
-	glUniformMatrix4fv(programUniforms[planepr]["modelToWorldMatrix"], 1, GL_FALSE, glm::value_ptr(modelToWorld));
-	glUniformMatrix4fv(programUniforms[planepr]["modelToLightToClipMatrix"], NUMBER_OF_LIGHTS, GL_FALSE, glm::value_ptr(modelLightWorldClip[0]));
-	
-	glm::vec2 textureScale = plane.getTextureScale();
-	glUniform2f(programUniforms[planepr]["textureScale"], textureScale.x, textureScale.y);
-	glUniform2f(programUniforms[planepr]["shadowTexSize"], windowSize.x, windowSize.y);
+void GraphicsSubsystem::deferredLightingPass()
+{
+	// the pass covers every pixel of the target and writes its depth, so it also stands for the clear
+	glBindFramebuffer(GL_FRAMEBUFFER, settings.motionBlur ? sceneFbo : screenFbo);
+	glDepthFunc(GL_ALWAYS);
+
+	const ProgramId lightingPrograms[SHADOW_MODE_COUNT] = { PROGRAM_DEFERRED_LIGHTING, PROGRAM_DEFERRED_LIGHTING_LAYERED,
+		PROGRAM_DEFERRED_LIGHTING_CUBE };
+	const ProgramHandle &pr = programs[lightingPrograms[settings.shadowMode]];
+	state.useProgram(pr.id);
+	glUniformMatrix4fv(pr.uniforms[UNIFORM_CLIP_TO_CAMERA], 1, GL_FALSE, glm::value_ptr(glm::inverse(camProjection)));
+	glUniformMatrix4fv(pr.uniforms[UNIFORM_CAMERA_TO_WORLD], 1, GL_FALSE, glm::value_ptr(glm::inverse(worldToCam)));
+	glUniformMatrix4fv(pr.uniforms[UNIFORM_WORLD_TO_LIGHT_CLIP], NUMBER_OF_LIGHTS, GL_FALSE, glm::value_ptr(modelLightWorldClip[0]));
+	glUniformMatrix4fv(pr.uniforms[UNIFORM_WORLD_TO_LIGHT], 1, GL_FALSE, glm::value_ptr(worldToLightMatrix));
+	glUniformMatrix3fv(pr.uniforms[UNIFORM_WORLD_TO_LIGHT_IT], 1, GL_FALSE, glm::value_ptr(worldToLightITMatrix));
+	glUniform3f(pr.uniforms[UNIFORM_CAM_POS], camPos.x, camPos.y, camPos.z);
+
+	for (int i = 0; i < GBUFFER_COUNT; i++)
+		state.bindTexture(gbufferTexUnit[i], GL_TEXTURE_2D, gbufferTextures[i]);
+	bindShadowMaps(pr);
+	bindTexture(TEXTURE_ROOM_BALL);
+	bindClusterBuffers(pr);
+
+	state.bindVertexArray(fullscreenVao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glDepthFunc(GL_LEQUAL);
+}
 
-	glUniform1i(programUniforms[planepr]["colorTexture"], texUnits[textureName]);
-	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+void GraphicsSubsystem::motionBlurPass()
+{
+	// one full-screen pass smearing the scene color along the per-pixel velocity
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+	glDisable(GL_DEPTH_TEST);
+
+	state.useProgram(programs[PROGRAM_MOTION_BLUR].id);
+	for (int i = 0; i < 2; i++)
 	{
-		glActiveTexture(GL_TEXTURE0 + shadowTexUnit[i]);  
-		glBindTexture(GL_TEXTURE_2D, shadowMapTextures[i]);
+		state.bindTexture(sceneTexUnit[i], GL_TEXTURE_2D, sceneTextures[i]);
+		state.bindSampler(sceneTexUnit[i], 0);
 	}
+	state.bindVertexArray(fullscreenVao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
 
-	glActiveTexture(GL_TEXTURE0 + texUnits[textureName]);
-	glBindTexture(GL_TEXTURE_2D, textures[textureName]);
-	glBindSampler(texUnits[textureName], sampler);
-	
-	plane.draw();
+	glEnable(GL_DEPTH_TEST);
+}
 
-	glBindSampler(texUnits[textureName], 0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	
-	glUseProgram(0);
+void GraphicsSubsystem::flushQueue(QueuePass pass)
+{
+	size_t begin, end;
+	queue.sort();
+	queue.getRange(pass, begin, end);
+	if (begin == end)
+		return;
+
+	// the skybox is seen from the inside
+	if (pass == QUEUE_SKYBOX)
+		glCullFace(GL_FRONT);
+	for (size_t i = begin; i < end; i++)
+		executePacket(queue.getPacket(i));
+	if (pass == QUEUE_SKYBOX)
+		glCullFace(GL_BACK);
 }
 
-void GraphicsSubsystem::drawLight(const Mesh *reference, LightSubsystem &lss)
+void GraphicsSubsystem::executePacket(const RenderPacket &packet)
 {
-	const float refScale = 0.2f;
-	GLuint simplepr = shaders["simple"];
-	glUseProgram(simplepr);
-	LightBlock lblock = lss.getLightInformation(worldToCam);
-	std::vector<glm::vec3> lPosData = lss.getLightWorldPosition();
+	const ProgramHandle &pr = programs[packet.program];
+	state.useProgram(pr.id);
+	glUniformMatrix4fv(pr.uniforms[UNIFORM_MODEL_TO_WORLD], 1, GL_FALSE, glm::value_ptr(packet.modelToWorld));
+	glUniformMatrix4fv(pr.uniforms[UNIFORM_PREV_MODEL_TO_WORLD], 1, GL_FALSE, glm::value_ptr(packet.prevModelToWorld));
 
-	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+	switch (packet.program)
 	{
-		glm::mat4 modelToWorld = glm::scale(glm::translate(glm::mat4(1.0), lPosData[i]), glm::vec3(refScale));
-		glUniformMatrix4fv(programUniforms[simplepr]["modelToWorldMatrix"], 1, GL_FALSE, glm::value_ptr(modelToWorld));
-		glUniform4f(programUniforms[simplepr]["baseColor"], lblock.lights[i].lightIntensity.x, lblock.lights[i].lightIntensity.y, lblock.lights[i].lightIntensity.z, lblock.lights[i].lightIntensity.w);
-		reference->draw();
+	case PROGRAM_BALL:
+	case PROGRAM_BALL_DEFERRED:
+		glUniformMatrix4fv(pr.uniforms[UNIFORM_WORLD_TO_LIGHT], 1, GL_FALSE, glm::value_ptr(worldToLightMatrix));
+		glUniformMatrix3fv(pr.uniforms[UNIFORM_WORLD_TO_LIGHT_IT], 1, GL_FALSE, glm::value_ptr(worldToLightITMatrix));
+		glUniform3f(pr.uniforms[UNIFORM_CAM_POS], camPos.x, camPos.y, camPos.z);
+
+		bindTexture(TEXTURE_ROOM_BALL);
+		bindTexture(packet.texture);
+		state.bindSampler(textures[packet.texture].unit, samplers[packet.material]);
+		bindClusterBuffers(pr);
+		break;
+	case PROGRAM_PLANE:
+	case PROGRAM_PLANE_LAYERED:
+	case PROGRAM_PLANE_CUBE:
+	case PROGRAM_PLANE_DEFERRED:
+		glUniformMatrix4fv(pr.uniforms[UNIFORM_MODEL_TO_LIGHT_TO_CLIP], NUMBER_OF_LIGHTS, GL_FALSE, glm::value_ptr(modelLightWorldClip[0]));
+		if (packet.program != PROGRAM_PLANE_DEFERRED)
+			bindShadowMaps(pr);
+		for (int i = 0; i < PLANE_TEXTURE_COUNT; i++)
+		{
+			bindTexture(planeTextures[i]);
+			state.bindSampler(textures[planeTextures[i]].unit, samplers[planeMaterials[i]]);
+		}
+		bindClusterBuffers(pr);
+		break;
+	case PROGRAM_SKYBOX:
+		bindTexture(packet.texture);
+		break;
+	default:
+		break;
+	}
+
+	if (packet.instanceCount)
+	{
+		uploadInstances();
+		bindInstanceAttributes(packet.mesh, packet.firstInstance);
+		packet.mesh->drawInstanced(packet.instanceCount, packet.lod);
+		trianglesDrawn += packet.mesh->getTriangleCount(packet.lod) * packet.instanceCount;
+	}
+	else
+	{
+		state.bindVertexArray(packet.mesh->getVertexArray());
+		packet.mesh->draw(packet.lod);
+		trianglesDrawn += packet.mesh->getTriangleCount(packet.lod);
 	}
-	glUseProgram(0);
 }
 
-void GraphicsSubsystem::drawSkybox(const Cube &cube)
+void GraphicsSubsystem::bindClusterBuffers(const ProgramHandle &program)
 {
-	GLuint skyboxpr = shaders["skybox"];
-	glCullFace(GL_FRONT);
-	glUseProgram(skyboxpr);
+	glm::vec2 slices = clusters.getSliceParams();
+	glUniform4f(program.uniforms[UNIFORM_CLUSTER_SCALE], CLUSTER_TILES_X / (float)windowSize.x,
+		CLUSTER_TILES_Y / (float)windowSize.y, slices.x, slices.y);
+	for (int i = 0; i < CLUSTER_BUFFER_COUNT; i++)
+		state.bindTexture(clusterTexUnit[i], GL_TEXTURE_BUFFER, clusterTextures[i]);
+}
 
-	glm::mat4 modelToWorld = cube.getModelToWorldMat();
+double GraphicsSubsystem::timeMeshDraws(const Mesh &mesh, unsigned instances, int repeats)
+{
+	std::vector<InstanceData> data(instances, makeBallInstance(glm::mat4(1.0f), glm::mat3(1.0f), glm::mat4(1.0f), MATERIAL_BALL));
+	beginFrame();
+	unsigned first = queue.addInstances(data.data(), instances);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+	glViewport(0, 0, 16, 16);
+	state.useProgram(programs[PROGRAM_BALL].id);
+	bindTexture(TEXTURE_ROOM_BALL);
+	bindTexture(TEXTURE_BALL);
+	uploadInstances();
+	bindInstanceAttributes(&mesh, first);
+
+	// the first draw pays for any lazy setup in the driver
+	mesh.drawInstanced(instances);
+	glFinish();
+	std::chrono::steady_clock::time_point from = std::chrono::steady_clock::now();
+	for (int i = 0; i < repeats; i++)
+		mesh.drawInstanced(instances);
+	glFinish();
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+
+	glViewport(0, 0, windowSize.x, windowSize.y);
+	return ms / repeats;
+}
 
-	glUniformMatrix4fv(programUniforms[skyboxpr]["modelToWorldMatrix"], 1, GL_FALSE, glm::value_ptr(modelToWorld));
+void GraphicsSubsystem::uploadInstances()
+{
+	if (instancesUploaded)
+		return;
+	instancesUploaded = true;
+
+	const std::vector<InstanceData> &instances = queue.getInstances();
+	if (instances.empty())
+		return;
+	GLsizeiptr size = instances.size() * sizeof(InstanceData);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	if (size > instanceBufferSize)
+		instanceBufferSize = std::max(size, instanceBufferSize * 2);
+	// orphaning the old storage, so the driver doesn't wait on last frame's draws
+	glBufferData(GL_ARRAY_BUFFER, instanceBufferSize, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, size, instances.data());
+}
 
-	glActiveTexture(GL_TEXTURE0 + texUnits["room"]);  
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textures["room"]);
-	
-	cube.draw();
-	
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+void GraphicsSubsystem::bindInstanceAttributes(const Mesh *mesh, unsigned firstInstance)
+{
+	// GL 3.3 has no base instance, so the attributes are pointed at the packet's first record;
+	// offsets are the InstanceData layout
+	const struct { GLint size; size_t offset; } columns[] = {
+		{ 4, 0 }, { 4, 16 }, { 4, 32 }, { 4, 48 },	// modelToWorld
+		{ 4, 64 }, { 4, 80 }, { 4, 96 }, { 4, 112 },	// prevModelToWorld
+		{ 3, 128 }, { 3, 140 }, { 3, 152 },				// normalModelToWorld
+		{ 4, 164 },										// params
+	};
+	const size_t base = firstInstance * sizeof(InstanceData);
+
+	state.bindVertexArray(mesh->getVertexArray());
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	for (GLuint i = 0; i < sizeof(columns) / sizeof(columns[0]); i++)
+	{
+		glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + i);
+		glVertexAttribPointer(INSTANCE_ATTRIBUTE + i, columns[i].size, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(void*)(base + columns[i].offset));
+		glVertexAttribDivisor(INSTANCE_ATTRIBUTE + i, 1);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-	glUseProgram(0);
-	glCullFace(GL_BACK);
+int GraphicsSubsystem::getStateChangesIssued() const
+{
+	return state.getIssued();
 }
 
-void GraphicsSubsystem::shadowMapPass(const Mesh *target, LightSubsystem &lss)
+int GraphicsSubsystem::getStateChangesSkipped() const
+{
+	return state.getSkipped();
+}
+
+int GraphicsSubsystem::getTrianglesDrawn() const
+{
+	return trianglesDrawn;
+}
+
+int GraphicsSubsystem::getMaxLightsPerCluster() const
+{
+	return clusters.getMaxLightsPerCluster();
+}
+
+int GraphicsSubsystem::getClusterEntriesDropped() const
+{
+	return clusters.getDroppedEntries();
+}
+
+int GraphicsSubsystem::getShadowCastersDrawn() const
+{
+	return shadowCastersDrawn;
+}
+
+void GraphicsSubsystem::setShadowBounds(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+	shadowBoundsMin = casterBoundsMin = boundsMin;
+	shadowBoundsMax = casterBoundsMax = boundsMax;
+}
+
+// radius of the sphere around an instance, the meshes fit in [-1, 1] on every axis
+static float boundingRadius(const glm::mat4 &modelToWorld)
+{
+	return sqrtf(glm::dot(glm::vec3(modelToWorld[0]), glm::vec3(modelToWorld[0])) +
+		glm::dot(glm::vec3(modelToWorld[1]), glm::vec3(modelToWorld[1])) +
+		glm::dot(glm::vec3(modelToWorld[2]), glm::vec3(modelToWorld[2])));
+}
+
+bool GraphicsSubsystem::fitCasterBounds()
+{
+	// the box of the balls down to the receivers under them; a shadow can't fall outside the frusta
+	// through its corners. The box is kept with some slack until a ball leaves it or the balls
+	// gather in a small part of it, as every new box means new frusta and rendering the cache again
+	const std::vector<InstanceData> &instances = queue.getInstances();
+	const CasterRange *ranges[2] = { &staticCasters, &dynamicCasters };
+	glm::vec3 lo(1e30f), hi(-1e30f);
+	for (int r = 0; r < 2; r++)
+		for (unsigned c = ranges[r]->first; c < ranges[r]->first + ranges[r]->count; c++)
+		{
+			glm::vec3 center(instances[c].modelToWorld[3]);
+			float radius = boundingRadius(instances[c].modelToWorld);
+			lo = glm::min(lo, center - radius);
+			hi = glm::max(hi, center + radius);
+		}
+	lo = glm::clamp(lo, shadowBoundsMin, shadowBoundsMax);
+	hi = glm::clamp(hi, shadowBoundsMin, shadowBoundsMax);
+	lo.y = shadowBoundsMin.y;
+	if (hi.x <= lo.x || hi.y <= lo.y || hi.z <= lo.z)
+		return false;
+
+	glm::vec3 size = hi - lo;
+	glm::vec3 fitted = casterBoundsMax - casterBoundsMin;
+	bool inside = glm::all(glm::greaterThanEqual(lo, casterBoundsMin)) && glm::all(glm::lessThanEqual(hi, casterBoundsMax));
+	if (inside && size.x * size.z >= SHADOW_FIT_SHRINK * fitted.x * fitted.z)
+		return false;
+	casterBoundsMin = glm::max(lo - size * SHADOW_FIT_MARGIN, shadowBoundsMin);
+	casterBoundsMax = glm::min(hi + size * SHADOW_FIT_MARGIN, shadowBoundsMax);
+	return true;
+}
+
+glm::mat4 GraphicsSubsystem::calcLightFrustum(const glm::vec3 &lightPos)
+{
+	// the lights hang above the table: each looks straight down through a frustum cut around the
+	// corners of the casters' box, so the whole map goes to where the balls are
+	glm::mat4 lightView = calcLookAtMatrix(lightPos, lightPos - glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::vec2 lo(1e30f), hi(-1e30f);
+	float nearDepth = 1e30f, farDepth = 0.0f;
+	for (int c = 0; c < 8; c++)
+	{
+		glm::vec3 corner(c & 1 ? casterBoundsMax.x : casterBoundsMin.x, c & 2 ? casterBoundsMax.y : casterBoundsMin.y,
+			c & 4 ? casterBoundsMax.z : casterBoundsMin.z);
+		glm::vec3 p = glm::vec3(lightView * glm::vec4(corner, 1.0f));
+		float depth = std::max(-p.z, 0.1f);
+		glm::vec2 slope = glm::vec2(p) / depth;
+		lo = glm::min(lo, slope);
+		hi = glm::max(hi, slope);
+		nearDepth = std::min(nearDepth, depth);
+		farDepth = std::max(farDepth, depth);
+	}
+	nearDepth *= 0.99f;
+	farDepth *= 1.01f;
+	glm::mat4 lightProjection = glm::frustum(lo.x * nearDepth, hi.x * nearDepth, lo.y * nearDepth, hi.y * nearDepth,
+		nearDepth, farDepth);
+	lightProjScale = std::max(lightProjScale, lightProjection[1][1]);
+	return lightProjection * lightView;
+}
+
+void GraphicsSubsystem::updateCubeFrusta(const std::vector<glm::vec3> &lightPositions)
+{
+	// far enough to take in the casters' box from every light, with room for the receivers around it
+	float range = 0.0f;
+	for (size_t i = 0; i < lightPositions.size(); i++)
+		for (int c = 0; c < 8; c++)
+		{
+			glm::vec3 corner(c & 1 ? shadowBoundsMax.x : shadowBoundsMin.x, c & 2 ? shadowBoundsMax.y : shadowBoundsMin.y,
+				c & 4 ? shadowBoundsMax.z : shadowBoundsMin.z);
+			range = std::max(range, glm::length(corner - lightPositions[i]));
+		}
+	range *= 1.5f;
+	if (range != shadowRange)
+		staticCubesValid = false;
+	shadowRange = range;
+
+	// the directions and up vectors of the cube map faces, +x -x +y -y +z -z
+	const glm::vec3 faceDirs[6] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+		glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+	const glm::vec3 faceUps[6] = { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+		glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+	glm::mat4 faceProjection = glm::perspective(90.0f, 1.0f, 0.05f, shadowRange);
+	for (size_t i = 0; i < lightPositions.size() && i < NUMBER_OF_LIGHTS; i++)
+	{
+		if (lightPositions[i] != cubeLightPos[i])
+			staticCubesValid = false;
+		cubeLightPos[i] = lightPositions[i];
+		for (int face = 0; face < 6; face++)
+			cubeFaceClip[i][face] = faceProjection * calcLookAtMatrix(cubeLightPos[i], cubeLightPos[i] + faceDirs[face], faceUps[face]);
+	}
+}
+
+int GraphicsSubsystem::cubeFaceMask(const CasterRange &range, const glm::vec3 &lightPos) const
+{
+	// a face takes a caster whose bounding sphere reaches in front of the light and comes within its
+	// radius of the four planes through the light that bound the face
+	const std::vector<InstanceData> &instances = queue.getInstances();
+	int mask = 0;
+	for (unsigned c = range.first; c < range.first + range.count && mask != 0x3f; c++)
+	{
+		const glm::mat4 &modelToWorld = instances[c].modelToWorld;
+		glm::vec3 v = glm::vec3(modelToWorld[3]) - lightPos;
+		float radius = boundingRadius(modelToWorld);
+		for (int face = 0; face < 6; face++)
+		{
+			int axis = face / 2;
+			float ahead = face & 1 ? -v[axis] : v[axis];
+			bool inside = ahead + radius > 0.0f;
+			for (int j = 0; j < 3 && inside; j++)
+				if (j != axis)
+					inside = ahead - fabsf(v[j]) > -radius * 1.4142136f;
+			if (inside)
+				mask |= 1 << face;
+		}
+	}
+	return mask;
+}
+
+int GraphicsSubsystem::chooseCasterLod(const CasterRange &range, const std::vector<glm::vec3> &lightPositions, float texelsPerUnit) const
+{
+	// only the outline matters in a depth map: the casters get the coarsest level that keeps it
+	// within SHADOW_LOD_MAX_ERROR texels for the caster closest to a light
+	if (!range.count)
+		return 0;
+	const std::vector<InstanceData> &instances = queue.getInstances();
+	float maxRadius = 0.0f;
+	for (unsigned c = range.first; c < range.first + range.count; c++)
+	{
+		glm::vec3 center(instances[c].modelToWorld[3]);
+		float radius = glm::length(glm::vec3(instances[c].modelToWorld[0])) * texelsPerUnit;
+		for (size_t i = 0; i < lightPositions.size(); i++)
+			maxRadius = std::max(maxRadius, radius / std::max(glm::length(center - lightPositions[i]), zNear));
+	}
+	return range.mesh->chooseLod(maxRadius, SHADOW_LOD_MAX_ERROR);
+}
+
+bool GraphicsSubsystem::updateCasterSnapshot(const CasterRange &range, std::vector<glm::mat4> &snapshot, int &snapshotLod) const
+{
+	const std::vector<InstanceData> &instances = queue.getInstances();
+	bool changed = snapshot.size() != range.count || snapshotLod != range.lod;
+	snapshot.resize(range.count);
+	for (unsigned c = 0; c < range.count; c++)
+	{
+		const glm::mat4 &modelToWorld = instances[range.first + c].modelToWorld;
+		if (changed || snapshot[c] != modelToWorld)
+		{
+			snapshot[c] = modelToWorld;
+			changed = true;
+		}
+	}
+	snapshotLod = range.lod;
+	return changed;
+}
+
+void GraphicsSubsystem::shadowMapPass(LightSubsystem &lss)
 {
-	GLuint shadowpr = shaders["shadow"];
-	glClearDepth(1.0f);
-	glUseProgram(shadowpr);
 	std::vector<glm::vec3> lPosData = lss.getLightWorldPosition();
+	fitCasterBounds();
+	lightProjScale = 0.0f;
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+	{
+		glm::mat4 frustum = calcLightFrustum(lPosData[i]);
+		if (frustum != modelLightWorldClip[i])
+		{
+			modelLightWorldClip[i] = frustum;
+			staticShadowsValid = false;
+		}
+	}
+
+	bool cube = settings.shadowMode == SHADOW_CUBE;
+	if (cube)
+		updateCubeFrusta(lPosData);
+
+	// a cube face is a 90 degree frustum
+	float texelsPerUnit = cube ? 0.5f * cubeShadowSize : 0.5f * shadowMapSize * lightProjScale;
+	staticCasters.lod = chooseCasterLod(staticCasters, lPosData, texelsPerUnit);
+	dynamicCasters.lod = chooseCasterLod(dynamicCasters, lPosData, texelsPerUnit);
+	// both snapshots are refreshed, hence no short circuit
+	if (updateCasterSnapshot(staticCasters, staticSnapshot, staticSnapshotLod) |
+		updateCasterSnapshot(planeCasters, planeSnapshot, planeSnapshotLod))
+		staticShadowsValid = staticCubesValid = false;
+	bool dynamicMoved = updateCasterSnapshot(dynamicCasters, dynamicSnapshot, dynamicSnapshotLod);
+
+	shadowCastersDrawn = 0;
+	bool mapsValid = shadowMapsValid && shadowMapsMode == settings.shadowMode;
+	if ((cube ? staticCubesValid : staticShadowsValid) && mapsValid && !dynamicMoved)
+		return;
+
+	glClearDepth(1.0f);
+	glViewport(0, 0, cube ? cubeShadowSize : shadowMapSize, cube ? cubeShadowSize : shadowMapSize);
+	if (cube)
+		shadowMapPassCube(!mapsValid);
+	else
+	{
+		if (!staticShadowsValid)
+			renderStaticShadows();
+		if (settings.shadowMode == SHADOW_LAYERED)
+			shadowMapPassLayered();
+		else
+			shadowMapPassPerLight();
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+	glViewport(0, 0, windowSize.x, windowSize.y);
+	shadowMapsValid = true;
+	shadowMapsMode = settings.shadowMode;
+}
+
+void GraphicsSubsystem::renderStaticShadows()
+{
+	const ProgramHandle &shadowpr = programs[PROGRAM_SHADOW];
+	state.useProgram(shadowpr.id);
 
-	glm::mat4 modelMatrix = target->getModelToWorldMat();
 	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
 	{
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowFbo[i]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, staticShadowFbo[i]);
 		glClear(GL_DEPTH_BUFFER_BIT);
 
-		modelLightWorldClip[i] = glm::perspective(45.0f, 1.0f, zNear, zFar) *
-			calcLookAtMatrix(lPosData[i], target->getWorldPos(), glm::vec3(0.0f, 0.0f, 1.0f)); // (0, 0, 1) - optimized for the ball
+		glUniformMatrix4fv(shadowpr.uniforms[UNIFORM_WORLD_TO_LIGHT_CLIP], 1, GL_FALSE, glm::value_ptr(modelLightWorldClip[i]));
+		drawShadowCasters(staticCasters);
+	}
+	staticShadowsValid = true;
+}
 
-		glm::mat4 modelToClipMatrix = modelLightWorldClip[i] * modelMatrix;
-		glUniformMatrix4fv(programUniforms[shadowpr]["modelToClipMatrix"], 1, GL_FALSE, glm::value_ptr(modelToClipMatrix));
+void GraphicsSubsystem::copyStaticShadows(int light, GLuint targetFbo)
+{
+	// with no static casters the cached map is empty, clearing is the cheaper copy of it
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFbo);
+	if (!staticCasters.count)
+	{
+		glClear(GL_DEPTH_BUFFER_BIT);
+		return;
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, staticShadowFbo[light]);
+	glBlitFramebuffer(0, 0, shadowMapSize, shadowMapSize, 0, 0, shadowMapSize, shadowMapSize, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+}
 
-		target->draw();
+void GraphicsSubsystem::shadowMapPassPerLight()
+{
+	const ProgramHandle &shadowpr = programs[PROGRAM_SHADOW];
+	state.useProgram(shadowpr.id);
+
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+	{
+		copyStaticShadows(i, shadowFbo[i]);
+
+		glUniformMatrix4fv(shadowpr.uniforms[UNIFORM_WORLD_TO_LIGHT_CLIP], 1, GL_FALSE, glm::value_ptr(modelLightWorldClip[i]));
+		drawShadowCasters(dynamicCasters);
 	}
-	glUseProgram(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GraphicsSubsystem::shadowMapPassLayered()
+{
+	// one draw: the geometry shader replicates every triangle into each light's layer
+	const ProgramHandle &shadowpr = programs[PROGRAM_SHADOW_LAYERED];
+	state.useProgram(shadowpr.id);
+
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+		copyStaticShadows(i, shadowLayerFbo[i]);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowArrayFbo);
+
+	glUniformMatrix4fv(shadowpr.uniforms[UNIFORM_WORLD_TO_LIGHT_CLIP], NUMBER_OF_LIGHTS, GL_FALSE,
+		glm::value_ptr(modelLightWorldClip[0]));
+	drawShadowCasters(dynamicCasters);
+}
+
+void GraphicsSubsystem::shadowMapPassCube(bool restoreAll)
+{
+	const ProgramHandle &shadowpr = programs[PROGRAM_SHADOW_CUBE];
+	state.useProgram(shadowpr.id);
+	glUniform1f(shadowpr.uniforms[UNIFORM_SHADOW_RANGE], shadowRange);
+
+	bool renderStatic = !staticCubesValid;
+	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+	{
+		glUniformMatrix4fv(shadowpr.uniforms[UNIFORM_FACE_TO_CLIP], 6, GL_FALSE, glm::value_ptr(cubeFaceClip[i][0]));
+		glUniform3fv(shadowpr.uniforms[UNIFORM_LIGHT_WORLD_POS], 1, glm::value_ptr(cubeLightPos[i]));
+		if (renderStatic)
+		{
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, staticCubeFbo[i]);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			glUniform1i(shadowpr.uniforms[UNIFORM_FACE_MASK],
+				cubeFaceMask(planeCasters, cubeLightPos[i]) | cubeFaceMask(staticCasters, cubeLightPos[i]));
+			drawShadowCasters(planeCasters);
+			drawShadowCasters(staticCasters);
+		}
+
+		// the faces the moving casters left last time get the cached depth back, as do the ones they are in now
+		int dynamicFaces = cubeFaceMask(dynamicCasters, cubeLightPos[i]);
+		copyStaticCubeFaces(i, renderStatic || restoreAll ? 0x3f : cubeDynamicFaces[i] | dynamicFaces);
+		cubeDynamicFaces[i] = dynamicFaces;
+		if (!dynamicFaces)
+			continue;
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cubeShadowFbo[i]);
+		glUniform1i(shadowpr.uniforms[UNIFORM_FACE_MASK], dynamicFaces);
+		drawShadowCasters(dynamicCasters);
+	}
+	staticCubesValid = true;
+}
+
+void GraphicsSubsystem::copyStaticCubeFaces(int light, int faces)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, cubeCopyFbo[0]);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cubeCopyFbo[1]);
+	for (int face = 0; face < 6; face++)
+	{
+		if (!(faces & (1 << face)))
+			continue;
+		GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, staticCubeTextures[light], 0);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, cubeShadowTextures[light], 0);
+		glBlitFramebuffer(0, 0, cubeShadowSize, cubeShadowSize, 0, 0, cubeShadowSize, cubeShadowSize,
+			GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	}
+}
+
+void GraphicsSubsystem::bindShadowMaps(const ProgramHandle &program)
+{
+	if (settings.shadowMode == SHADOW_CUBE)
+	{
+		glUniform3fv(program.uniforms[UNIFORM_LIGHT_WORLD_POS], NUMBER_OF_LIGHTS, glm::value_ptr(cubeLightPos[0]));
+		glUniform1f(program.uniforms[UNIFORM_SHADOW_RANGE], shadowRange);
+		glUniform2f(program.uniforms[UNIFORM_SHADOW_TEX_SIZE], cubeShadowSize, cubeShadowSize);
+		for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+			state.bindTexture(shadowTexUnit[i], GL_TEXTURE_CUBE_MAP, cubeShadowTextures[i]);
+		return;
+	}
+
+	glUniform2f(program.uniforms[UNIFORM_SHADOW_TEX_SIZE], shadowMapSize, shadowMapSize);
+	if (settings.shadowMode == SHADOW_LAYERED)
+		state.bindTexture(shadowTexUnit[0], GL_TEXTURE_2D_ARRAY, shadowArrayTexture);
+	else
+		for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+			state.bindTexture(shadowTexUnit[i], GL_TEXTURE_2D, shadowMapTextures[i]);
+}
+
+void GraphicsSubsystem::drawShadowCasters(const CasterRange &range)
+{
+	if (!range.count)
+		return;
+	uploadInstances();
+	bindInstanceAttributes(range.mesh, range.first);
+	range.mesh->drawInstanced(range.count, range.lod);
+	trianglesDrawn += range.mesh->getTriangleCount(range.lod) * range.count;
+	shadowCastersDrawn += range.count;
 }
 
 void GraphicsSubsystem::bindLighting(LightSubsystem &lss)
 {
 	LightBlock lightData = lss.getLightInformation(worldToCam);
-	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers["light"]);
+	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers[BLOCK_LIGHT]);
 	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(lightData), &lightData);
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	clusters.build(lss.getPointLights(), worldToCam, camProjection, zNear, zFar);
+	if (clusters.getDroppedEntries() && !clusterOverflowReported)
+	{
+		printf("Can't list every point light in its clusters: %i entries don't fit the index buffer\n", clusters.getDroppedEntries());
+		clusterOverflowReported = true;
+	}
+	const std::vector<glm::vec4> &lightTexels = clusters.getLightTexels();
+	const std::vector<uint32_t> &grid = clusters.getGrid();
+	const std::vector<uint16_t> &indices = clusters.getIndices();
+	uploadClusterBuffer(CLUSTER_BUFFER_LIGHTS, lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+	uploadClusterBuffer(CLUSTER_BUFFER_GRID, grid.data(), grid.size() * sizeof(uint32_t));
+	uploadClusterBuffer(CLUSTER_BUFFER_INDICES, indices.data(), indices.size() * sizeof(uint16_t));
 }
 
-void GraphicsSubsystem::bindMaterial(const MaterialBlock &matData)
+void GraphicsSubsystem::setMaterial(MaterialId material, const MaterialBlock &matData)
 {
-	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers["material"]);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(matData), &matData);
+	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers[BLOCK_MATERIAL]);
+	glBufferSubData(GL_UNIFORM_BUFFER, material * sizeof(MaterialBlock), sizeof(matData), &matData);
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
@@ -523,42 +1693,52 @@ void GraphicsSubsystem::clearBuffers()
 void GraphicsSubsystem::setCam()
 {
 	camPos = resolveCamPosition();
+	prevWorldToCam = worldToCam;
 	worldToCam = calcLookAtMatrix(camPos, camTarget, glm::vec3(0.0f, 1.0f, 0.0f));
-	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers["matrices"]);
+	if (!hasPrevCam)
+	{
+		prevWorldToCam = worldToCam;
+		hasPrevCam = true;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers[BLOCK_MATRICES]);
 	glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(worldToCam));
+	glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) * 2, sizeof(glm::mat4), glm::value_ptr(prevWorldToCam));
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
-void GraphicsSubsystem::accumFrame(int cur, int n)
-{
-	if(cur == 0)
-		glAccum(GL_LOAD, 1.0f / n);
-	else
-		glAccum(GL_ACCUM, 1.0f / n);
-}
-
-void GraphicsSubsystem::returnFrame()
-{
-	glAccum(GL_RETURN, 1.0);
-}
 
 void GraphicsSubsystem::swapBuffers()
 {
-	glutSwapBuffers();
+	if (headless)
+		glFinish();
+	else
+		glutSwapBuffers();
 }
 
 void GraphicsSubsystem::reshape(int w, int h)
 {	
 	glm::mat4 persMatrix = glm::perspective(45.0f, (w / (float)h), zNear, zFar);
+	pixelsPerUnit = 0.5f * h * persMatrix[1][1];
+	camProjection = persMatrix;
 
-	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers["matrices"]);
+	glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffers[BLOCK_MATRICES]);
 	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(persMatrix));
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
 	glViewport(0, 0, (GLsizei) w, (GLsizei) h);
 
 	windowSize = glm::ivec2(w, h);
-	reallocShadowTextures();
+	reallocSceneTarget();
+	reallocGBuffer();
+
+	if (headless)
+	{
+		glBindRenderbuffer(GL_RENDERBUFFER, screenRenderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+		glBindRenderbuffer(GL_RENDERBUFFER, screenRenderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	}
 }
 
 void GraphicsSubsystem::setCamTarget(const glm::vec3 &camt)
@@ -575,12 +1755,39 @@ void GraphicsSubsystem::rotateCam(const glm::vec3 &diff)
 
 GraphicsSubsystem::~GraphicsSubsystem()
 {
-    for ( std::unordered_map<std::string, GLuint>::iterator buff = uniformBuffers.begin( ); buff != uniformBuffers.end( ); buff++ )
-		glDeleteBuffers(1, &buff->second);
-    for ( std::unordered_map<std::string, GLuint>::iterator tex = textures.begin( ); tex != textures.end( ); tex++ )
-		glDeleteTextures(1, &tex->second);
+	glDeleteBuffers(BLOCK_COUNT, uniformBuffers);
+	glDeleteBuffers(1, &instanceBuffer);
+	for (int i = 0; i < TEXTURE_COUNT; i++)
+		glDeleteTextures(1, &textures[i].id);
+	for (int i = 0; i < PROGRAM_COUNT; i++)
+		glDeleteProgram(programs[i].id);
 	glDeleteBuffers(NUMBER_OF_LIGHTS, shadowFbo);
 	for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
 		glDeleteTextures(1, &shadowMapTextures[i]);
-
+	glDeleteFramebuffers(NUMBER_OF_LIGHTS, staticShadowFbo);
+	glDeleteTextures(NUMBER_OF_LIGHTS, staticShadowTextures);
+	glDeleteFramebuffers(NUMBER_OF_LIGHTS, shadowLayerFbo);
+	glDeleteFramebuffers(NUMBER_OF_LIGHTS, cubeShadowFbo);
+	glDeleteFramebuffers(NUMBER_OF_LIGHTS, staticCubeFbo);
+	glDeleteFramebuffers(2, cubeCopyFbo);
+	glDeleteTextures(NUMBER_OF_LIGHTS, cubeShadowTextures);
+	glDeleteTextures(NUMBER_OF_LIGHTS, staticCubeTextures);
+	glDeleteFramebuffers(1, &shadowArrayFbo);
+	glDeleteTextures(1, &shadowArrayTexture);
+	glDeleteFramebuffers(1, &sceneFbo);
+	glDeleteTextures(2, sceneTextures);
+	glDeleteRenderbuffers(1, &sceneDepthBuffer);
+	glDeleteFramebuffers(1, &gbufferFbo);
+	glDeleteTextures(GBUFFER_COUNT, gbufferTextures);
+	glDeleteVertexArrays(1, &fullscreenVao);
+	glDeleteSamplers(MATERIAL_COUNT, samplers);
+	glDeleteTextures(CLUSTER_BUFFER_COUNT, clusterTextures);
+	glDeleteBuffers(CLUSTER_BUFFER_COUNT, clusterBuffers);
+
+	if (headless)
+	{
+		glDeleteFramebuffers(1, &screenFbo);
+		glDeleteRenderbuffers(2, screenRenderbuffers);
+		destroyHeadlessContext();
+	}
 }
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "lightClusters.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <math.h>
+
+static const int CLUSTER_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+
+LightClusters::LightClusters(): sliceParams(0.0f), maxIndices(0xFFFFFFFF), maxPerCluster(0), droppedEntries(0)
+{
+	grid.assign(CLUSTER_COUNT * 2, 0);
+}
+
+bool LightClusters::tileRange(float center, float depth, float radius, float projScale, int tiles, int &first, int &last)
+{
+	// the tangents from the eye to the sphere in the plane of this axis and the view direction give
+	// the extent in normalized device coordinates; an eye inside the sphere sees it everywhere
+	float lo = -1.0f, hi = 1.0f;
+	float lengthSq = center * center + depth * depth;
+	if (lengthSq > radius * radius)
+	{
+		float angle = atan2f(center, depth);
+		float spread = asinf(radius / sqrtf(lengthSq));
+		if (angle - spread > -0.5f * M_PI)
+			lo = tanf(angle - spread) * projScale;
+		if (angle + spread < 0.5f * M_PI)
+			hi = tanf(angle + spread) * projScale;
+	}
+	if (hi < -1.0f || lo > 1.0f)
+		return false;
+
+	first = std::max((int)floorf((lo * 0.5f + 0.5f) * tiles), 0);
+	last = std::min((int)floorf((hi * 0.5f + 0.5f) * tiles), tiles - 1);
+	return first <= last;
+}
+
+void LightClusters::build(const std::vector<PointLight> &lights, const glm::mat4 &worldToCam, const glm::mat4 &projection,
+	float zNear, float zFar)
+{
+	float slicesPerLog = CLUSTER_SLICES / logf(zFar / zNear);
+	sliceParams = glm::vec2(slicesPerLog, -logf(zNear) * slicesPerLog);
+
+	lightTexels.clear();
+	bounds.clear();
+	std::fill(grid.begin(), grid.end(), 0);
+
+	/*=============================================
+	  lights in view -> the clusters they cover, counted per cluster
+	===============================================*/
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		const PointLight &light = lights[i];
+		glm::vec3 pos = glm::vec3(worldToCam * glm::vec4(light.worldPos, 1.0f));
+		float depth = -pos.z;
+		if (depth + light.radius < zNear || depth - light.radius > zFar)
+			continue;
+
+		Bounds b;
+		if (!tileRange(pos.x, depth, light.radius, projection[0][0], CLUSTER_TILES_X, b.first[0], b.last[0]) ||
+			!tileRange(pos.y, depth, light.radius, projection[1][1], CLUSTER_TILES_Y, b.first[1], b.last[1]))
+			continue;
+		float nearDepth = std::max(depth - light.radius, zNear);
+		float farDepth = std::min(depth + light.radius, zFar);
+		b.first[2] = std::max((int)(logf(nearDepth) * sliceParams.x + sliceParams.y), 0);
+		b.last[2] = std::min((int)(logf(farDepth) * sliceParams.x + sliceParams.y), CLUSTER_SLICES - 1);
+
+		lightTexels.push_back(glm::vec4(pos, light.radius));
+		lightTexels.push_back(glm::vec4(light.intensity, 0.0f));
+		bounds.push_back(b);
+		for (int z = b.first[2]; z <= b.last[2]; z++)
+			for (int y = b.first[1]; y <= b.last[1]; y++)
+				for (int x = b.first[0]; x <= b.last[0]; x++)
+					grid[((z * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x) * 2 + 1]++;
+	}
+
+	/*=============================================
+	  counts -> offsets -> the index lists
+	===============================================*/
+	// every cluster lists all of its lights, only the index buffer as a whole is bounded
+	uint32_t offset = 0;
+	maxPerCluster = 0;
+	droppedEntries = 0;
+	for (int c = 0; c < CLUSTER_COUNT; c++)
+	{
+		uint32_t count = std::min(grid[c * 2 + 1], maxIndices - offset);
+		droppedEntries += grid[c * 2 + 1] - count;
+		grid[c * 2] = offset;
+		grid[c * 2 + 1] = count;
+		offset += count;
+		maxPerCluster = std::max(maxPerCluster, (int)count);
+	}
+	indices.resize(offset);
+	filled.assign(CLUSTER_COUNT, 0);
+
+	for (size_t l = 0; l < bounds.size(); l++)
+	{
+		const Bounds &b = bounds[l];
+		for (int z = b.first[2]; z <= b.last[2]; z++)
+			for (int y = b.first[1]; y <= b.last[1]; y++)
+				for (int x = b.first[0]; x <= b.last[0]; x++)
+				{
+					int c = (z * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x;
+					if (filled[c] < grid[c * 2 + 1])
+						indices[grid[c * 2] + filled[c]++] = (uint16_t)l;
+				}
+	}
+}
+
+const std::vector<glm::vec4> &LightClusters::getLightTexels() const
+{
+	return lightTexels;
+}
+
+const std::vector<uint32_t> &LightClusters::getGrid() const
+{
+	return grid;
+}
+
+const std::vector<uint16_t> &LightClusters::getIndices() const
+{
+	return indices;
+}
+
+glm::vec2 LightClusters::getSliceParams() const
+{
+	return sliceParams;
+}
+
+int LightClusters::getVisibleLights() const
+{
+	return (int)bounds.size();
+}
+
+int LightClusters::getMaxLightsPerCluster() const
+{
+	return maxPerCluster;
+}
+
+int LightClusters::getDroppedEntries() const
+{
+	return (int)droppedEntries;
+}
+
+void LightClusters::setMaxIndices(uint32_t count)
+{
+	maxIndices = count;
+}
@@ -1,29 +1,15 @@
 #include "lightSubsystem.h"
+#include "settings.h"
 
+// dark until the scene sets the lights up
 LightSubsystem::LightSubsystem()
 {
-	const glm::vec4 lightPos[] = { 
-		glm::vec4(3.0, 8.0, 3.0, 1.0),
-		glm::vec4(-3.0, 8.0, 3.0, 1.0),
-		glm::vec4(0.0, 7.0, -4.0, 1.0),
-	};
-
-	const glm::vec4 lightIntensity[] = { 
-		glm::vec4(0.85, 0.9, 1.0, 1.0),
-		glm::vec4(0.85, 0.9, 1.0, 1.0),
-		glm::vec4(1.0, 0.85, 0.45, 1.0),
-	};
-
-	const float halfLightDistance = 7.0f;
-	const float lightAttenuation = 1.0f / (halfLightDistance * halfLightDistance);
-
-	lightData.ambientIntensity = glm::vec4(glm::vec3(0.3f), 1.0f);
-	lightData.lightAttenuation = lightAttenuation;
-
+	lightData.ambientIntensity = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	setHalfLightDistance(1.0f);
 	for(int i = 0; i < NUMBER_OF_LIGHTS; i++)
 	{
-		lightsWorldPos[i] = lightPos[i];
-		lightData.lights[i].lightIntensity = lightIntensity[i];
+		lightsWorldPos[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		lightData.lights[i].lightIntensity = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 	}
 }
 
@@ -44,14 +30,46 @@ std::vector<glm::vec3> LightSubsystem::getLightWorldPosition() const
 
 void LightSubsystem::setLightIntesity(int index, const glm::vec4 &intesity)
 {
-	if (index < 0 || index > NUMBER_OF_LIGHTS)
+	if (index < 0 || index >= NUMBER_OF_LIGHTS)
 		return;
 	lightData.lights[index].lightIntensity = glm::clamp(intesity, 0.0f, 1.0f);
 }
 
+void LightSubsystem::setAmbientIntensity(float intensity)
+{
+	lightData.ambientIntensity = glm::vec4(glm::vec3(intensity), 1.0f);
+}
+
+void LightSubsystem::setHalfLightDistance(float distance)
+{
+	lightData.lightAttenuation = 1.0f / (distance * distance);
+}
+
 void LightSubsystem::setLightWorldPos(int index, const glm::vec4 &intesity)
 {
-	if (index < 0 || index > NUMBER_OF_LIGHTS)
+	if (index < 0 || index >= NUMBER_OF_LIGHTS)
 		return;
 	lightsWorldPos[index] = intesity;
 }
+
+bool LightSubsystem::addPointLight(const glm::vec3 &worldPos, const glm::vec3 &intensity, float radius)
+{
+	if (pointLights.size() >= MAX_POINT_LIGHTS)
+		return false;
+	PointLight light;
+	light.worldPos = worldPos;
+	light.radius = radius;
+	light.intensity = glm::clamp(intensity, 0.0f, 1.0f);
+	pointLights.push_back(light);
+	return true;
+}
+
+void LightSubsystem::clearPointLights()
+{
+	pointLights.clear();
+}
+
+const std::vector<PointLight> &LightSubsystem::getPointLights() const
+{
+	return pointLights;
+}
@@ -1,9 +1,54 @@
+#include "benchmarks.h"
 #include "engine.h"
+#include "renderSettings.h"
+#include "sceneStore.h"
+#include "textureCooker.h"
+#include "settings.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 int main(int argc, char **argv)
 {
+	bool benchmark = false;
+	int frames = BENCHMARK_FRAMES;
+	std::string report = BENCHMARK_REPORT;
+	std::string scene = SCENE_FILE;
+	RenderSettings rs;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--benchmark"))
+		{
+			benchmark = true;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				frames = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--report") && i + 1 < argc)
+			report = argv[++i];
+		else if (!strcmp(argv[i], "--scene") && i + 1 < argc)
+			scene = argv[++i];
+		else if (!strcmp(argv[i], "--bench") && i + 1 < argc)
+			return Benchmarks::run(argv[++i]);
+		else if (!strcmp(argv[i], "--cook"))
+			return TextureCooker::cookAll() | SceneStore::cookAll();
+		else if (i + 1 < argc && rs.parseOption(argv[i], argv[i + 1]))
+			i++;
+		else
+		{
+			printf("Usage: %s [--benchmark [frames]] [--report file.json] [--scene file] [--shadows per-light|layered|cube]\n\t[--shadow-quality low|medium|high] [--motion-blur on|off] [--shader-cache on|off|rebuild] [--texture-filter nearest|bilinear|trilinear|anisotropic]\n\t[--render-path forward|deferred] | --bench <name> | --cook\n", argv[0]);
+			Benchmarks::printUsage();
+			return 1;
+		}
+	}
+
+	if (benchmark)
+	{
+		Engine engine(true, rs, scene);
+		return engine.runBenchmark(frames, report);
+	}
+
 	printf("%s\n", GREETING);
-	Engine engine;
-	return 0;
+	Engine engine(false, rs, scene);
+	return engine.run();
 }
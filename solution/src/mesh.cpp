@@ -1,7 +1,108 @@
 #include "mesh.h"
+#include "settings.h"
+#include <stdio.h>
 #include <glm/gtc/matrix_transform.hpp>
 
-Mesh::Mesh(const glm::vec3 &wp): worldPos(wp) {}
+Mesh::Mesh(const glm::vec3 &wp): worldPos(wp), registry(NULL), geometry(-1) {}
+
+bool Mesh::attach(MeshRegistry &r)
+{
+	registry = &r;
+	return !registry->acquire(getKey(), geometry);
+}
+
+void Mesh::load(MeshRegistry &r)
+{
+	if (attach(r))
+		return;
+	build();
+	upload();
+}
+
+void Mesh::build()
+{
+	generate();
+	optimize();
+}
+
+void Mesh::optimize()
+{
+	// every level is optimized on its own: the generators lay them out one after another, each with
+	// its own vertices and indices that start from its base vertex
+	std::vector<MeshVertex> vertices;
+	std::vector<GLuint> indices;
+	vertices.reserve(vertexData.size());
+	indices.reserve(indexData.size());
+	for (size_t l = 0; l < lodRanges.size(); l++)
+	{
+		MeshRange &r = lodRanges[l];
+		size_t vertexEnd = l + 1 < lodRanges.size() ? (size_t)lodRanges[l + 1].baseVertex : vertexData.size();
+		std::vector<MeshVertex> levelVertices(vertexData.begin() + r.baseVertex, vertexData.begin() + vertexEnd);
+		std::vector<GLuint> levelIndices(indexData.begin() + r.firstIndex, indexData.begin() + r.firstIndex + r.indexCount);
+
+		cacheBefore.push_back(MeshOptimizer::analyze(levelIndices, levelVertices.size()));
+		MeshOptimizer::optimize(levelVertices, levelIndices, MESH_OVERDRAW_CLUSTER);
+		cacheAfter.push_back(MeshOptimizer::analyze(levelIndices, levelVertices.size()));
+
+		r.baseVertex = (GLint)vertices.size();
+		r.firstIndex = (GLsizei)indices.size();
+		vertices.insert(vertices.end(), levelVertices.begin(), levelVertices.end());
+		indices.insert(indices.end(), levelIndices.begin(), levelIndices.end());
+	}
+	vertexData.swap(vertices);
+	indexData.swap(indices);
+}
+
+void Mesh::printOptimizationReport() const
+{
+	if (cacheBefore.empty())
+		return;
+	printf("Mesh %s, vertex cache of %i:\n", getKey().c_str(), MESH_CACHE_SIZE);
+	for (size_t l = 0; l < cacheBefore.size(); l++)
+		printf("\tlevel %u: %6i triangles  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f\n", (unsigned)l, lodRanges[l].indexCount / 3,
+			cacheBefore[l].acmr, cacheAfter[l].acmr, cacheBefore[l].atvr, cacheAfter[l].atvr);
+}
+
+void Mesh::upload()
+{
+	registry->upload(geometry, vertexData, indexData, lodRanges);
+	std::vector<MeshVertex>().swap(vertexData);
+	std::vector<GLuint>().swap(indexData);
+}
+
+GLuint Mesh::getVertexArray() const
+{
+	return registry->getVertexArray(geometry);
+}
+
+void Mesh::draw(int lod) const
+{
+	const MeshRange &r = registry->getRange(geometry, lod);
+	glDrawElementsBaseVertex(GL_TRIANGLES, r.indexCount, registry->getIndexType(geometry),
+		(void*)(r.firstIndex * registry->getIndexSize(geometry)), r.baseVertex);
+}
+
+void Mesh::drawInstanced(GLsizei instances, int lod) const
+{
+	const MeshRange &r = registry->getRange(geometry, lod);
+	glDrawElementsInstancedBaseVertex(GL_TRIANGLES, r.indexCount, registry->getIndexType(geometry),
+		(void*)(r.firstIndex * registry->getIndexSize(geometry)), instances, r.baseVertex);
+}
+
+GLsizei Mesh::getTriangleCount(int lod) const
+{
+	return registry->getRange(geometry, lod).indexCount / 3;
+}
+
+int Mesh::getLodCount() const
+{
+	return registry->getRangeCount(geometry);
+}
+
+int Mesh::chooseLod(float /*projectedRadius*/, float /*maxError*/) const
+{
+	return 0;
+}
 
 glm::mat4 Mesh::getModelToWorldMat() const
 {
@@ -16,4 +117,10 @@ glm::vec3 Mesh::getWorldPos() const
 void Mesh::setWorldPos(const glm::vec3 &wp)
 {
 	worldPos = wp;
-}
\ No newline at end of file
+}
+
+Mesh::~Mesh()
+{
+	if (registry)
+		registry->release(geometry);
+}
@@ -0,0 +1,235 @@
+#include "meshOptimizer.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <math.h>
+
+// the scoring model of the original, it works for smaller hardware caches as well
+static const int SCORING_CACHE_SIZE = 32;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+void MeshOptimizer::optimize(std::vector<MeshVertex> &vertices, std::vector<GLuint> &indices, int overdrawCluster)
+{
+	optimizeVertexCache(indices, vertices.size());
+	if (overdrawCluster > 0)
+		optimizeOverdraw(vertices, indices, overdrawCluster);
+	optimizeVertexFetch(vertices, indices);
+}
+
+MeshOptimizer::CacheStats MeshOptimizer::analyze(const std::vector<GLuint> &indices, size_t vertexCount)
+{
+	// a vertex is in the cache while fewer than MESH_CACHE_SIZE misses have happened since its own
+	std::vector<long long> missedAt(vertexCount, -(long long)MESH_CACHE_SIZE);
+	std::vector<bool> used(vertexCount, false);
+	long long misses = 0;
+	size_t usedCount = 0;
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		GLuint v = indices[i];
+		if (misses - missedAt[v] >= MESH_CACHE_SIZE)
+			missedAt[v] = ++misses;
+		if (!used[v])
+		{
+			used[v] = true;
+			usedCount++;
+		}
+	}
+
+	CacheStats s;
+	s.acmr = indices.empty() ? 0.0f : (float)misses / (indices.size() / 3);
+	s.atvr = usedCount ? (float)misses / usedCount : 0.0f;
+	return s;
+}
+
+float MeshOptimizer::vertexScore(int cachePosition, unsigned trianglesLeft)
+{
+	if (trianglesLeft == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// the last triangle's vertices get a fixed score, so it does not matter in which order they were added
+		if (cachePosition < 3)
+			score = LAST_TRIANGLE_SCORE;
+		else
+			score = powf(1.0f - (cachePosition - 3) / (float)(SCORING_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+	}
+	// vertices with few triangles left are finished off before they leave the cache
+	return score + VALENCE_BOOST_SCALE * powf((float)trianglesLeft, -VALENCE_BOOST_POWER);
+}
+
+void MeshOptimizer::optimizeVertexCache(std::vector<GLuint> &indices, size_t vertexCount)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	// triangles of each vertex, the ones still to emit first
+	std::vector<unsigned> adjacencyStart(vertexCount + 1, 0);
+	for (size_t i = 0; i < indices.size(); i++)
+		adjacencyStart[indices[i] + 1]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		adjacencyStart[v + 1] += adjacencyStart[v];
+	std::vector<unsigned> trianglesLeft(vertexCount, 0);
+	std::vector<unsigned> adjacency(indices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		GLuint v = indices[i];
+		adjacency[adjacencyStart[v] + trianglesLeft[v]++] = (unsigned)(i / 3);
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		vertexScores[v] = vertexScore(-1, trianglesLeft[v]);
+
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	int best = 0;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const GLuint *tri = &indices[t * 3];
+		triangleScores[t] = vertexScores[tri[0]] + vertexScores[tri[1]] + vertexScores[tri[2]];
+		if (triangleScores[t] > triangleScores[best])
+			best = (int)t;
+	}
+
+	std::vector<GLuint> result;
+	result.reserve(indices.size());
+	std::vector<GLuint> cache, newCache;
+	cache.reserve(SCORING_CACHE_SIZE + 3);
+	newCache.reserve(SCORING_CACHE_SIZE + 3);
+	size_t nextUnemitted = 0;
+
+	for (size_t n = 0; n < triangleCount; n++)
+	{
+		// none of the cached vertices has triangles left: go on with the next triangle in the input
+		if (best < 0)
+		{
+			while (emitted[nextUnemitted])
+				nextUnemitted++;
+			best = (int)nextUnemitted;
+		}
+
+		const GLuint *tri = &indices[best * 3];
+		emitted[best] = true;
+		result.insert(result.end(), tri, tri + 3);
+
+		newCache.assign(tri, tri + 3);
+		for (int i = 0; i < 3; i++)
+		{
+			GLuint v = tri[i];
+			unsigned *first = &adjacency[adjacencyStart[v]];
+			unsigned *last = first + trianglesLeft[v] - 1;
+			std::swap(*std::find(first, last + 1, (unsigned)best), *last);
+			trianglesLeft[v]--;
+		}
+		for (size_t i = 0; i < cache.size(); i++)
+			if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+				newCache.push_back(cache[i]);
+
+		// the vertices pushed out of the cache are rescored as well
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			GLuint v = newCache[i];
+			cachePosition[v] = i < (size_t)SCORING_CACHE_SIZE ? (int)i : -1;
+			vertexScores[v] = vertexScore(cachePosition[v], trianglesLeft[v]);
+		}
+
+		best = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			GLuint v = newCache[i];
+			for (unsigned j = 0; j < trianglesLeft[v]; j++)
+			{
+				unsigned t = adjacency[adjacencyStart[v] + j];
+				const GLuint *other = &indices[t * 3];
+				triangleScores[t] = vertexScores[other[0]] + vertexScores[other[1]] + vertexScores[other[2]];
+				if (cachePosition[v] >= 0 && triangleScores[t] > bestScore)
+				{
+					bestScore = triangleScores[t];
+					best = (int)t;
+				}
+			}
+		}
+
+		if (newCache.size() > (size_t)SCORING_CACHE_SIZE)
+			newCache.resize(SCORING_CACHE_SIZE);
+		cache.swap(newCache);
+	}
+	indices.swap(result);
+}
+
+void MeshOptimizer::optimizeOverdraw(const std::vector<MeshVertex> &vertices, std::vector<GLuint> &indices, int clusterSize)
+{
+	const size_t triangleCount = indices.size() / 3;
+	const size_t clusterCount = (triangleCount + clusterSize - 1) / clusterSize;
+	if (clusterCount < 2)
+		return;
+
+	glm::vec3 meshCenter(0.0f);
+	for (size_t i = 0; i < indices.size(); i++)
+		meshCenter += vertices[indices[i]].position;
+	meshCenter /= (float)indices.size();
+
+	// without a view to sort by, the clusters that stick out the furthest along their own normal are the
+	// likeliest to cover the rest from wherever the mesh is seen
+	std::vector<std::pair<float, size_t> > order(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		glm::vec3 center(0.0f), normal(0.0f);
+		float area = 0.0f;
+		size_t end = std::min(triangleCount, (c + 1) * clusterSize);
+		for (size_t t = c * clusterSize; t < end; t++)
+		{
+			const glm::vec3 &a = vertices[indices[t * 3]].position;
+			const glm::vec3 &b = vertices[indices[t * 3 + 1]].position;
+			const glm::vec3 &d = vertices[indices[t * 3 + 2]].position;
+			// area weighted, as is the center
+			glm::vec3 areaNormal = glm::cross(b - a, d - a);
+			float triangleArea = glm::length(areaNormal);
+			normal += areaNormal;
+			center += (a + b + d) * (triangleArea / 3.0f);
+			area += triangleArea;
+		}
+		float facing = 0.0f;
+		if (area > EPS && glm::length(normal) > EPS)
+			facing = glm::dot(center / area - meshCenter, glm::normalize(normal));
+		order[c] = std::make_pair(-facing, c);
+	}
+	std::stable_sort(order.begin(), order.end());
+
+	std::vector<GLuint> result;
+	result.reserve(indices.size());
+	for (size_t i = 0; i < clusterCount; i++)
+	{
+		size_t c = order[i].second;
+		size_t end = std::min(triangleCount, (c + 1) * clusterSize);
+		result.insert(result.end(), indices.begin() + c * clusterSize * 3, indices.begin() + end * 3);
+	}
+	indices.swap(result);
+}
+
+void MeshOptimizer::optimizeVertexFetch(std::vector<MeshVertex> &vertices, std::vector<GLuint> &indices)
+{
+	const GLuint unused = ~0u;
+	std::vector<GLuint> remap(vertices.size(), unused);
+	std::vector<MeshVertex> result;
+	result.reserve(vertices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		GLuint &v = indices[i];
+		if (remap[v] == unused)
+		{
+			remap[v] = (GLuint)result.size();
+			result.push_back(vertices[v]);
+		}
+		v = remap[v];
+	}
+	vertices.swap(result);
+}
@@ -0,0 +1,258 @@
+#include "meshRegistry.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdio.h>
+#include <glm/gtc/packing.hpp>
+
+// largest finite half float
+static const float HALF_MAX = 65504.0f;
+
+MeshRegistry::MeshRegistry(VertexFormat format): preferredFormat(format) { }
+
+bool MeshRegistry::acquire(const std::string &key, int &entry)
+{
+	std::map<std::string, int>::iterator it = keys.find(key);
+	if (it != keys.end())
+	{
+		entry = it->second;
+		entries[entry].refs++;
+		return false;
+	}
+
+	Entry e;
+	e.key = key;
+	e.refs = 1;
+	e.page = -1;
+	entries.push_back(e);
+	entry = (int)entries.size() - 1;
+	keys[key] = entry;
+	return true;
+}
+
+void MeshRegistry::release(int entry)
+{
+	Entry &e = entries[entry];
+	if (--e.refs > 0)
+		return;
+
+	keys.erase(e.key);
+	if (e.page < 0)
+		return;
+	Page &p = pages[e.page];
+	if (--p.entries == 0)
+	{
+		glDeleteVertexArrays(1, &p.vao);
+		glDeleteBuffers(1, &p.vertexBuffer);
+		glDeleteBuffers(1, &p.indexBuffer);
+		p.vao = p.vertexBuffer = p.indexBuffer = 0;
+		p.vertexCapacity = p.indexCapacity = 0;
+	}
+	e.page = -1;
+}
+
+void MeshRegistry::upload(int entry, const std::vector<MeshVertex> &vertices, const std::vector<GLuint> &indices,
+	const std::vector<MeshRange> &ranges)
+{
+	// the indices of each range start from its base vertex, so 16 bits are enough unless a single range is huge
+	GLuint maxIndex = indices.empty() ? 0 : *std::max_element(indices.begin(), indices.end());
+	GLenum indexType = maxIndex > 0xFFFF ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+	VertexFormat format = preferredFormat == VERTEX_PACKED && fitsPacked(vertices) ? VERTEX_PACKED : VERTEX_FLOAT;
+	int pageIndex = findPage((GLsizei)vertices.size(), (GLsizei)indices.size(), indexType, format);
+	Page &p = pages[pageIndex];
+
+	glBindBuffer(GL_ARRAY_BUFFER, p.vertexBuffer);
+	if (format == VERTEX_PACKED)
+	{
+		std::vector<PackedVertex> packed(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+			packed[i] = pack(vertices[i]);
+		glBufferSubData(GL_ARRAY_BUFFER, p.vertexCount * sizeof(PackedVertex), packed.size() * sizeof(PackedVertex), packed.data());
+	}
+	else
+		glBufferSubData(GL_ARRAY_BUFFER, p.vertexCount * sizeof(MeshVertex), vertices.size() * sizeof(MeshVertex), vertices.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p.indexBuffer);
+	if (indexType == GL_UNSIGNED_INT)
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, p.indexCount * sizeof(GLuint), indices.size() * sizeof(GLuint), indices.data());
+	else
+	{
+		std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, p.indexCount * sizeof(GLushort), shortIndices.size() * sizeof(GLushort), shortIndices.data());
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	Entry &e = entries[entry];
+	e.page = pageIndex;
+	e.ranges = ranges;
+	for (size_t i = 0; i < e.ranges.size(); i++)
+	{
+		e.ranges[i].firstIndex += p.indexCount;
+		e.ranges[i].baseVertex += p.vertexCount;
+	}
+	p.vertexCount += (GLsizei)vertices.size();
+	p.indexCount += (GLsizei)indices.size();
+	p.entries++;
+}
+
+int MeshRegistry::findPage(GLsizei vertices, GLsizei indices, GLenum indexType, VertexFormat format)
+{
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		const Page &p = pages[i];
+		if (p.vao && p.indexType == indexType && p.format == format &&
+			p.vertexCount + vertices <= p.vertexCapacity && p.indexCount + indices <= p.indexCapacity)
+			return (int)i;
+	}
+
+	// a mesh bigger than a page gets one of its own size
+	Page p;
+	p.vertexCapacity = std::max(vertices, (GLsizei)MESH_PAGE_VERTICES);
+	p.indexCapacity = std::max(indices, (GLsizei)MESH_PAGE_INDICES);
+	p.vertexCount = p.indexCount = 0;
+	p.entries = 0;
+	p.indexType = indexType;
+	p.format = format;
+	createPage(p);
+	pages.push_back(p);
+	return (int)pages.size() - 1;
+}
+
+void MeshRegistry::createPage(Page &p)
+{
+	GLsizeiptr indexSize = p.indexType == GL_UNSIGNED_INT ? sizeof(GLuint) : sizeof(GLushort);
+
+	glGenBuffers(1, &p.vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, p.vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, p.vertexCapacity * getVertexSize(p.format), NULL, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &p.indexBuffer);
+	glGenVertexArrays(1, &p.vao);
+	glBindVertexArray(p.vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p.indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, p.indexCapacity * indexSize, NULL, GL_STATIC_DRAW);
+
+	for (int i = 0; i <= 2; i++)
+		glEnableVertexAttribArray(i);
+	if (p.format == VERTEX_PACKED)
+	{
+		glVertexAttribPointer(0, 4, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+		glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texcoord));
+	}
+	else
+	{
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, position));
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, texcoord));
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+bool MeshRegistry::fitsPacked(const std::vector<MeshVertex> &vertices)
+{
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const MeshVertex &v = vertices[i];
+		if (glm::any(glm::greaterThan(glm::abs(v.position), glm::vec3(HALF_MAX))) ||
+			glm::any(glm::greaterThan(glm::abs(v.texcoord), glm::vec2(1.0f))))
+			return false;
+	}
+	return true;
+}
+
+PackedVertex MeshRegistry::pack(const MeshVertex &v)
+{
+	PackedVertex p;
+	for (int i = 0; i < 3; i++)
+		p.position[i] = glm::packHalf1x16(v.position[i]);
+	p.position[3] = glm::packHalf1x16(1.0f);
+	p.normal = glm::packSnorm3x10_1x2(glm::vec4(v.normal, 0.0f));
+	for (int i = 0; i < 2; i++)
+		p.texcoord[i] = (GLshort)glm::packSnorm1x16(v.texcoord[i]);
+	return p;
+}
+
+GLsizeiptr MeshRegistry::getVertexSize(VertexFormat format)
+{
+	return format == VERTEX_PACKED ? sizeof(PackedVertex) : sizeof(MeshVertex);
+}
+
+GLuint MeshRegistry::getVertexArray(int entry) const
+{
+	return pages[entries[entry].page].vao;
+}
+
+GLenum MeshRegistry::getIndexType(int entry) const
+{
+	return pages[entries[entry].page].indexType;
+}
+
+GLsizeiptr MeshRegistry::getIndexSize(int entry) const
+{
+	return getIndexType(entry) == GL_UNSIGNED_INT ? sizeof(GLuint) : sizeof(GLushort);
+}
+
+int MeshRegistry::getRangeCount(int entry) const
+{
+	return (int)entries[entry].ranges.size();
+}
+
+const MeshRange &MeshRegistry::getRange(int entry, int range) const
+{
+	return entries[entry].ranges[range];
+}
+
+int MeshRegistry::getPageCount() const
+{
+	int count = 0;
+	for (size_t i = 0; i < pages.size(); i++)
+		if (pages[i].vao)
+			count++;
+	return count;
+}
+
+size_t MeshRegistry::getVertexBytes() const
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < pages.size(); i++)
+		if (pages[i].vao)
+			bytes += pages[i].vertexCount * getVertexSize(pages[i].format);
+	return bytes;
+}
+
+void MeshRegistry::printReport() const
+{
+	int meshes = 0, refs = 0;
+	for (size_t i = 0; i < entries.size(); i++)
+		if (entries[i].refs > 0)
+		{
+			meshes++;
+			refs += entries[i].refs;
+		}
+	printf("Mesh registry: %i meshes used by %i objects in %i pages\n", meshes, refs, getPageCount());
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		const Page &p = pages[i];
+		if (!p.vao)
+			continue;
+		printf("\tpage %u: %i/%i %i-byte vertices, %i/%i %s indices\n", (unsigned)i, p.vertexCount, p.vertexCapacity,
+			(int)getVertexSize(p.format), p.indexCount, p.indexCapacity, p.indexType == GL_UNSIGNED_INT ? "32-bit" : "16-bit");
+	}
+}
+
+MeshRegistry::~MeshRegistry()
+{
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		if (!pages[i].vao)
+			continue;
+		glDeleteVertexArrays(1, &pages[i].vao);
+		glDeleteBuffers(1, &pages[i].vertexBuffer);
+		glDeleteBuffers(1, &pages[i].indexBuffer);
+	}
+}
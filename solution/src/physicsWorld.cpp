@@ -0,0 +1,470 @@
+#include "physicsWorld.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <math.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+PhysicsParams::PhysicsParams(): ballRadius(1.0f), tableHalfSize(10.0f, 10.0f),
+	ballRestitution(0.95f), cushionRestitution(0.8f), rollingFriction(3.6f),
+	pocketRadius(1.6f), pockets(true)
+{ }
+
+PhysicsWorld::PhysicsWorld(const PhysicsParams &p): params(p), cellSize(0.0f), gridW(0), gridH(0),
+	contacts(0), eventsResolved(0)
+{ }
+
+const PhysicsParams &PhysicsWorld::getParams() const
+{
+	return params;
+}
+
+void PhysicsWorld::setParams(const PhysicsParams &p)
+{
+	params = p;
+	clear();
+}
+
+void PhysicsWorld::clear()
+{
+	posX.clear(); posZ.clear();
+	velX.clear(); velZ.clear();
+	prevX.clear(); prevZ.clear();
+	rotation.clear(); prevRotation.clear();
+	active.clear();
+}
+
+int PhysicsWorld::addBall(const glm::vec2 &pos, const glm::vec2 &vel)
+{
+	posX.push_back(pos.x); posZ.push_back(pos.y);
+	velX.push_back(vel.x); velZ.push_back(vel.y);
+	prevX.push_back(pos.x); prevZ.push_back(pos.y);
+	rotation.push_back(glm::quat());
+	prevRotation.push_back(glm::quat());
+	active.push_back(1);
+	return (int)posX.size() - 1;
+}
+
+void PhysicsWorld::placeBall(int ball, const glm::vec2 &pos)
+{
+	posX[ball] = prevX[ball] = pos.x;
+	posZ[ball] = prevZ[ball] = pos.y;
+	velX[ball] = velZ[ball] = 0.0f;
+	active[ball] = 1;
+}
+
+void PhysicsWorld::accelerate(int ball, const glm::vec2 &dv, float maxSpeed)
+{
+	glm::vec2 v = glm::vec2(velX[ball], velZ[ball]) + dv;
+	float speed = glm::length(v);
+	if (speed > maxSpeed)
+		v *= maxSpeed / speed;
+	velX[ball] = v.x;
+	velZ[ball] = v.y;
+}
+
+/*=================================
+			 Stepping
+===================================*/
+
+void PhysicsWorld::step(float dt)
+{
+	prevX = posX;
+	prevZ = posZ;
+	prevRotation = rotation;
+
+	applyFriction(dt);
+	findPairs(dt);
+	resolveEvents(dt);
+	separateOverlaps();
+	if (params.pockets)
+		collidePockets();
+}
+
+void PhysicsWorld::applyFriction(float dt)
+{
+	// velocities stay constant inside the step, friction takes its share up front
+	const float slowdown = params.rollingFriction * dt;
+	for (size_t i = 0; i < posX.size(); i++)
+	{
+		float speed = sqrtf(velX[i] * velX[i] + velZ[i] * velZ[i]);
+		if (!active[i] || speed < EPS)
+			continue;
+		float k = std::max(speed - slowdown, 0.0f) / speed;
+		velX[i] *= k;
+		velZ[i] *= k;
+	}
+}
+
+void PhysicsWorld::buildGrid(float reach)
+{
+	cellSize = reach;
+	gridW = std::max(1, (int)ceilf(2.0f * params.tableHalfSize.x / cellSize));
+	gridH = std::max(1, (int)ceilf(2.0f * params.tableHalfSize.y / cellSize));
+	cellStart.assign(gridW * gridH + 1, 0);
+
+	const int n = (int)posX.size();
+	ballCell.resize(n);
+	cellBalls.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		if (!active[i])
+		{
+			ballCell[i] = -1;
+			continue;
+		}
+		int cx = glm::clamp((int)((posX[i] + params.tableHalfSize.x) / cellSize), 0, gridW - 1);
+		int cz = glm::clamp((int)((posZ[i] + params.tableHalfSize.y) / cellSize), 0, gridH - 1);
+		ballCell[i] = cz * gridW + cx;
+		cellStart[ballCell[i] + 1]++;
+	}
+	for (int c = 0; c < gridW * gridH; c++)
+		cellStart[c + 1] += cellStart[c];
+
+	// cellStart[c] is used as a write cursor and is shifted back afterwards
+	for (int i = 0; i < n; i++)
+		if (ballCell[i] >= 0)
+			cellBalls[cellStart[ballCell[i]]++] = i;
+	for (int c = gridW * gridH; c > 0; c--)
+		cellStart[c] = cellStart[c - 1];
+	cellStart[0] = 0;
+}
+
+void PhysicsWorld::findPairs(float dt)
+{
+	const int n = (int)posX.size();
+	float maxSpeed = 0.0f;
+	for (int i = 0; i < n; i++)
+		if (active[i])
+			maxSpeed = std::max(maxSpeed, velX[i] * velX[i] + velZ[i] * velZ[i]);
+
+	// a collision can leave a ball up to sqrt(2) times faster than the fastest one before it
+	float travel = 1.5f * sqrtf(maxSpeed) * dt;
+	float reach = 2.0f * params.ballRadius + 2.0f * travel;
+	buildGrid(reach);
+
+	// cells are as wide as the reach, so pairs that can meet are never more than one cell apart
+	pairs.clear();
+	for (int i = 0; i < n; i++)
+	{
+		if (ballCell[i] < 0)
+			continue;
+		int cx = ballCell[i] % gridW;
+		int cz = ballCell[i] / gridW;
+		for (int z = std::max(cz - 1, 0); z <= std::min(cz + 1, gridH - 1); z++)
+			for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, gridW - 1); x++)
+			{
+				int c = z * gridW + x;
+				for (int k = cellStart[c]; k < cellStart[c + 1]; k++)
+				{
+					int j = cellBalls[k];
+					float dx = posX[j] - posX[i];
+					float dz = posZ[j] - posZ[i];
+					if (j > i && dx * dx + dz * dz < reach * reach)
+						pairs.push_back(glm::ivec2(i, j));
+				}
+			}
+	}
+
+	neighbourStart.assign(n + 1, 0);
+	for (size_t p = 0; p < pairs.size(); p++)
+	{
+		neighbourStart[pairs[p].x + 1]++;
+		neighbourStart[pairs[p].y + 1]++;
+	}
+	for (int i = 0; i < n; i++)
+		neighbourStart[i + 1] += neighbourStart[i];
+	neighbours.resize(pairs.size() * 2);
+
+	// same cursor trick as the grid
+	for (size_t p = 0; p < pairs.size(); p++)
+	{
+		neighbours[neighbourStart[pairs[p].x]++] = pairs[p].y;
+		neighbours[neighbourStart[pairs[p].y]++] = pairs[p].x;
+	}
+	for (int i = n; i > 0; i--)
+		neighbourStart[i] = neighbourStart[i - 1];
+	neighbourStart[0] = 0;
+}
+
+void PhysicsWorld::resolveEvents(float dt)
+{
+	const int n = (int)posX.size();
+	ballTime.assign(n, 0.0f);
+	ballEvents.assign(n, 0);
+	events.clear();
+	contacts = 0;
+	eventsResolved = 0;
+
+	for (int i = 0; i < n; i++)
+		if (active[i])
+			predict(i, 0.0f, dt, false);
+
+	// a tight cluster with restitution below one can collapse into endless tiny collisions;
+	// past the budget the remaining overlaps are settled by separateOverlaps
+	const int maxEvents = 16 * n + 64;
+	while (!events.empty() && eventsResolved < maxEvents)
+	{
+		std::pop_heap(events.begin(), events.end());
+		Event e = events.back();
+		events.pop_back();
+
+		bool ball = e.b >= 0;
+		if (!active[e.a] || e.countA != ballEvents[e.a])
+			continue;
+		if (ball && (!active[e.b] || e.countB != ballEvents[e.b]))
+			continue;
+
+		advanceBall(e.a, e.time);
+		if (ball)
+		{
+			advanceBall(e.b, e.time);
+			collideBalls(e.a, e.b);
+			ballEvents[e.b]++;
+			contacts++;
+		}
+		else
+			collideCushion(e.a, e.b);
+		ballEvents[e.a]++;
+		eventsResolved++;
+
+		if (active[e.a])
+			predict(e.a, e.time, dt, true);
+		if (ball)
+			predict(e.b, e.time, dt, true);
+	}
+
+	for (int i = 0; i < n; i++)
+		advanceBall(i, dt);
+}
+
+void PhysicsWorld::predict(int ball, float now, float dt, bool allNeighbours)
+{
+	const float limitX = params.tableHalfSize.x - params.ballRadius;
+	const float limitZ = params.tableHalfSize.y - params.ballRadius;
+	const float d = 2.0f * params.ballRadius;
+	const float x = posX[ball], z = posZ[ball];
+	const float vx = velX[ball], vz = velZ[ball];
+
+	// cushions; a ball already past the line while moving out is hit immediately
+	if (vx != 0.0f)
+	{
+		float t = std::max(((vx > 0.0f ? limitX : -limitX) - x) / vx, 0.0f);
+		if (now + t <= dt)
+			pushEvent(now + t, ball, CUSHION_X);
+	}
+	if (vz != 0.0f)
+	{
+		float t = std::max(((vz > 0.0f ? limitZ : -limitZ) - z) / vz, 0.0f);
+		if (now + t <= dt)
+			pushEvent(now + t, ball, CUSHION_Z);
+	}
+
+	for (int k = neighbourStart[ball]; k < neighbourStart[ball + 1]; k++)
+	{
+		int j = neighbours[k];
+		// at the start of the step every pair is predicted once, from its lower ball
+		if ((!allNeighbours && j < ball) || !active[j])
+			continue;
+
+		// solve |p + v t| = d for the relative motion, partner brought forward to now
+		float lag = now - ballTime[j];
+		float px = posX[j] + velX[j] * lag - x;
+		float pz = posZ[j] + velZ[j] * lag - z;
+		float rvx = velX[j] - vx;
+		float rvz = velZ[j] - vz;
+		float b = px * rvx + pz * rvz;
+		if (b >= 0.0f)
+			continue;
+		float a = rvx * rvx + rvz * rvz;
+		float c = px * px + pz * pz - d * d;
+		float t = 0.0f;
+		if (c > 0.0f)
+		{
+			float disc = b * b - a * c;
+			if (disc < 0.0f)
+				continue;
+			t = (-b - sqrtf(disc)) / a;
+		}
+		if (now + t <= dt)
+			pushEvent(now + t, ball, j);
+	}
+}
+
+void PhysicsWorld::pushEvent(float time, int a, int b)
+{
+	Event e;
+	e.time = time;
+	e.a = a;
+	e.b = b;
+	e.countA = ballEvents[a];
+	e.countB = b >= 0 ? ballEvents[b] : 0;
+	events.push_back(e);
+	std::push_heap(events.begin(), events.end());
+}
+
+void PhysicsWorld::advanceBall(int ball, float time)
+{
+	float dt = time - ballTime[ball];
+	ballTime[ball] = time;
+	float speed = sqrtf(velX[ball] * velX[ball] + velZ[ball] * velZ[ball]);
+	if (dt <= 0.0f || speed < EPS)
+		return;
+	posX[ball] += velX[ball] * dt;
+	posZ[ball] += velZ[ball] * dt;
+
+	// rolling without slipping: the ball turns by distance / radius
+	glm::vec3 axis = glm::vec3(velZ[ball], 0.0f, -velX[ball]) / speed;
+	rotation[ball] = glm::normalize(glm::angleAxis(speed * dt / params.ballRadius, axis) * rotation[ball]);
+}
+
+void PhysicsWorld::collideBalls(int a, int b)
+{
+	float dx = posX[b] - posX[a];
+	float dz = posZ[b] - posZ[a];
+	float dist = sqrtf(dx * dx + dz * dz);
+	if (dist < EPS)
+		return;
+	float nx = dx / dist;
+	float nz = dz / dist;
+
+	// equal masses: the normal components are exchanged, scaled by the restitution
+	float approach = (velX[a] - velX[b]) * nx + (velZ[a] - velZ[b]) * nz;
+	if (approach <= 0.0f)
+		return;
+	float j = 0.5f * (1.0f + params.ballRestitution) * approach;
+	velX[a] -= j * nx; velZ[a] -= j * nz;
+	velX[b] += j * nx; velZ[b] += j * nz;
+}
+
+void PhysicsWorld::collideCushion(int ball, int cushion)
+{
+	// the pockets cut through the cushions
+	if (params.pockets && overPocket(ball))
+	{
+		active[ball] = 0;
+		velX[ball] = velZ[ball] = 0.0f;
+		return;
+	}
+
+	const float e = params.cushionRestitution;
+	if (cushion == CUSHION_X)
+	{
+		float limitX = params.tableHalfSize.x - params.ballRadius;
+		posX[ball] = glm::clamp(posX[ball], -limitX, limitX);
+		velX[ball] = -velX[ball] * e;
+	}
+	else
+	{
+		float limitZ = params.tableHalfSize.y - params.ballRadius;
+		posZ[ball] = glm::clamp(posZ[ball], -limitZ, limitZ);
+		velZ[ball] = -velZ[ball] * e;
+	}
+}
+
+void PhysicsWorld::separateOverlaps()
+{
+	const float d = 2.0f * params.ballRadius;
+	for (size_t p = 0; p < pairs.size(); p++)
+	{
+		int a = pairs[p].x, b = pairs[p].y;
+		if (!active[a] || !active[b])
+			continue;
+		float dx = posX[b] - posX[a];
+		float dz = posZ[b] - posZ[a];
+		float dist2 = dx * dx + dz * dz;
+		// contacts resolved at their time of impact sit at exactly d, give them some slack
+		if (dist2 >= d * d * 0.999f || dist2 < EPS)
+			continue;
+
+		float dist = sqrtf(dist2);
+		float push = 0.5f * (d - dist) / dist;
+		posX[a] -= dx * push; posZ[a] -= dz * push;
+		posX[b] += dx * push; posZ[b] += dz * push;
+		collideBalls(a, b);
+	}
+}
+
+bool PhysicsWorld::overPocket(int ball) const
+{
+	const glm::vec2 h = params.tableHalfSize;
+	const glm::vec2 pockets[] = {
+		glm::vec2(-h.x, -h.y), glm::vec2(h.x, -h.y),
+		glm::vec2(-h.x, 0.0f), glm::vec2(h.x, 0.0f),
+		glm::vec2(-h.x, h.y), glm::vec2(h.x, h.y),
+	};
+	const float r2 = params.pocketRadius * params.pocketRadius;
+
+	for (int p = 0; p < 6; p++)
+	{
+		float dx = posX[ball] - pockets[p].x;
+		float dz = posZ[ball] - pockets[p].y;
+		if (dx * dx + dz * dz < r2)
+			return true;
+	}
+	return false;
+}
+
+void PhysicsWorld::collidePockets()
+{
+	for (size_t i = 0; i < posX.size(); i++)
+		if (active[i] && overPocket((int)i))
+		{
+			active[i] = 0;
+			velX[i] = velZ[i] = 0.0f;
+		}
+}
+/*=================================
+			  State
+===================================*/
+
+int PhysicsWorld::getBallCount() const
+{
+	return (int)posX.size();
+}
+
+int PhysicsWorld::getActiveCount() const
+{
+	return (int)std::count(active.begin(), active.end(), 1);
+}
+
+bool PhysicsWorld::isPocketed(int ball) const
+{
+	return !active[ball];
+}
+
+glm::vec2 PhysicsWorld::getVelocity(int ball) const
+{
+	return glm::vec2(velX[ball], velZ[ball]);
+}
+
+glm::vec3 PhysicsWorld::getPosition(int ball, float alpha) const
+{
+	return glm::vec3(prevX[ball] + (posX[ball] - prevX[ball]) * alpha, params.ballRadius,
+		prevZ[ball] + (posZ[ball] - prevZ[ball]) * alpha);
+}
+
+glm::quat PhysicsWorld::getRotation(int ball, float alpha) const
+{
+	return glm::slerp(prevRotation[ball], rotation[ball], alpha);
+}
+
+glm::mat4 PhysicsWorld::getModelToWorldMat(int ball, float alpha) const
+{
+	return glm::translate(glm::mat4(1.0), getPosition(ball, alpha)) * glm::mat4_cast(getRotation(ball, alpha));
+}
+
+int PhysicsWorld::getCandidatePairs() const
+{
+	return (int)pairs.size();
+}
+
+int PhysicsWorld::getContacts() const
+{
+	return contacts;
+}
+
+int PhysicsWorld::getEvents() const
+{
+	return eventsResolved;
+}
@@ -0,0 +1,230 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <numeric>
+
+const char *Profiler::passNames[PASS_COUNT] = { "simulation", "shadow", "scene", "lighting", "lights", "skybox", "motionBlur", "present" };
+
+const char *Profiler::counterNames[COUNTER_COUNT] = { "stateChanges", "stateChangesSkipped", "physicsSteps", "triangles", "matricesUpdated",
+	"lightsPerCluster", "clusterDrops", "shadowCasters" };
+
+const char *Profiler::startupNames[STARTUP_COUNT] = { "shaders", "assets", "scene", "total" };
+
+Profiler::Profiler(): enabled(false), gpuTimers(false)
+{
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		passUsed[i] = false;
+		queries[i] = 0;
+	}
+	for (int i = 0; i < STARTUP_COUNT; i++)
+		startupTimes[i] = 0.0;
+}
+
+void Profiler::init()
+{
+	// timer queries are core since 3.3, but some software drivers still report them as unsupported
+	gpuTimers = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if (gpuTimers)
+		glGenQueries(PASS_COUNT, queries);
+}
+
+void Profiler::setEnabled(bool e)
+{
+	enabled = e;
+}
+
+bool Profiler::isEnabled() const
+{
+	return enabled;
+}
+
+bool Profiler::hasGpuTimers() const
+{
+	return gpuTimers;
+}
+
+void Profiler::reset()
+{
+	frameTimes.clear();
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		passCpuTimes[i].clear();
+		passGpuTimes[i].clear();
+	}
+	for (int i = 0; i < COUNTER_COUNT; i++)
+		counters[i].clear();
+}
+
+void Profiler::beginFrame()
+{
+	if (!enabled)
+		return;
+	for (int i = 0; i < PASS_COUNT; i++)
+		passUsed[i] = false;
+	frameStart = Clock::now();
+}
+
+void Profiler::endFrame()
+{
+	if (!enabled)
+		return;
+	frameTimes.push_back(elapsedMs(frameStart, Clock::now()));
+
+	// the frame has been finished by the caller, so reading the queries back does not stall
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		if (!passUsed[i] || !gpuTimers)
+			continue;
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+		passGpuTimes[i].push_back(ns / 1000000.0);
+	}
+}
+
+void Profiler::beginPass(ProfilePass pass)
+{
+	if (!enabled)
+		return;
+	if (gpuTimers)
+		glBeginQuery(GL_TIME_ELAPSED, queries[pass]);
+	passStart[pass] = Clock::now();
+}
+
+void Profiler::endPass(ProfilePass pass)
+{
+	if (!enabled)
+		return;
+	if (gpuTimers)
+		glEndQuery(GL_TIME_ELAPSED);
+	passCpuTimes[pass].push_back(elapsedMs(passStart[pass], Clock::now()));
+	passUsed[pass] = true;
+}
+
+void Profiler::setCounter(ProfileCounter counter, double value)
+{
+	if (!enabled)
+		return;
+	counters[counter].push_back(value);
+}
+
+// not tied to frames, so it is kept even while disabled and across reset()
+void Profiler::setStartupTime(StartupStage stage, double ms)
+{
+	startupTimes[stage] = ms;
+}
+
+double Profiler::elapsedMs(const Clock::time_point &from, const Clock::time_point &to)
+{
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+Profiler::Stats Profiler::computeStats(std::vector<double> samples)
+{
+	Stats s = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	if (samples.empty())
+		return s;
+
+	std::sort(samples.begin(), samples.end());
+	size_t n = samples.size();
+	// nearest-rank percentiles
+	s.p50 = samples[std::min(n - 1, (size_t)(0.50 * n))];
+	s.p95 = samples[std::min(n - 1, (size_t)(0.95 * n))];
+	s.p99 = samples[std::min(n - 1, (size_t)(0.99 * n))];
+	s.min = samples.front();
+	s.max = samples.back();
+	s.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / n;
+	return s;
+}
+
+double Profiler::getPassMs(ProfilePass pass) const
+{
+	return computeStats(gpuTimers ? passGpuTimes[pass] : passCpuTimes[pass]).mean;
+}
+
+void Profiler::printSummary() const
+{
+	Stats frame = computeStats(frameTimes);
+	printf("Startup, ms:");
+	for (int i = 0; i < STARTUP_COUNT; i++)
+		printf(" %s %.1f", startupNames[i], startupTimes[i]);
+	printf("\nFrames: %u\n", (unsigned)frameTimes.size());
+	printf("Frame time, ms: mean %.3f  p50 %.3f  p95 %.3f  p99 %.3f\n", frame.mean, frame.p50, frame.p95, frame.p99);
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		if (passCpuTimes[i].empty())
+			continue;
+		Stats cpu = computeStats(passCpuTimes[i]);
+		Stats gpu = computeStats(passGpuTimes[i]);
+		printf("\t%-12s cpu %.3f ms  gpu %.3f ms\n", passNames[i], cpu.mean, gpu.mean);
+	}
+	for (int i = 0; i < COUNTER_COUNT; i++)
+	{
+		if (counters[i].empty())
+			continue;
+		Stats c = computeStats(counters[i]);
+		printf("\t%-20s %.1f per frame (max %.0f)\n", counterNames[i], c.mean, c.max);
+	}
+}
+
+void Profiler::writeStats(FILE *f, const Stats &s)
+{
+	fprintf(f, "{ \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"min\": %.4f, \"max\": %.4f }",
+		s.mean, s.p50, s.p95, s.p99, s.min, s.max);
+}
+
+bool Profiler::writeJson(const std::string &path, const std::string &label) const
+{
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f)
+	{
+		printf("Can't write benchmark report to %s\n", path.c_str());
+		return false;
+	}
+
+	const char *renderer = (const char*)glGetString(GL_RENDERER);
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"label\": \"%s\",\n", label.c_str());
+	fprintf(f, "\t\"renderer\": \"%s\",\n", renderer ? renderer : "unknown");
+	fprintf(f, "\t\"startupMs\": {");
+	for (int i = 0; i < STARTUP_COUNT; i++)
+		fprintf(f, "%s \"%s\": %.3f", i ? "," : "", startupNames[i], startupTimes[i]);
+	fprintf(f, " },\n");
+	fprintf(f, "\t\"frames\": %u,\n", (unsigned)frameTimes.size());
+	fprintf(f, "\t\"frameTimeMs\": ");
+	writeStats(f, computeStats(frameTimes));
+	fprintf(f, ",\n\t\"passes\": {");
+
+	bool first = true;
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		if (passCpuTimes[i].empty())
+			continue;
+		fprintf(f, "%s\n\t\t\"%s\": {\n\t\t\t\"cpuMs\": ", first ? "" : ",", passNames[i]);
+		writeStats(f, computeStats(passCpuTimes[i]));
+		fprintf(f, ",\n\t\t\t\"gpuMs\": ");
+		writeStats(f, computeStats(passGpuTimes[i]));
+		fprintf(f, "\n\t\t}");
+		first = false;
+	}
+	fprintf(f, "\n\t},\n\t\"counters\": {");
+
+	first = true;
+	for (int i = 0; i < COUNTER_COUNT; i++)
+	{
+		if (counters[i].empty())
+			continue;
+		fprintf(f, "%s\n\t\t\"%s\": ", first ? "" : ",", counterNames[i]);
+		writeStats(f, computeStats(counters[i]));
+		first = false;
+	}
+	fprintf(f, "\n\t}\n}\n");
+	fclose(f);
+	return true;
+}
+
+Profiler::~Profiler()
+{
+	if (gpuTimers)
+		glDeleteQueries(PASS_COUNT, queries);
+}
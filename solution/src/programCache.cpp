@@ -0,0 +1,176 @@
+#include "programCache.h"
+
+#include <stdio.h>
+#ifdef _WIN32
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+
+static const uint32_t CACHE_MAGIC = 0x42505347;	// "GSPB"
+static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+// stored in front of the binary; the key guards against hash-named files that belong to something else
+struct CacheHeader
+{
+	uint32_t magic;
+	uint32_t format;
+	uint64_t key;
+	uint32_t length;
+};
+
+ProgramCache::ProgramCache(): mode(SHADER_CACHE_OFF), hits(0), compiled(0), rejected(0) { }
+
+void ProgramCache::init(const std::string &directory, ShaderCacheMode m)
+{
+	dir = directory;
+	mode = m;
+
+	GLint formats = 0;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats == 0)
+	{
+		if (mode != SHADER_CACHE_OFF)
+			printf("Program binaries are not supported by the driver, shaders are always compiled\n");
+		mode = SHADER_CACHE_OFF;
+		return;
+	}
+
+	const char *strings[] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER),
+		(const char*)glGetString(GL_VERSION), (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION) };
+	for (int i = 0; i < 4; i++)
+		driver += std::string(strings[i] ? strings[i] : "") + "\n";
+
+	if (mode != SHADER_CACHE_OFF)
+		makeDirectory(dir.c_str());
+}
+
+GLuint ProgramCache::load(const std::vector<shaderStringPair> &filePathList, const std::string &defines)
+{
+	std::vector<shaderStringPair> sources;
+	ShaderWorker::readSources(filePathList, defines, sources);
+	if (mode == SHADER_CACHE_OFF)
+	{
+		compiled++;
+		return ShaderWorker::createProgramFromSources(sources);
+	}
+
+	// defines are already part of the sources
+	uint64_t key = hash(driver, FNV_OFFSET);
+	for (std::vector<shaderStringPair>::const_iterator it = sources.begin(); it != sources.end(); it++)
+	{
+		char type[16];
+		sprintf(type, "%u\n", (unsigned)it->first);
+		key = hash(it->second, hash(type, key));
+	}
+	std::string path = entryPath(key);
+
+	if (mode == SHADER_CACHE_ON)
+	{
+		GLuint program = loadBinary(path, key);
+		if (program)
+		{
+			hits++;
+			return program;
+		}
+	}
+
+	compiled++;
+	GLuint program = ShaderWorker::createProgramFromSources(sources, true);
+	saveBinary(program, path, key);
+	return program;
+}
+
+uint64_t ProgramCache::hash(const std::string &data, uint64_t h)
+{
+	// FNV-1a
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		h ^= (unsigned char)data[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+std::string ProgramCache::entryPath(uint64_t key) const
+{
+	char name[32];
+	sprintf(name, "%016llx.bin", (unsigned long long)key);
+	return dir + name;
+}
+
+GLuint ProgramCache::loadBinary(const std::string &path, uint64_t key)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return 0;
+
+	CacheHeader header;
+	std::vector<char> binary;
+	bool valid = fread(&header, sizeof(header), 1, f) == 1 && header.magic == CACHE_MAGIC && header.key == key;
+	if (valid)
+	{
+		binary.resize(header.length);
+		valid = header.length > 0 && fread(&binary[0], 1, binary.size(), f) == binary.size();
+	}
+	fclose(f);
+	if (!valid)
+		return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.format, &binary[0], (GLsizei)binary.size());
+	GLint status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE)
+	{
+		// a format from an older driver build; swallow the error it may have raised
+		while (glGetError() != GL_NO_ERROR);
+		glDeleteProgram(program);
+		rejected++;
+		return 0;
+	}
+	return program;
+}
+
+void ProgramCache::saveBinary(GLuint program, const std::string &path, uint64_t key)
+{
+	GLint status = GL_FALSE, length = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (status == GL_FALSE || length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+	{
+		printf("Can't write program binary to %s\n", path.c_str());
+		return;
+	}
+	CacheHeader header = { CACHE_MAGIC, format, key, (uint32_t)length };
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(&binary[0], 1, length, f);
+	fclose(f);
+}
+
+int ProgramCache::getHits() const
+{
+	return hits;
+}
+
+int ProgramCache::getCompiled() const
+{
+	return compiled;
+}
+
+int ProgramCache::getRejected() const
+{
+	return rejected;
+}
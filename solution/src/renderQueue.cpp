@@ -0,0 +1,199 @@
+#include "renderQueue.h"
+
+#include <algorithm>
+#include <string.h>
+
+RenderQueue::RenderQueue(): sorted(true) { }
+
+uint64_t RenderQueue::makeKey(QueuePass pass, int program, int material, int texture, float depth)
+{
+	// non-negative floats keep their order when compared as integers
+	uint32_t depthBits;
+	depth = std::max(depth, 0.0f);
+	memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	return ((uint64_t)(pass & 0xF) << 60) |
+		((uint64_t)(program & 0xFF) << 52) |
+		((uint64_t)(material & 0xFF) << 44) |
+		((uint64_t)(texture & 0xFFF) << 32) |
+		depthBits;
+}
+
+void RenderQueue::clear()
+{
+	packets.clear();
+	order.clear();
+	instances.clear();
+	sorted = true;
+}
+
+void RenderQueue::submit(QueuePass pass, float depth, const RenderPacket &packet)
+{
+	SortEntry entry;
+	entry.key = makeKey(pass, packet.program, packet.material, packet.texture, depth);
+	entry.index = (unsigned)packets.size();
+	packets.push_back(packet);
+	order.push_back(entry);
+	sorted = false;
+}
+
+unsigned RenderQueue::addInstances(const InstanceData *data, unsigned count)
+{
+	unsigned first = (unsigned)instances.size();
+	instances.insert(instances.end(), data, data + count);
+	return first;
+}
+
+void RenderQueue::sort()
+{
+	if (sorted)
+		return;
+	std::sort(order.begin(), order.end());
+	sorted = true;
+}
+
+void RenderQueue::getRange(QueuePass pass, size_t &begin, size_t &end) const
+{
+	begin = 0;
+	while (begin < order.size() && (order[begin].key >> 60) < (uint64_t)pass)
+		begin++;
+	end = begin;
+	while (end < order.size() && (order[end].key >> 60) == (uint64_t)pass)
+		end++;
+}
+
+const RenderPacket &RenderQueue::getPacket(size_t sortedIndex) const
+{
+	return packets[order[sortedIndex].index];
+}
+
+size_t RenderQueue::size() const
+{
+	return packets.size();
+}
+
+const std::vector<InstanceData> &RenderQueue::getInstances() const
+{
+	return instances;
+}
+
+/*=================================
+		   State cache
+===================================*/
+
+StateCache::StateCache()
+{
+	invalidate();
+	resetCounters();
+}
+
+void StateCache::invalidate()
+{
+	program = UNKNOWN;
+	vertexArray = UNKNOWN;
+	activeUnit = UNKNOWN;
+	for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+	{
+		textureTargets[i] = GL_NONE;
+		textures[i] = UNKNOWN;
+		samplers[i] = UNKNOWN;
+	}
+	for (int i = 0; i < MAX_BUFFER_BINDINGS; i++)
+	{
+		buffers[i].buffer = UNKNOWN;
+		buffers[i].offset = 0;
+		buffers[i].size = 0;
+	}
+}
+
+void StateCache::resetCounters()
+{
+	issued = 0;
+	skipped = 0;
+}
+
+void StateCache::useProgram(GLuint pr)
+{
+	if (program == pr)
+	{
+		skipped++;
+		return;
+	}
+	glUseProgram(pr);
+	program = pr;
+	issued++;
+}
+
+void StateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	if (unit < MAX_TEXTURE_UNITS && textures[unit] == texture && textureTargets[unit] == target)
+	{
+		skipped++;
+		return;
+	}
+	if (activeUnit != unit)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		activeUnit = unit;
+	}
+	glBindTexture(target, texture);
+	if (unit < MAX_TEXTURE_UNITS)
+	{
+		textureTargets[unit] = target;
+		textures[unit] = texture;
+	}
+	issued++;
+}
+
+void StateCache::bindSampler(GLuint unit, GLuint sampler)
+{
+	if (unit < MAX_TEXTURE_UNITS && samplers[unit] == sampler)
+	{
+		skipped++;
+		return;
+	}
+	glBindSampler(unit, sampler);
+	if (unit < MAX_TEXTURE_UNITS)
+		samplers[unit] = sampler;
+	issued++;
+}
+
+void StateCache::bindBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	if (index < MAX_BUFFER_BINDINGS && buffers[index].buffer == buffer &&
+		buffers[index].offset == offset && buffers[index].size == size)
+	{
+		skipped++;
+		return;
+	}
+	glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+	if (index < MAX_BUFFER_BINDINGS)
+	{
+		buffers[index].buffer = buffer;
+		buffers[index].offset = offset;
+		buffers[index].size = size;
+	}
+	issued++;
+}
+
+void StateCache::bindVertexArray(GLuint vao)
+{
+	if (vertexArray == vao)
+	{
+		skipped++;
+		return;
+	}
+	glBindVertexArray(vao);
+	vertexArray = vao;
+	issued++;
+}
+
+int StateCache::getIssued() const
+{
+	return issued;
+}
+
+int StateCache::getSkipped() const
+{
+	return skipped;
+}
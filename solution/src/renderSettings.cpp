@@ -0,0 +1,80 @@
+#include "renderSettings.h"
+
+#include <string.h>
+
+static const char *shadowModeNames[SHADOW_MODE_COUNT] = { "per-light", "layered", "cube" };
+static const char *shadowQualityNames[SHADOW_QUALITY_COUNT] = { "low", "medium", "high" };
+static const char *shaderCacheNames[SHADER_CACHE_MODE_COUNT] = { "off", "on", "rebuild" };
+static const char *textureFilterNames[FILTER_COUNT] = { "nearest", "bilinear", "trilinear", "anisotropic" };
+static const char *renderPathNames[RENDER_PATH_COUNT] = { "forward", "deferred" };
+
+RenderSettings::RenderSettings(): shadowMode(SHADOW_PER_LIGHT), shadowQuality(SHADOW_QUALITY_MEDIUM), motionBlur(false),
+	shaderCache(SHADER_CACHE_ON), textureFilter(FILTER_ANISOTROPIC), renderPath(RENDER_FORWARD) { }
+
+std::string RenderSettings::describe() const
+{
+	return std::string("shadows=") + shadowModeNames[shadowMode] +
+		" shadowQuality=" + shadowQualityNames[shadowQuality] +
+		" motionBlur=" + (motionBlur ? "on" : "off") +
+		" shaderCache=" + shaderCacheNames[shaderCache] +
+		" textureFilter=" + textureFilterNames[textureFilter] +
+		" renderPath=" + renderPathNames[renderPath];
+}
+
+bool RenderSettings::parseOption(const char *name, const char *value)
+{
+	if (!strcmp(name, "--shadows"))
+	{
+		for (int i = 0; i < SHADOW_MODE_COUNT; i++)
+			if (!strcmp(value, shadowModeNames[i]))
+			{
+				shadowMode = (ShadowMode)i;
+				return true;
+			}
+	}
+	else if (!strcmp(name, "--shadow-quality"))
+	{
+		for (int i = 0; i < SHADOW_QUALITY_COUNT; i++)
+			if (!strcmp(value, shadowQualityNames[i]))
+			{
+				shadowQuality = (ShadowQuality)i;
+				return true;
+			}
+	}
+	else if (!strcmp(name, "--motion-blur"))
+	{
+		if (!strcmp(value, "on") || !strcmp(value, "off"))
+		{
+			motionBlur = !strcmp(value, "on");
+			return true;
+		}
+	}
+	else if (!strcmp(name, "--shader-cache"))
+	{
+		for (int i = 0; i < SHADER_CACHE_MODE_COUNT; i++)
+			if (!strcmp(value, shaderCacheNames[i]))
+			{
+				shaderCache = (ShaderCacheMode)i;
+				return true;
+			}
+	}
+	else if (!strcmp(name, "--texture-filter"))
+	{
+		for (int i = 0; i < FILTER_COUNT; i++)
+			if (!strcmp(value, textureFilterNames[i]))
+			{
+				textureFilter = (TextureFilter)i;
+				return true;
+			}
+	}
+	else if (!strcmp(name, "--render-path"))
+	{
+		for (int i = 0; i < RENDER_PATH_COUNT; i++)
+			if (!strcmp(value, renderPathNames[i]))
+			{
+				renderPath = (RenderPath)i;
+				return true;
+			}
+	}
+	return false;
+}
@@ -2,241 +2,136 @@
 #include "settings.h"
 
 #include <algorithm>
+#include <stdio.h>
 #include <glm/gtc/matrix_transform.hpp>
 
 
-Sphere::Sphere(const glm::vec3 &wp, int r, int s): Mesh(wp), 
-	maxSpeed(0.3f), braking(0.001f), 
-	acceleration(0.005f), rings(r), sectors(s) 
-{ }
-
-void Sphere::load()
-{
-	float const R = 1.0f / (float)(rings-1);
-	float const S = 1.0f / (float)(sectors-1);
-	size_t sizeOfVertexData = rings * sectors * 8;
-	size_t sizeOfIndexData = rings * sectors * 4;
-	float *sphereVertexData = new GLfloat[sizeOfVertexData];
-	GLshort *sphereIndexData = new GLshort[sizeOfIndexData];
-	size_t normalDataOffset = sizeof(float) * rings * sectors * 3;
-	size_t texcoDataOffset = sizeof(float) * rings * sectors * 3 * 2;
-
-	float *v = sphereVertexData;
-	float *n = v + normalDataOffset / sizeof(float);
-	float *t = v + texcoDataOffset / sizeof(float);
-	GLshort *i = sphereIndexData;
-
-	for (int r = 0; r < rings; r++)
-		for (int s = 0; s < sectors; s++) 
-		{
-			float y = sin(-M_PI / 2.0f + M_PI * r * R);
-			float x = cos(2 * M_PI * s * S) * sin(M_PI * r * R);
-			float z = sin(2 * M_PI * s * S) * sin(M_PI * r * R);
-
-			*v++ = x;
-			*v++ = y;
-			*v++ = z;
-
-			*n++ = x;
-			*n++ = y;
-			*n++ = z;
-
-			*t++ = -s*S;
-			*t++ = r*R;
-
-			*i++ = (r+1) * sectors + s;
-			*i++ = (r+1) * sectors + (s+1);
-			*i++ = r * sectors + (s+1);
-			*i++ = r * sectors + s;
-		}
-
-	glGenBuffers(1, &vertexBufferObject);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * sizeOfVertexData, sphereVertexData, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glGenBuffers(1, &indexBufferObject);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObject);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLshort) * sizeOfIndexData, sphereIndexData, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
-	for (int i = 0; i <= 2; i++)
-		glEnableVertexAttribArray(i);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)normalDataOffset);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)texcoDataOffset);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObject);
-	glBindVertexArray(0);
-
-	vaoSize = sizeOfIndexData;
-
-	delete[] sphereVertexData;
-	delete[] sphereIndexData;
-}
-
-void Sphere::draw() const
+Sphere::Sphere(const glm::vec3 &wp, int sectors, int lodCount): Mesh(wp)
 {
-	glBindVertexArray(vao);
-	glDrawElements(GL_QUADS, vaoSize, GL_UNSIGNED_SHORT, 0);
-	glBindVertexArray(0);
+	for (int i = 0; i < lodCount && (sectors >> i) >= 4; i++)
+		lodSectors.push_back(sectors >> i);
 }
 
-glm::mat4 Sphere::getModelToWorldMat() const
+std::string Sphere::getKey() const
 {
-	return glm::translate(glm::mat4(1.0), worldPos) * glm::mat4_cast(rotation);
+	char key[64];
+	sprintf(key, "sphere/%i/%i", lodSectors[0], (int)lodSectors.size());
+	return key;
 }
 
-glm::vec3 Sphere::getVelocity() const
+void Sphere::generate()
 {
-	return velocity;
-}
-
-void Sphere::changeVelocity(const glm::vec3 &a, float frameDiv)
-{
-	velocity += glm::normalize(glm::vec3(a.x, 0.0, a.z)) * acceleration * frameDiv;
-	velocity = glm::clamp(velocity, -maxSpeed, maxSpeed);
-}
-
-void Sphere::move(float frameDiv)
-{
-	float angle = glm::length(velocity) * frameDiv;
-	if (angle > EPS)
+	for (size_t l = 0; l < lodSectors.size(); l++)
 	{
-		glm::quat rq = glm::normalize(glm::angleAxis(angle, glm::normalize(glm::vec3(velocity.z, 0.0, -velocity.x))));
-		rotation = glm::normalize(rq * rotation);
+		const int sectors = lodSectors[l];
+		const int rings = std::max(2, sectors / 2);
+		const float R = 1.0f / (float)rings;
+		const float S = 1.0f / (float)sectors;
+		const int rowSize = sectors + 1;	// the seam column is doubled for the texture coordinates
+
+		MeshRange range;
+		range.baseVertex = (GLint)vertexData.size();
+		range.firstIndex = (GLsizei)indexData.size();
+
+		for (int r = 0; r <= rings; r++)
+			for (int s = 0; s <= sectors; s++)
+			{
+				float y = sin(-M_PI / 2.0f + M_PI * r * R);
+				float x = cos(2 * M_PI * s * S) * sin(M_PI * r * R);
+				float z = sin(2 * M_PI * s * S) * sin(M_PI * r * R);
+
+				// on the unit sphere the normal is the position
+				MeshVertex v;
+				v.position = glm::vec3(x, y, z);
+				v.normal = v.position;
+				v.texcoord = glm::vec2(-s*S, r*R);
+				vertexData.push_back(v);
+			}
+
+		// two triangles per quad, one at the poles where the other one would be degenerate
+		for (int r = 0; r < rings; r++)
+			for (int s = 0; s < sectors; s++)
+			{
+				GLuint a = r * rowSize + s, b = a + 1;
+				GLuint c = a + rowSize, d = c + 1;
+				if (r != rings - 1)
+				{
+					indexData.push_back(c);
+					indexData.push_back(d);
+					indexData.push_back(b);
+				}
+				if (r != 0)
+				{
+					indexData.push_back(c);
+					indexData.push_back(b);
+					indexData.push_back(a);
+				}
+			}
+		range.indexCount = (GLsizei)indexData.size() - range.firstIndex;
+		lodRanges.push_back(range);
 	}
-
-	worldPos += velocity * frameDiv;
-	
-	const float a = braking * frameDiv;
-	velocity.x = velocity.x < 0.0 ? glm::clamp(velocity.x + a, -maxSpeed, 0.0f) : glm::clamp(velocity.x - a, 0.0f, maxSpeed);
-	velocity.z = velocity.z < 0.0 ? glm::clamp(velocity.z + a, -maxSpeed, 0.0f) : glm::clamp(velocity.z - a, 0.0f, maxSpeed);
 }
 
-void Sphere::setVelocity(const glm::vec3 &v)
+int Sphere::chooseLod(float projectedRadius, float maxError) const
 {
-	velocity = v;
+	// a segment spanning the angle 2*pi/sectors dips 1 - cos(pi/sectors) below the surface at its middle
+	for (int l = (int)lodSectors.size() - 1; l > 0; l--)
+		if (projectedRadius * (1.0f - cos(M_PI / lodSectors[l])) <= maxError)
+			return l;
+	return 0;
 }
 
-Sphere::~Sphere()
+Plane::Plane(const glm::vec3 &wp): Mesh(wp) { }
+
+std::string Plane::getKey() const
 {
-	glDeleteBuffers(1, &vertexBufferObject);
-	glDeleteBuffers(1, &indexBufferObject);
+	return "plane";
 }
 
-Plane::Plane(const glm::vec3 &wp): Mesh(wp), scale(glm::vec3(1.0)), textureScale(glm::vec2(1.0)) { }
-
-void Plane::load()
+void Plane::generate()
 {
-	const float planeVertexData[] = {
-		-1.0f, 0.0f, -1.0f,
-		1.0f, 0.0f, -1.0f,
-		-1.0f, 0.0f, 1.0f,
-		1.0f, 0.0f, 1.0f,
-
-		0.0, 1.0, 0.0,
-		0.0, 1.0, 0.0,
-		0.0, 1.0, 0.0,
-		0.0, 1.0, 0.0,
-
-		0.0, 0.0,
-		1.0, 0.0,
-		0.0, 1.0,
-		1.0, 1.0,
+	const MeshVertex planeVertexData[] = {
+		{ glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(0.0, 1.0, 0.0), glm::vec2(0.0, 0.0) },
+		{ glm::vec3(1.0f, 0.0f, -1.0f), glm::vec3(0.0, 1.0, 0.0), glm::vec2(1.0, 0.0) },
+		{ glm::vec3(-1.0f, 0.0f, 1.0f), glm::vec3(0.0, 1.0, 0.0), glm::vec2(0.0, 1.0) },
+		{ glm::vec3(1.0f, 0.0f, 1.0f), glm::vec3(0.0, 1.0, 0.0), glm::vec2(1.0, 1.0) },
 	};
 
-	const GLshort planeIndexData[] = 
+	const GLuint planeIndexData[] =
 	{
 		2, 1, 0,
 		2, 3, 1,
 	};
 
-	glGenBuffers(1, &vertexBufferObject);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertexData), planeVertexData, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glGenBuffers(1, &indexBufferObject);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObject);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(planeIndexData), planeIndexData, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	size_t normalDataOffset = sizeof(float) * 3 * 4;
-	size_t texcoDataOffset = sizeof(float) * 3 * 8;
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
-	for (int i = 0; i <= 2; i++)
-		glEnableVertexAttribArray(i);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)normalDataOffset);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)texcoDataOffset);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObject);
-	glBindVertexArray(0);
-
-	vaoSize = sizeof(planeIndexData) / sizeof(planeIndexData[0]);
+	vertexData.assign(planeVertexData, planeVertexData + sizeof(planeVertexData) / sizeof(planeVertexData[0]));
+	indexData.assign(planeIndexData, planeIndexData + sizeof(planeIndexData) / sizeof(planeIndexData[0]));
+	MeshRange range = { 0, (GLsizei)indexData.size(), 0 };
+	lodRanges.assign(1, range);
 }
 
-void Plane::draw() const
-{
-	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, vaoSize, GL_UNSIGNED_SHORT, 0);
-	glBindVertexArray(0);
-}
-
-glm::mat4 Plane::getModelToWorldMat() const
-{
-	return glm::scale(glm::translate(glm::mat4(1.0), worldPos) * glm::mat4_cast(rotation), scale);
-}
-
-glm::vec2 Plane::getTextureScale() const
-{
-	return textureScale;
-}
-
-void Plane::setScale(const glm::vec3 &sc)
-{
-	scale = sc;
-}
-
-void Plane::setTextureScale(const glm::vec2 &tsc)
-{
-	textureScale = tsc;
-}
-
-void Plane::setRotate(const glm::vec3 &euler)
-{
-	rotation = glm::quat(euler);
-}
+Cube::Cube(const glm::vec3 &wp): Mesh(wp), scale(glm::vec3(1.0)) {}
 
-Plane::~Plane()
+std::string Cube::getKey() const
 {
-	glDeleteBuffers(1, &vertexBufferObject);
-	glDeleteBuffers(1, &indexBufferObject);
+	return "cube";
 }
 
-Cube::Cube(const glm::vec3 &wp): Mesh(wp), scale(glm::vec3(1.0)) {}
-
-void Cube::load()
+void Cube::generate()
 {
-	const float cubeVertexData[] = {
-		-0.5f, -0.5f, -0.5f,
-		0.5f, -0.5f, -0.5f,
-		0.5f, 0.5f, -0.5f,
-		-0.5f, 0.5f, -0.5f,
+	// the skybox only reads positions
+	const glm::vec3 cubeVertexData[] = {
+		glm::vec3(-0.5f, -0.5f, -0.5f),
+		glm::vec3(0.5f, -0.5f, -0.5f),
+		glm::vec3(0.5f, 0.5f, -0.5f),
+		glm::vec3(-0.5f, 0.5f, -0.5f),
 
-		-0.5f, -0.5f, 0.5f,
-		0.5f, -0.5f, 0.5f,
-		0.5f, 0.5f, 0.5f,
-		-0.5f, 0.5f, 0.5f,
+		glm::vec3(-0.5f, -0.5f, 0.5f),
+		glm::vec3(0.5f, -0.5f, 0.5f),
+		glm::vec3(0.5f, 0.5f, 0.5f),
+		glm::vec3(-0.5f, 0.5f, 0.5f),
 	};
 
-	const GLshort cubeIndexData[] = 
+	const GLuint cubeIndexData[] =
 	{
 		0, 2, 1,
 		0, 3, 2,
@@ -257,33 +152,14 @@ void Cube::load()
 		0, 5, 4,
 	};
 
-	glGenBuffers(1, &vertexBufferObject);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertexData), cubeVertexData, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glGenBuffers(1, &indexBufferObject);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObject);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndexData), cubeIndexData, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObject);
-	glBindVertexArray(0);
-
-	vaoSize = sizeof(cubeIndexData) / sizeof(cubeIndexData[0]);
-}
-
-void Cube::draw() const
-{
-	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, vaoSize, GL_UNSIGNED_SHORT, 0);
-	glBindVertexArray(0);
+	for (size_t i = 0; i < sizeof(cubeVertexData) / sizeof(cubeVertexData[0]); i++)
+	{
+		MeshVertex v = { cubeVertexData[i], glm::vec3(0.0f), glm::vec2(0.0f) };
+		vertexData.push_back(v);
+	}
+	indexData.assign(cubeIndexData, cubeIndexData + sizeof(cubeIndexData) / sizeof(cubeIndexData[0]));
+	MeshRange range = { 0, (GLsizei)indexData.size(), 0 };
+	lodRanges.assign(1, range);
 }
 
 glm::mat4 Cube::getModelToWorldMat() const
@@ -295,9 +171,3 @@ void Cube::setScale(const glm::vec3 &sc)
 {
 	scale = sc;
 }
-
-Cube::~Cube()
-{
-	glDeleteBuffers(1, &vertexBufferObject);
-	glDeleteBuffers(1, &indexBufferObject);
-}
\ No newline at end of file
@@ -0,0 +1,503 @@
+#include "sceneStore.h"
+#include "textureContainer.h"
+#include "settings.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <type_traits>
+#ifdef _WIN32
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+
+const char *sceneMeshNames[SCENE_MESH_COUNT] = { "plane", "sphere" };
+
+// the scenes --cook turns into binaries
+static const char *const sceneFiles[] = { SCENE_FILE, LIGHTS_SCENE_FILE };
+
+// data/scenes/table.scene is cooked into data/scenes/cooked/table.gscn
+static std::string cookedScenePath(const std::string &path)
+{
+	size_t slash = path.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+	size_t dot = name.rfind('.');
+	if (dot != std::string::npos)
+		name.resize(dot);
+	return std::string(COOKED_SCENE_PATH) + name + ".gscn";
+}
+
+SceneStore::SceneStore()
+{
+	clear();
+}
+
+void SceneStore::clear()
+{
+	meshes.clear();
+	materialIds.clear();
+	textures.clear();
+	positions.clear();
+	rotations.clear();
+	scales.clear();
+	textureScales.clear();
+	parents.clear();
+	lightPositions.clear();
+	lightIntensities.clear();
+	pointLightPositions.clear();
+	pointLightIntensities.clear();
+	pointLightRadii.clear();
+	for (int i = 0; i < MATERIAL_COUNT; i++)
+	{
+		materials[i].specularColor = glm::vec4(0.0f);
+		materials[i].specularShininess = 0.0f;
+		materials[i].reflectivity = 0.0f;
+	}
+	ambient = 0.0f;
+	lightHalfDistance = 1.0f;
+	tableHalfSize = glm::vec2(0.0f);
+}
+
+bool SceneStore::load(const std::string &path)
+{
+	// an up-to-date cooked copy of a text scene is read instead
+	std::string file = path;
+	std::string cooked = cookedScenePath(path);
+	struct stat cookedStat, sourceStat;
+	if (cooked != path && stat(cooked.c_str(), &cookedStat) == 0)
+	{
+		if (stat(path.c_str(), &sourceStat) == 0 && sourceStat.st_mtime > cookedStat.st_mtime)
+			printf("%s is older than %s, cook the scenes again\n", cooked.c_str(), path.c_str());
+		else
+			file = cooked;
+	}
+
+	MappedFile mapped;
+	if (!mapped.open(file))
+	{
+		printf("Can't open scene %s\n", file.c_str());
+		return false;
+	}
+
+	clear();
+	bool loaded;
+	if (mapped.getSize() >= sizeof(uint32_t) && *(const uint32_t*)mapped.getData() == SCENE_FILE_MAGIC)
+		loaded = loadBinary(mapped.getData(), mapped.getSize());
+	else
+	{
+		mapped.close();
+		loaded = loadText(file);
+	}
+	// a cooked copy from an older build is skipped, the source is still there
+	if (!loaded && file != path)
+	{
+		clear();
+		loaded = loadText(path);
+	}
+	if (!loaded)
+	{
+		clear();
+		return false;
+	}
+	return true;
+}
+
+bool SceneStore::loadText(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "r");
+	if (!f)
+	{
+		printf("Can't open scene %s\n", path.c_str());
+		return false;
+	}
+
+	char line[512];
+	int lineNumber = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), f))
+	{
+		lineNumber++;
+		char keyword[32], name[3][32];
+		glm::vec3 a, b, c;
+		glm::vec2 uv;
+		float x, y;
+		if (sscanf(line, " %31s", keyword) != 1 || keyword[0] == '#')
+			continue;
+
+		if (!strcmp(keyword, "table"))
+			ok = sscanf(line, "%*s %f %f", &tableHalfSize.x, &tableHalfSize.y) == 2;
+		else if (!strcmp(keyword, "ambient"))
+			ok = sscanf(line, "%*s %f", &ambient) == 1;
+		else if (!strcmp(keyword, "attenuation"))
+			ok = sscanf(line, "%*s %f", &lightHalfDistance) == 1 && lightHalfDistance > 0.0f;
+		else if (!strcmp(keyword, "light"))
+		{
+			ok = sscanf(line, "%*s %f %f %f %f %f %f", &a.x, &a.y, &a.z, &b.x, &b.y, &b.z) == 6;
+			if (ok)
+				addLight(a, b);
+		}
+		else if (!strcmp(keyword, "pointLight"))
+		{
+			ok = sscanf(line, "%*s %f %f %f %f %f %f %f", &a.x, &a.y, &a.z, &b.x, &b.y, &b.z, &x) == 7 && x > 0.0f;
+			if (ok)
+				addPointLight(a, b, x);
+		}
+		else if (!strcmp(keyword, "material"))
+		{
+			glm::vec4 specular;
+			ok = sscanf(line, "%*s %31s %f %f %f %f %f %f", name[0], &specular.r, &specular.g, &specular.b, &specular.a, &x, &y) == 7;
+			int id = ok ? findName(name[0], materialNames, MATERIAL_COUNT) : -1;
+			ok = id >= 0;
+			if (ok)
+			{
+				MaterialBlock m = materials[id];
+				m.specularColor = specular;
+				m.specularShininess = x;
+				m.reflectivity = y;
+				setMaterial((MaterialId)id, m);
+			}
+		}
+		else if (!strcmp(keyword, "object"))
+		{
+			int end = 0, parent = -1;
+			ok = sscanf(line, "%*s %31s %31s %31s %f %f %f %f %f %f %f %f %f %f %f%n", name[0], name[1], name[2],
+				&a.x, &a.y, &a.z, &b.x, &b.y, &b.z, &c.x, &c.y, &c.z, &uv.x, &uv.y, &end) == 14;
+			int mesh = ok ? findName(name[0], sceneMeshNames, SCENE_MESH_COUNT) : -1;
+			int material = ok ? findName(name[1], materialNames, MATERIAL_COUNT) : -1;
+			int texture = ok ? findTexture(name[2]) : -1;
+			ok = mesh >= 0 && material >= 0 && texture >= 0;
+			if (ok && sscanf(line + end, " %31s %i", keyword, &parent) >= 1)
+				ok = !strcmp(keyword, "parent") && parent >= 0 && parent < getObjectCount();
+			if (ok)
+				addObject((SceneMesh)mesh, (MaterialId)material, (TextureId)texture, a, glm::quat(glm::radians(b)), c, uv, parent);
+		}
+		else
+			ok = false;
+	}
+	fclose(f);
+
+	if (!ok)
+		printf("Can't parse scene %s, line %i: %s", path.c_str(), lineNumber, line);
+	return ok;
+}
+
+template <typename T>
+bool SceneStore::readArray(const unsigned char *&cursor, const unsigned char *end, std::vector<T> &out, uint32_t count)
+{
+	// the arrays follow each other unpadded, so they are copied out rather than read in place; glm's types
+	// have copy constructors of their own and aren't trivially copyable, but they are plain floats underneath
+	static_assert(std::is_standard_layout<T>::value, "a cooked array is copied byte for byte");
+	if (count > (size_t)(end - cursor) / sizeof(T))
+		return false;
+	size_t bytes = count * sizeof(T);
+	out.resize(count);
+	if (bytes)
+		memcpy((void*)out.data(), cursor, bytes);
+	cursor += bytes;
+	return true;
+}
+
+bool SceneStore::loadBinary(const unsigned char *data, size_t size)
+{
+	if (size < sizeof(SceneFileHeader))
+		return false;
+	const SceneFileHeader &h = *(const SceneFileHeader*)data;
+	if (h.version != SCENE_FILE_VERSION || h.materials != MATERIAL_COUNT)
+	{
+		printf("Can't load scene: version %u with %u materials, expected %u with %u\n", h.version, h.materials,
+			SCENE_FILE_VERSION, (unsigned)MATERIAL_COUNT);
+		return false;
+	}
+	ambient = h.ambient;
+	lightHalfDistance = h.lightHalfDistance;
+	tableHalfSize = glm::vec2(h.tableHalfSize[0], h.tableHalfSize[1]);
+
+	const unsigned char *cursor = data + sizeof(SceneFileHeader);
+	const unsigned char *end = data + size;
+	std::vector<MaterialBlock> materialTable;
+	bool ok = readArray(cursor, end, meshes, h.objects) &&
+		readArray(cursor, end, materialIds, h.objects) &&
+		readArray(cursor, end, textures, h.objects) &&
+		readArray(cursor, end, positions, h.objects) &&
+		readArray(cursor, end, rotations, h.objects) &&
+		readArray(cursor, end, scales, h.objects) &&
+		readArray(cursor, end, textureScales, h.objects) &&
+		readArray(cursor, end, parents, h.objects) &&
+		readArray(cursor, end, materialTable, h.materials) &&
+		readArray(cursor, end, lightPositions, h.lights) &&
+		readArray(cursor, end, lightIntensities, h.lights) &&
+		readArray(cursor, end, pointLightPositions, h.pointLights) &&
+		readArray(cursor, end, pointLightIntensities, h.pointLights) &&
+		readArray(cursor, end, pointLightRadii, h.pointLights);
+	if (!ok)
+	{
+		printf("Can't load scene: the file is truncated\n");
+		return false;
+	}
+
+	// the same checks loadText makes, a stale or damaged cook must not index past the tables
+	for (uint32_t i = 0; i < h.objects; i++)
+		if (meshes[i] >= SCENE_MESH_COUNT || materialIds[i] >= MATERIAL_COUNT || textures[i] >= TEXTURE_COUNT ||
+			parents[i] < -1 || parents[i] >= (int32_t)i)
+		{
+			printf("Can't load scene: object %u is out of range\n", i);
+			return false;
+		}
+	std::copy(materialTable.begin(), materialTable.end(), materials);
+	return true;
+}
+
+template <typename T>
+void SceneStore::writeArray(FILE *f, const std::vector<T> &data)
+{
+	if (!data.empty())
+		fwrite(data.data(), sizeof(T), data.size(), f);
+}
+
+bool SceneStore::saveBinary(const std::string &path) const
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+	{
+		printf("Can't write scene %s\n", path.c_str());
+		return false;
+	}
+
+	SceneFileHeader h;
+	h.magic = SCENE_FILE_MAGIC;
+	h.version = SCENE_FILE_VERSION;
+	h.objects = (uint32_t)meshes.size();
+	h.lights = (uint32_t)lightPositions.size();
+	h.pointLights = (uint32_t)pointLightPositions.size();
+	h.materials = MATERIAL_COUNT;
+	h.ambient = ambient;
+	h.lightHalfDistance = lightHalfDistance;
+	h.tableHalfSize[0] = tableHalfSize.x;
+	h.tableHalfSize[1] = tableHalfSize.y;
+	fwrite(&h, sizeof(h), 1, f);
+	writeArray(f, meshes);
+	writeArray(f, materialIds);
+	writeArray(f, textures);
+	writeArray(f, positions);
+	writeArray(f, rotations);
+	writeArray(f, scales);
+	writeArray(f, textureScales);
+	writeArray(f, parents);
+	writeArray(f, std::vector<MaterialBlock>(materials, materials + MATERIAL_COUNT));
+	writeArray(f, lightPositions);
+	writeArray(f, lightIntensities);
+	writeArray(f, pointLightPositions);
+	writeArray(f, pointLightIntensities);
+	writeArray(f, pointLightRadii);
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+bool SceneStore::saveText(const std::string &path) const
+{
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f)
+	{
+		printf("Can't write scene %s\n", path.c_str());
+		return false;
+	}
+
+	fprintf(f, "table %g %g\nambient %g\nattenuation %g\n", tableHalfSize.x, tableHalfSize.y, ambient, lightHalfDistance);
+	for (size_t i = 0; i < lightPositions.size(); i++)
+		fprintf(f, "light %g %g %g  %g %g %g\n", lightPositions[i].x, lightPositions[i].y, lightPositions[i].z,
+			lightIntensities[i].r, lightIntensities[i].g, lightIntensities[i].b);
+	for (size_t i = 0; i < pointLightPositions.size(); i++)
+		fprintf(f, "pointLight %g %g %g  %g %g %g  %g\n", pointLightPositions[i].x, pointLightPositions[i].y,
+			pointLightPositions[i].z, pointLightIntensities[i].r, pointLightIntensities[i].g, pointLightIntensities[i].b,
+			pointLightRadii[i]);
+	for (int i = 0; i < MATERIAL_COUNT; i++)
+	{
+		const MaterialBlock &m = materials[i];
+		fprintf(f, "material %s  %g %g %g %g  %g %g\n", materialNames[i], m.specularColor.r, m.specularColor.g,
+			m.specularColor.b, m.specularColor.a, m.specularShininess, m.reflectivity);
+	}
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		glm::vec3 euler = glm::degrees(glm::eulerAngles(rotations[i]));
+		fprintf(f, "object %s %s %s  %g %g %g  %g %g %g  %g %g %g  %g %g", sceneMeshNames[meshes[i]],
+			materialNames[materialIds[i]], textureSources[textures[i]].name, positions[i].x, positions[i].y, positions[i].z,
+			euler.x, euler.y, euler.z, scales[i].x, scales[i].y, scales[i].z, textureScales[i].x, textureScales[i].y);
+		if (parents[i] >= 0)
+			fprintf(f, "  parent %i", parents[i]);
+		fprintf(f, "\n");
+	}
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+int SceneStore::cookAll()
+{
+	makeDirectory(COOKED_SCENE_PATH);
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(sceneFiles) / sizeof(sceneFiles[0]); i++)
+	{
+		SceneStore scene;
+		std::string outPath = cookedScenePath(sceneFiles[i]);
+		if (!scene.loadText(sceneFiles[i]) || !scene.saveBinary(outPath))
+		{
+			failed++;
+			continue;
+		}
+		printf("%s: %i objects, %i lights, %i point lights -> %s\n", sceneFiles[i], scene.getObjectCount(),
+			scene.getLightCount(), scene.getPointLightCount(), outPath.c_str());
+	}
+	return failed ? 1 : 0;
+}
+
+int SceneStore::addObject(SceneMesh mesh, MaterialId material, TextureId texture, const glm::vec3 &position,
+	const glm::quat &rotation, const glm::vec3 &scale, const glm::vec2 &textureScale, int parent)
+{
+	meshes.push_back((unsigned char)mesh);
+	materialIds.push_back((unsigned char)material);
+	textures.push_back((unsigned char)texture);
+	positions.push_back(position);
+	rotations.push_back(rotation);
+	scales.push_back(scale);
+	textureScales.push_back(textureScale);
+	parents.push_back(parent < (int)meshes.size() - 1 ? parent : -1);
+	return (int)meshes.size() - 1;
+}
+
+int SceneStore::addLight(const glm::vec3 &position, const glm::vec3 &intensity)
+{
+	lightPositions.push_back(position);
+	lightIntensities.push_back(intensity);
+	return (int)lightPositions.size() - 1;
+}
+
+int SceneStore::addPointLight(const glm::vec3 &position, const glm::vec3 &intensity, float radius)
+{
+	pointLightPositions.push_back(position);
+	pointLightIntensities.push_back(intensity);
+	pointLightRadii.push_back(radius);
+	return (int)pointLightPositions.size() - 1;
+}
+
+void SceneStore::setMaterial(MaterialId id, const MaterialBlock &material)
+{
+	materials[id] = material;
+}
+
+int SceneStore::findName(const char *name, const char *const names[], int count)
+{
+	for (int i = 0; i < count; i++)
+		if (!strcmp(name, names[i]))
+			return i;
+	return -1;
+}
+
+int SceneStore::findTexture(const char *name)
+{
+	for (int i = 0; i < TEXTURE_COUNT; i++)
+		if (!strcmp(name, textureSources[i].name))
+			return i;
+	return -1;
+}
+
+int SceneStore::getObjectCount() const
+{
+	return (int)meshes.size();
+}
+
+const std::vector<unsigned char> &SceneStore::getMeshes() const
+{
+	return meshes;
+}
+
+const std::vector<unsigned char> &SceneStore::getMaterialIds() const
+{
+	return materialIds;
+}
+
+const std::vector<unsigned char> &SceneStore::getTextures() const
+{
+	return textures;
+}
+
+const std::vector<glm::vec2> &SceneStore::getTextureScales() const
+{
+	return textureScales;
+}
+
+const std::vector<glm::vec3> &SceneStore::getPositions() const
+{
+	return positions;
+}
+
+const std::vector<glm::quat> &SceneStore::getRotations() const
+{
+	return rotations;
+}
+
+const std::vector<glm::vec3> &SceneStore::getScales() const
+{
+	return scales;
+}
+
+const std::vector<int32_t> &SceneStore::getParents() const
+{
+	return parents;
+}
+
+MaterialBlock &SceneStore::getMaterial(MaterialId id)
+{
+	return materials[id];
+}
+
+int SceneStore::getLightCount() const
+{
+	return (int)lightPositions.size();
+}
+
+const std::vector<glm::vec3> &SceneStore::getLightPositions() const
+{
+	return lightPositions;
+}
+
+const std::vector<glm::vec3> &SceneStore::getLightIntensities() const
+{
+	return lightIntensities;
+}
+
+int SceneStore::getPointLightCount() const
+{
+	return (int)pointLightPositions.size();
+}
+
+const std::vector<glm::vec3> &SceneStore::getPointLightPositions() const
+{
+	return pointLightPositions;
+}
+
+const std::vector<glm::vec3> &SceneStore::getPointLightIntensities() const
+{
+	return pointLightIntensities;
+}
+
+const std::vector<float> &SceneStore::getPointLightRadii() const
+{
+	return pointLightRadii;
+}
+
+float SceneStore::getAmbient() const
+{
+	return ambient;
+}
+
+float SceneStore::getLightHalfDistance() const
+{
+	return lightHalfDistance;
+}
+
+glm::vec2 SceneStore::getTableHalfSize() const
+{
+	return tableHalfSize;
+}
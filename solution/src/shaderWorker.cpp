@@ -26,6 +26,7 @@ GLuint ShaderWorker::createShader(GLenum eShaderType, const std::string &strShad
 		switch (eShaderType)
 		{
 		case GL_VERTEX_SHADER: strShaderType = "vertex"; break;
+		case GL_GEOMETRY_SHADER: strShaderType = "geometry"; break;
 		case GL_FRAGMENT_SHADER: strShaderType = "fragment"; break;
 		}
 		std::cerr << "Compile failure in " << strShaderType << " shader" << std::endl << strInfoLog << std::endl;
@@ -35,9 +36,11 @@ GLuint ShaderWorker::createShader(GLenum eShaderType, const std::string &strShad
 	return shader;
 }
 
-GLuint ShaderWorker::createProgramFromShaders(const std::vector<GLuint> &shaderList)
+GLuint ShaderWorker::createProgramFromShaders(const std::vector<GLuint> &shaderList, bool retrievable)
 {
 	GLuint program = glCreateProgram();
+	if (retrievable)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
 	for (size_t iLoop = 0; iLoop < shaderList.size(); iLoop++)
 		glAttachShader(program, shaderList[iLoop]);
@@ -64,24 +67,43 @@ GLuint ShaderWorker::createProgramFromShaders(const std::vector<GLuint> &shaderL
 }
 
 
-GLuint ShaderWorker::createProgramFromFiles(const std::vector<shaderStringPair> &filePathList)
+GLuint ShaderWorker::createProgramFromFiles(const std::vector<shaderStringPair> &filePathList, const std::string &defines)
 {
 	std::vector<shaderStringPair> vec;
+	readSources(filePathList, defines, vec);
+	return createProgramFromSources(vec);
+}
+
+void ShaderWorker::readSources(const std::vector<shaderStringPair> &filePathList, const std::string &defines,
+	std::vector<shaderStringPair> &sources)
+{
 	for (std::vector<shaderStringPair>::const_iterator it=filePathList.begin(); it != filePathList.end(); it++)
 	{
 		std::string shaderProgram;
 		if (!loadShaderFromFile(it->second, shaderProgram))
-			vec.push_back(std::make_pair(it->first, shaderProgram));
+		{
+			insertDefines(shaderProgram, defines);
+			sources.push_back(std::make_pair(it->first, shaderProgram));
+		}
 	}
-	return loadShaders(vec);
 }
 
-GLuint ShaderWorker::loadShaders(const std::vector<shaderStringPair> &vshader)
+void ShaderWorker::insertDefines(std::string &shader, const std::string &defines)
+{
+	if (defines.empty())
+		return;
+	// #version has to stay the first directive
+	size_t pos = shader.find("#version");
+	pos = pos == std::string::npos ? 0 : shader.find('\n', pos) + 1;
+	shader.insert(pos, defines);
+}
+
+GLuint ShaderWorker::createProgramFromSources(const std::vector<shaderStringPair> &sources, bool retrievable)
 {
 	std::vector<GLuint> myshaderList;
-	for (std::vector<shaderStringPair>::const_iterator it=vshader.begin(); it != vshader.end(); it++)
+	for (std::vector<shaderStringPair>::const_iterator it=sources.begin(); it != sources.end(); it++)
 		myshaderList.push_back(createShader(it->first, it->second));
-	GLuint myProgram = createProgramFromShaders(myshaderList);
+	GLuint myProgram = createProgramFromShaders(myshaderList, retrievable);
 	std::for_each(myshaderList.begin(), myshaderList.end(), glDeleteShader);
 	return myProgram;
 }
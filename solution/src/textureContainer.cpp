@@ -0,0 +1,175 @@
+#include "textureContainer.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*=================================
+		   Mapped file
+===================================*/
+
+#ifdef _WIN32
+MappedFile::MappedFile(): data(NULL), size(0), file(INVALID_HANDLE_VALUE), mapping(NULL) { }
+
+bool MappedFile::open(const std::string &path)
+{
+	close();
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(file, &length) || length.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	data = mapping ? (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!data)
+	{
+		close();
+		return false;
+	}
+	size = (size_t)length.QuadPart;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	data = NULL;
+	size = 0;
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+}
+#else
+MappedFile::MappedFile(): data(NULL), size(0), fd(-1) { }
+
+bool MappedFile::open(const std::string &path)
+{
+	close();
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close();
+		return false;
+	}
+	void *view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+	data = (const unsigned char*)view;
+	size = st.st_size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data)
+		munmap((void*)data, size);
+	if (fd >= 0)
+		::close(fd);
+	data = NULL;
+	size = 0;
+	fd = -1;
+}
+#endif
+
+const unsigned char *MappedFile::getData() const
+{
+	return data;
+}
+
+size_t MappedFile::getSize() const
+{
+	return size;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+/*=================================
+		 Texture container
+===================================*/
+
+TextureContainer::TextureContainer(): header(NULL), levels(NULL) { }
+
+bool TextureContainer::probe(const std::string &path, const char *const sources[], int faces, bool compressionSupported)
+{
+	struct stat cooked, source;
+	if (stat(path.c_str(), &cooked) != 0)
+		return false;
+	for (int i = 0; i < faces; i++)
+		if (stat(sources[i], &source) == 0 && source.st_mtime > cooked.st_mtime)
+		{
+			printf("%s is older than %s, cook the textures again\n", path.c_str(), sources[i]);
+			return false;
+		}
+
+	TextureFileHeader h;
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	bool read = fread(&h, sizeof(h), 1, f) == 1;
+	fclose(f);
+	return read && h.magic == TEXTURE_FILE_MAGIC && h.version == TEXTURE_FILE_VERSION &&
+		h.faces == (uint32_t)faces && (h.pixelFormat != 0 || compressionSupported);
+}
+
+bool TextureContainer::open(const std::string &path)
+{
+	if (!file.open(path) || file.getSize() < sizeof(TextureFileHeader))
+		return false;
+	header = (const TextureFileHeader*)file.getData();
+	levels = (const TextureFileLevel*)(header + 1);
+
+	size_t tableEnd = sizeof(TextureFileHeader) + sizeof(TextureFileLevel) * header->faces * header->levels;
+	if (header->magic != TEXTURE_FILE_MAGIC || header->version != TEXTURE_FILE_VERSION || tableEnd > file.getSize())
+		return false;
+	for (uint32_t i = 0; i < header->faces * header->levels; i++)
+		if ((size_t)levels[i].offset + levels[i].size > file.getSize())
+			return false;
+	return true;
+}
+
+unsigned TextureContainer::prefetch() const
+{
+	// the sum keeps the reads from being optimized away
+	unsigned sum = 0;
+	for (size_t i = 0; i < file.getSize(); i += 4096)
+		sum += file.getData()[i];
+	return sum;
+}
+
+const TextureFileHeader &TextureContainer::getHeader() const
+{
+	return *header;
+}
+
+const TextureFileLevel &TextureContainer::getLevel(int face, int level) const
+{
+	return levels[face * header->levels + level];
+}
+
+const void *TextureContainer::getLevelData(int face, int level) const
+{
+	return file.getData() + getLevel(face, level).offset;
+}
@@ -0,0 +1,274 @@
+#include "textureCooker.h"
+#include "textureContainer.h"
+#include "renderHandles.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <GL/glew.h>
+#include <glimg/glimg.h>
+#ifdef _WIN32
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+
+int TextureCooker::cookAll()
+{
+	makeDirectory(COOKED_TEXTURE_PATH);
+	int failed = 0;
+	for (int i = 0; i < TEXTURE_COUNT; i++)
+	{
+		const TextureSource &src = textureSources[i];
+		std::string outPath = std::string(COOKED_TEXTURE_PATH) + src.name + ".gtex";
+		if (!cook(src.files, src.count, outPath))
+			failed++;
+	}
+	return failed ? 1 : 0;
+}
+
+bool TextureCooker::cook(const char *const files[], int count, const std::string &outPath)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::vector<unsigned char> > faceLevels;
+	std::vector<TextureFileLevel> table;
+	size_t sourceBytes = 0;
+	int width = 0, height = 0, levels = 0;
+
+	for (int face = 0; face < count; face++)
+	{
+		Image image;
+		if (!decode(files[face], image))
+			return false;
+		if (face == 0)
+		{
+			width = image.width;
+			height = image.height;
+			levels = 1 + (int)floor(log2((double)std::max(width, height)));
+		}
+		else if (image.width != width || image.height != height)
+		{
+			printf("Can't cook %s: the faces differ in size\n", outPath.c_str());
+			return false;
+		}
+		sourceBytes += image.rgb.size();
+
+		for (int level = 0; level < levels; level++)
+		{
+			if (level > 0)
+			{
+				Image next;
+				downsample(image, next);
+				image.width = next.width;
+				image.height = next.height;
+				image.rgb.swap(next.rgb);
+			}
+			faceLevels.push_back(std::vector<unsigned char>());
+			compress(image, faceLevels.back());
+			TextureFileLevel entry = { (uint32_t)image.width, (uint32_t)image.height, 0, (uint32_t)faceLevels.back().size() };
+			table.push_back(entry);
+		}
+	}
+
+	// levels start 16-byte aligned after the table
+	uint32_t offset = sizeof(TextureFileHeader) + sizeof(TextureFileLevel) * (uint32_t)table.size();
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		offset = (offset + 15) & ~15u;
+		table[i].offset = offset;
+		offset += table[i].size;
+	}
+
+	FILE *f = fopen(outPath.c_str(), "wb");
+	if (!f)
+	{
+		printf("Can't write %s\n", outPath.c_str());
+		return false;
+	}
+	TextureFileHeader header = { TEXTURE_FILE_MAGIC, TEXTURE_FILE_VERSION, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0,
+		(uint32_t)width, (uint32_t)height, (uint32_t)count, (uint32_t)levels };
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(&table[0], sizeof(TextureFileLevel), table.size(), f);
+	const char padding[16] = { 0 };
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		fwrite(padding, 1, table[i].offset - ftell(f), f);
+		fwrite(&faceLevels[i][0], 1, faceLevels[i].size(), f);
+	}
+	fclose(f);
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("%s: %ix%i x%i, %i levels, %.1f MB RGB -> %.1f MB BC1 with mips, %.0f ms\n", outPath.c_str(),
+		width, height, count, levels, sourceBytes / 1048576.0, offset / 1048576.0, ms);
+	return true;
+}
+
+bool TextureCooker::decode(const char *file, Image &image)
+{
+	try
+	{
+		std::unique_ptr<glimg::ImageSet> imageSet(glimg::loaders::stb::LoadFromFile(file));
+		glimg::SingleImage single = imageSet->GetImage(0, 0, 0);
+		glimg::ImageFormat format = single.GetFormat();
+		int comps = format.Components() == glimg::FMT_COLOR_RGBA ? 4 :
+			format.Components() == glimg::FMT_COLOR_RGB ? 3 : 0;
+		if (!comps || format.Depth() != glimg::BD_PER_COMP_8)
+		{
+			printf("Can't cook %s: only 8-bit RGB and RGBA images are supported\n", file);
+			return false;
+		}
+
+		image.width = single.GetDimensions().width;
+		image.height = single.GetDimensions().height;
+		image.rgb.resize(image.width * image.height * 3);
+		size_t stride = format.AlignByteCount(image.width * comps);
+		const unsigned char *src = (const unsigned char*)single.GetImageData();
+		for (int y = 0; y < image.height; y++)
+			for (int x = 0; x < image.width; x++)
+				memcpy(&image.rgb[(y * image.width + x) * 3], src + y * stride + x * comps, 3);
+	}
+	catch (std::exception &e)
+	{
+		printf("Can't cook %s: %s\n", file, e.what());
+		return false;
+	}
+	return true;
+}
+
+void TextureCooker::downsample(const Image &src, Image &dst)
+{
+	// 2x2 box filter, odd edges repeat their last texel
+	dst.width = std::max(1, src.width / 2);
+	dst.height = std::max(1, src.height / 2);
+	dst.rgb.resize(dst.width * dst.height * 3);
+	for (int y = 0; y < dst.height; y++)
+		for (int x = 0; x < dst.width; x++)
+		{
+			int x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+			int y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+			for (int c = 0; c < 3; c++)
+			{
+				int sum = src.rgb[(y0 * src.width + x0) * 3 + c] + src.rgb[(y0 * src.width + x1) * 3 + c] +
+					src.rgb[(y1 * src.width + x0) * 3 + c] + src.rgb[(y1 * src.width + x1) * 3 + c];
+				dst.rgb[(y * dst.width + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+}
+
+void TextureCooker::compress(const Image &image, std::vector<unsigned char> &out)
+{
+	int blocksX = (image.width + 3) / 4;
+	int blocksY = (image.height + 3) / 4;
+	out.resize(blocksX * blocksY * 8);
+
+	unsigned char pixels[16][3];
+	for (int by = 0; by < blocksY; by++)
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			// levels smaller than a block repeat their edge texels
+			for (int i = 0; i < 16; i++)
+			{
+				int x = std::min(bx * 4 + i % 4, image.width - 1);
+				int y = std::min(by * 4 + i / 4, image.height - 1);
+				memcpy(pixels[i], &image.rgb[(y * image.width + x) * 3], 3);
+			}
+			compressBlock(pixels, &out[(by * blocksX + bx) * 8]);
+		}
+}
+
+static uint16_t packColor565(const float c[3])
+{
+	int r = std::min(31, std::max(0, (int)(c[0] * 31.0f / 255.0f + 0.5f)));
+	int g = std::min(63, std::max(0, (int)(c[1] * 63.0f / 255.0f + 0.5f)));
+	int b = std::min(31, std::max(0, (int)(c[2] * 31.0f / 255.0f + 0.5f)));
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpackColor565(uint16_t c, int out[3])
+{
+	out[0] = ((c >> 11) & 31) * 255 / 31;
+	out[1] = ((c >> 5) & 63) * 255 / 63;
+	out[2] = (c & 31) * 255 / 31;
+}
+
+void TextureCooker::compressBlock(const unsigned char pixels[16][3], unsigned char *out)
+{
+	// endpoints at the extremes of the block's principal axis
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			mean[c] += pixels[i][c] / 16.0f;
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+	{
+		float d[3] = { pixels[i][0] - mean[0], pixels[i][1] - mean[1], pixels[i][2] - mean[2] };
+		cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+		cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+	}
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iter = 0; iter < 4; iter++)
+	{
+		float next[3] = { cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+			cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+			cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+		float len = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (len < 1e-6f)
+			break;
+		for (int c = 0; c < 3; c++)
+			axis[c] = next[c] / len;
+	}
+	float minT = 1e9f, maxT = -1e9f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = (pixels[i][0] - mean[0]) * axis[0] + (pixels[i][1] - mean[1]) * axis[1] + (pixels[i][2] - mean[2]) * axis[2];
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	float hi[3], lo[3];
+	for (int c = 0; c < 3; c++)
+	{
+		hi[c] = mean[c] + axis[c] * maxT;
+		lo[c] = mean[c] + axis[c] * minT;
+	}
+	uint16_t c0 = packColor565(hi), c1 = packColor565(lo);
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	// c0 > c1 selects the four-colour mode; equal endpoints give a flat block
+	int palette[4][3];
+	unpackColor565(c0, palette[0]);
+	unpackColor565(c1, palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+	uint32_t indices = 0;
+	for (int i = 0; c0 != c1 && i < 16; i++)
+	{
+		int best = 0, bestDist = 1 << 30;
+		for (int p = 0; p < 4; p++)
+		{
+			int dr = pixels[i][0] - palette[p][0], dg = pixels[i][1] - palette[p][1], db = pixels[i][2] - palette[p][2];
+			int dist = dr * dr + dg * dg + db * db;
+			if (dist < bestDist)
+			{
+				bestDist = dist;
+				best = p;
+			}
+		}
+		indices |= (uint32_t)best << (2 * i);
+	}
+
+	out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
@@ -0,0 +1,274 @@
+#include "transformKernel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TRANSFORM_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+// the AVX path is built for AVX on its own and only taken when the CPU reports it
+#if defined(__GNUC__) && !defined(__AVX__)
+#define TARGET_AVX __attribute__((target("avx")))
+#else
+#define TARGET_AVX
+#endif
+#endif
+
+TransformKernelPath TransformKernel::getBestPath()
+{
+#ifdef TRANSFORM_KERNEL_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	// the OS has to save the AVX registers as well
+	bool avx = (info[2] & (1 << 28)) && (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+#else
+	bool avx = __builtin_cpu_supports("avx") != 0;
+#endif
+	return avx ? TRANSFORM_AVX : TRANSFORM_SSE;
+#else
+	return TRANSFORM_SCALAR;
+#endif
+}
+
+const char *TransformKernel::getPathName(TransformKernelPath path)
+{
+	const char *names[TRANSFORM_PATH_COUNT] = { "scalar", "sse", "avx" };
+	return names[path];
+}
+
+void TransformKernel::run(TransformKernelPath path, const TransformArrays &in, glm::mat4 *model, glm::mat3 *normal,
+	const glm::mat4 *view, glm::mat4 *modelView)
+{
+	size_t done = 0;
+#ifdef TRANSFORM_KERNEL_X86
+	if (path == TRANSFORM_AVX)
+		done = runAvx(in, model, normal, view, modelView);
+	else if (path == TRANSFORM_SSE)
+		done = runSse(in, model, normal, view, modelView);
+#endif
+	runScalar(in, done, model, normal, view, modelView);
+}
+
+void TransformKernel::runScalar(const TransformArrays &in, size_t first, glm::mat4 *model, glm::mat3 *normal,
+	const glm::mat4 *view, glm::mat4 *modelView)
+{
+	for (size_t i = first; i < in.count; i++)
+	{
+		float x = in.rotation[0][i], y = in.rotation[1][i], z = in.rotation[2][i], w = in.rotation[3][i];
+		float xx = x * x, yy = y * y, zz = z * z;
+		float xy = x * y, xz = x * z, yz = y * z;
+		float wx = w * x, wy = w * y, wz = w * z;
+		// the columns of glm::mat3_cast
+		glm::vec3 r[3] = {
+			glm::vec3(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy)),
+			glm::vec3(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx)),
+			glm::vec3(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy)),
+		};
+		for (int c = 0; c < 3; c++)
+		{
+			float s = in.scale[c][i];
+			model[i][c] = glm::vec4(r[c] * s, 0.0f);
+			normal[i][c] = r[c] / s;
+		}
+		model[i][3] = glm::vec4(in.position[0][i], in.position[1][i], in.position[2][i], 1.0f);
+		if (modelView)
+			modelView[i] = *view * model[i];
+	}
+}
+
+#ifdef TRANSFORM_KERNEL_X86
+
+// rows hold element j of a column for four objects, those become the column of each object
+static inline void storeMat4Column(glm::mat4 *out, int column, __m128 r0, __m128 r1, __m128 r2, __m128 r3)
+{
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(&out[0][column][0], r0);
+	_mm_storeu_ps(&out[1][column][0], r1);
+	_mm_storeu_ps(&out[2][column][0], r2);
+	_mm_storeu_ps(&out[3][column][0], r3);
+}
+
+// a column of a mat3 is three floats; the fourth lane spills into the next column, which is written
+// afterwards, except for the last one
+static inline void storeMat3Column(glm::mat3 *out, int column, __m128 r0, __m128 r1, __m128 r2)
+{
+	__m128 r3 = _mm_setzero_ps();
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	__m128 rows[4] = { r0, r1, r2, r3 };
+	for (int k = 0; k < 4; k++)
+	{
+		float *dst = &out[k][column][0];
+		if (column < 2)
+			_mm_storeu_ps(dst, rows[k]);
+		else
+		{
+			_mm_storel_pi((__m64*)dst, rows[k]);
+			_mm_store_ss(dst + 2, _mm_movehl_ps(rows[k], rows[k]));
+		}
+	}
+}
+
+size_t TransformKernel::runSse(const TransformArrays &in, glm::mat4 *model, glm::mat3 *normal,
+	const glm::mat4 *view, glm::mat4 *modelView)
+{
+	const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+	__m128 v[4][4];
+	if (modelView)
+		for (int c = 0; c < 4; c++)
+			for (int j = 0; j < 4; j++)
+				v[c][j] = _mm_set1_ps((*view)[c][j]);
+
+	size_t i = 0;
+	for (; i + 4 <= in.count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(in.rotation[0] + i), y = _mm_loadu_ps(in.rotation[1] + i);
+		__m128 z = _mm_loadu_ps(in.rotation[2] + i), w = _mm_loadu_ps(in.rotation[3] + i);
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		// r[c][j] is element j of rotation column c
+		__m128 r[3][3] = {
+			{ _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), _mm_mul_ps(two, _mm_add_ps(xy, wz)), _mm_mul_ps(two, _mm_sub_ps(xz, wy)) },
+			{ _mm_mul_ps(two, _mm_sub_ps(xy, wz)), _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), _mm_mul_ps(two, _mm_add_ps(yz, wx)) },
+			{ _mm_mul_ps(two, _mm_add_ps(xz, wy)), _mm_mul_ps(two, _mm_sub_ps(yz, wx)), _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))) },
+		};
+
+		__m128 m[4][4];
+		for (int c = 0; c < 3; c++)
+		{
+			__m128 s = _mm_loadu_ps(in.scale[c] + i);
+			__m128 inv = _mm_div_ps(one, s);
+			for (int j = 0; j < 3; j++)
+				m[c][j] = _mm_mul_ps(r[c][j], s);
+			m[c][3] = zero;
+			storeMat3Column(normal + i, c, _mm_mul_ps(r[c][0], inv), _mm_mul_ps(r[c][1], inv), _mm_mul_ps(r[c][2], inv));
+		}
+		for (int j = 0; j < 3; j++)
+			m[3][j] = _mm_loadu_ps(in.position[j] + i);
+		m[3][3] = one;
+		for (int c = 0; c < 4; c++)
+			storeMat4Column(model + i, c, m[c][0], m[c][1], m[c][2], m[c][3]);
+
+		if (!modelView)
+			continue;
+		for (int c = 0; c < 4; c++)
+		{
+			__m128 mv[4];
+			for (int j = 0; j < 4; j++)
+			{
+				__m128 sum = _mm_add_ps(_mm_mul_ps(v[0][j], m[c][0]), _mm_mul_ps(v[1][j], m[c][1]));
+				sum = _mm_add_ps(sum, _mm_mul_ps(v[2][j], m[c][2]));
+				// the last row of a model matrix is 0 0 0 1
+				mv[j] = c == 3 ? _mm_add_ps(sum, v[3][j]) : sum;
+			}
+			storeMat4Column(modelView + i, c, mv[0], mv[1], mv[2], mv[3]);
+		}
+	}
+	return i;
+}
+
+// the same transposes on eight objects: every 128-bit half is transposed on its own, so the low half
+// of an output register is the column of object k and the high half the one of object k + 4
+TARGET_AVX static inline void storeMat4ColumnAvx(glm::mat4 *out, int column, __m256 r0, __m256 r1, __m256 r2, __m256 r3)
+{
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t2 = _mm256_unpackhi_ps(r0, r1), t3 = _mm256_unpackhi_ps(r2, r3);
+	__m256 rows[4] = {
+		_mm256_shuffle_ps(t0, t1, 0x44), _mm256_shuffle_ps(t0, t1, 0xEE),
+		_mm256_shuffle_ps(t2, t3, 0x44), _mm256_shuffle_ps(t2, t3, 0xEE),
+	};
+	for (int k = 0; k < 4; k++)
+	{
+		_mm_storeu_ps(&out[k][column][0], _mm256_castps256_ps128(rows[k]));
+		_mm_storeu_ps(&out[k + 4][column][0], _mm256_extractf128_ps(rows[k], 1));
+	}
+}
+
+TARGET_AVX static inline void storeMat3ColumnAvx(glm::mat3 *out, int column, __m256 r0, __m256 r1, __m256 r2)
+{
+	__m256 r3 = _mm256_setzero_ps();
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t2 = _mm256_unpackhi_ps(r0, r1), t3 = _mm256_unpackhi_ps(r2, r3);
+	__m256 rows[4] = {
+		_mm256_shuffle_ps(t0, t1, 0x44), _mm256_shuffle_ps(t0, t1, 0xEE),
+		_mm256_shuffle_ps(t2, t3, 0x44), _mm256_shuffle_ps(t2, t3, 0xEE),
+	};
+	for (int k = 0; k < 8; k++)
+	{
+		__m128 row = k < 4 ? _mm256_castps256_ps128(rows[k]) : _mm256_extractf128_ps(rows[k - 4], 1);
+		float *dst = &out[k][column][0];
+		if (column < 2)
+			_mm_storeu_ps(dst, row);
+		else
+		{
+			_mm_storel_pi((__m64*)dst, row);
+			_mm_store_ss(dst + 2, _mm_movehl_ps(row, row));
+		}
+	}
+}
+
+TARGET_AVX size_t TransformKernel::runAvx(const TransformArrays &in, glm::mat4 *model, glm::mat3 *normal,
+	const glm::mat4 *view, glm::mat4 *modelView)
+{
+	const __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f), zero = _mm256_setzero_ps();
+	__m256 v[4][4];
+	if (modelView)
+		for (int c = 0; c < 4; c++)
+			for (int j = 0; j < 4; j++)
+				v[c][j] = _mm256_set1_ps((*view)[c][j]);
+
+	size_t i = 0;
+	for (; i + 8 <= in.count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(in.rotation[0] + i), y = _mm256_loadu_ps(in.rotation[1] + i);
+		__m256 z = _mm256_loadu_ps(in.rotation[2] + i), w = _mm256_loadu_ps(in.rotation[3] + i);
+		__m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+		__m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+		__m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+		__m256 r[3][3] = {
+			{ _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), _mm256_mul_ps(two, _mm256_add_ps(xy, wz)), _mm256_mul_ps(two, _mm256_sub_ps(xz, wy)) },
+			{ _mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), _mm256_mul_ps(two, _mm256_add_ps(yz, wx)) },
+			{ _mm256_mul_ps(two, _mm256_add_ps(xz, wy)), _mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))) },
+		};
+
+		// a column at a time, so only one column of the results is live besides the rotation
+		for (int c = 0; c < 4; c++)
+		{
+			__m256 m[4];
+			if (c < 3)
+			{
+				__m256 s = _mm256_loadu_ps(in.scale[c] + i);
+				__m256 inv = _mm256_div_ps(one, s);
+				for (int j = 0; j < 3; j++)
+					m[j] = _mm256_mul_ps(r[c][j], s);
+				m[3] = zero;
+				storeMat3ColumnAvx(normal + i, c, _mm256_mul_ps(r[c][0], inv), _mm256_mul_ps(r[c][1], inv),
+					_mm256_mul_ps(r[c][2], inv));
+			}
+			else
+			{
+				for (int j = 0; j < 3; j++)
+					m[j] = _mm256_loadu_ps(in.position[j] + i);
+				m[3] = one;
+			}
+			storeMat4ColumnAvx(model + i, c, m[0], m[1], m[2], m[3]);
+
+			if (!modelView)
+				continue;
+			__m256 mv[4];
+			for (int j = 0; j < 4; j++)
+			{
+				__m256 sum = _mm256_add_ps(_mm256_mul_ps(v[0][j], m[0]), _mm256_mul_ps(v[1][j], m[1]));
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(v[2][j], m[2]));
+				mv[j] = c == 3 ? _mm256_add_ps(sum, v[3][j]) : sum;
+			}
+			storeMat4ColumnAvx(modelView + i, c, mv[0], mv[1], mv[2], mv[3]);
+		}
+	}
+	return i;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#include "transformSystem.h"
+
+TransformSystem::TransformSystem(): updated(0), kernelPath(TransformKernel::getBestPath()) { }
+
+void TransformSystem::clear()
+{
+	positions.clear();
+	rotations.clear();
+	scales.clear();
+	parents.clear();
+	dirty.clear();
+	changed.clear();
+	world.clear();
+	normal.clear();
+	updated = 0;
+}
+
+int TransformSystem::addNode(const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale, int parent)
+{
+	positions.push_back(position);
+	rotations.push_back(rotation);
+	scales.push_back(scale);
+	parents.push_back(parent < (int)parents.size() ? parent : -1);
+	dirty.push_back(1);
+	changed.push_back(0);
+	world.push_back(glm::mat4(1.0f));
+	normal.push_back(glm::mat3(1.0f));
+	return (int)positions.size() - 1;
+}
+
+void TransformSystem::setLocal(int node, const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale)
+{
+	if (positions[node] == position && rotations[node] == rotation && scales[node] == scale)
+		return;
+	positions[node] = position;
+	rotations[node] = rotation;
+	scales[node] = scale;
+	dirty[node] = 1;
+}
+
+int TransformSystem::update()
+{
+	batchNodes.clear();
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		int parent = parents[i];
+		changed[i] = dirty[i] || (parent >= 0 && changed[parent]);
+		if (changed[i])
+			batchNodes.push_back((int)i);
+	}
+	updated = (int)batchNodes.size();
+	if (!updated)
+		return 0;
+
+	TransformArrays in;
+	for (int c = 0; c < 10; c++)
+		batchComponents[c].resize(updated);
+	for (int k = 0; k < updated; k++)
+	{
+		int i = batchNodes[k];
+		for (int c = 0; c < 3; c++)
+		{
+			batchComponents[c][k] = positions[i][c];
+			batchComponents[7 + c][k] = scales[i][c];
+		}
+		for (int c = 0; c < 4; c++)
+			batchComponents[3 + c][k] = rotations[i][c];
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		in.position[c] = batchComponents[c].data();
+		in.scale[c] = batchComponents[7 + c].data();
+	}
+	for (int c = 0; c < 4; c++)
+		in.rotation[c] = batchComponents[3 + c].data();
+	in.count = updated;
+	batchModel.resize(updated);
+	batchNormal.resize(updated);
+	TransformKernel::run(kernelPath, in, batchModel.data(), batchNormal.data());
+
+	// the inverse transpose of a product is the product of the inverse transposes
+	for (int k = 0; k < updated; k++)
+	{
+		int i = batchNodes[k];
+		int parent = parents[i];
+		world[i] = parent >= 0 ? world[parent] * batchModel[k] : batchModel[k];
+		normal[i] = parent >= 0 ? normal[parent] * batchNormal[k] : batchNormal[k];
+		dirty[i] = 0;
+	}
+	return updated;
+}
+
+int TransformSystem::getNodeCount() const
+{
+	return (int)positions.size();
+}
+
+bool TransformSystem::isChanged(int node) const
+{
+	return changed[node] != 0;
+}
+
+const glm::mat4 &TransformSystem::getWorld(int node) const
+{
+	return world[node];
+}
+
+const glm::mat3 &TransformSystem::getNormal(int node) const
+{
+	return normal[node];
+}
+
+int TransformSystem::getUpdatedCount() const
+{
+	return updated;
+}
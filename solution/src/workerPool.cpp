@@ -0,0 +1,55 @@
+#include "workerPool.h"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(int count): stopping(false)
+{
+	if (count <= 0)
+		count = std::max(1, (int)std::thread::hardware_concurrency());
+	for (int i = 0; i < count; i++)
+		threads.push_back(std::thread(&WorkerPool::workerLoop, this));
+}
+
+void WorkerPool::submit(const std::function<void()> &job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	wake.notify_one();
+}
+
+int WorkerPool::getThreadCount() const
+{
+	return (int)threads.size();
+}
+
+void WorkerPool::workerLoop()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!stopping && jobs.empty())
+				wake.wait(lock);
+			// queued jobs are still run on shutdown, their owners may be waiting for them
+			if (jobs.empty())
+				return;
+			job = jobs.front();
+			jobs.pop_front();
+		}
+		job();
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+}